@@ -0,0 +1,412 @@
+/*
+ *  array.c - jobs which run once for each index in a range
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/* System Headers */
+
+#include <sys/types.h>
+#include <ctype.h>
+
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#elif defined(HAVE_SYS_FCNTL_H)
+#include <sys/fcntl.h>
+#endif
+
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+/* Local headers */
+
+#include "array.h"
+#include "jobattr.h"
+#include "spool.h"
+
+/* Macros */
+
+#define FIELD_WIDTH 10		/* of next and failed in the header */
+#define TAKEN_WIDTH (ARRAY_WINDOW / 4)	/* of taken, in hex */
+#define TAIL_WIDTH (2 * FIELD_WIDTH + TAKEN_WIDTH + 2)
+#define MARK "\n# array "
+
+/* Local functions */
+
+static int
+number(const char **p, unsigned long *ul)
+{
+    char *end;
+
+    if (!isdigit((unsigned char) **p))
+	return -1;
+    errno = 0;
+    *ul = strtoul(*p, &end, 10);
+    if (errno != 0)
+	return -1;
+    *p = end;
+    return 0;
+}
+
+static int
+hex_bits(const char **p, unsigned char *bits)
+{
+    unsigned int byte;
+    size_t i;
+
+    for (i = 0; i < ARRAY_WINDOW / 8; i++) {
+	if (!isxdigit((unsigned char) (*p)[0])
+	    || !isxdigit((unsigned char) (*p)[1])
+	    || sscanf(*p, "%2x", &byte) != 1)
+	    return -1;
+	bits[i] = byte;
+	*p += 2;
+    }
+    return 0;
+}
+
+static void
+format_tail(char *buf, size_t len, const struct job_array *a)
+{
+    size_t i, n;
+
+    n = snprintf(buf, len, "%0*lu %0*lu ", FIELD_WIDTH, a->next,
+		 FIELD_WIDTH, a->failed);
+    for (i = 0; i < ARRAY_WINDOW / 8 && n + 2 < len; i++, n += 2)
+	sprintf(buf + n, "%02x", a->taken[i]);
+}
+
+static int
+lock_file(int fd, short type)
+{
+    struct flock lock;
+
+    lock.l_type = type;
+    lock.l_whence = SEEK_SET;
+    lock.l_start = 0;
+    lock.l_len = 0;
+    return fcntl(fd, F_SETLKW, &lock);
+}
+
+static int
+locate(int fd, struct job_array *a, off_t *off)
+{
+/* Parse the array line in the header of the job file open on fd, and
+ * find where its fixed width fields start.  Returns -1 if there is no
+ * such line.
+ */
+    char buf[JOBATTR_MAX + 1];
+    char *line, *end;
+    ssize_t n;
+    size_t len;
+
+    while ((n = pread(fd, buf, JOBATTR_MAX, 0)) == -1 && errno == EINTR)
+	;
+    if (n == -1)
+	return -1;
+    buf[n] = '\0';
+
+    if ((line = strstr(buf, MARK)) == NULL
+	|| (end = strchr(line + 1, '\n')) == NULL)
+	return -1;
+    line += sizeof(MARK) - 1;
+    *end = '\0';
+    len = end - line;
+
+    if (len < TAIL_WIDTH + 4
+	|| line[len - TAIL_WIDTH - 1] != ' '
+	|| array_parse(line, a) == -1)
+	return -1;
+    *off = (line - buf) + len - TAIL_WIDTH;
+    return 0;
+}
+
+static int
+store(int fd, const struct job_array *a, off_t off)
+{
+    char buf[TAIL_WIDTH + 1];
+
+    format_tail(buf, sizeof(buf), a);
+    if (strlen(buf) != TAIL_WIDTH
+	|| pwrite(fd, buf, TAIL_WIDTH, off) != TAIL_WIDTH)
+	return -1;
+    return 0;
+}
+
+static void
+advance(struct job_array *a)
+{
+/* Move next past the indices at the start of the window which have
+ * been started, and the window with it.
+ */
+    size_t i;
+
+    while (a->taken[0] & 1) {
+	for (i = 0; i < ARRAY_WINDOW / 8; i++)
+	    a->taken[i] = (a->taken[i] >> 1)
+		| (i + 1 < ARRAY_WINDOW / 8 ? (a->taken[i + 1] & 1) << 7 : 0);
+	a->next++;
+    }
+}
+
+static long
+running_tasks(const struct job_array *a, unsigned long jobno,
+	      unsigned long index)
+{
+/* How many tasks of this array job other than index have been started
+ * and still hold their lease.
+ */
+    struct spool_scan *spool;
+    const struct spool_ent *ent;
+    long n = 0;
+
+    if ((spool = spool_open(ATJOB_DIR)) == NULL)
+	return -1;
+    while ((ent = spool_next(spool)) != NULL)
+	if (ent->queue == ARRAY_LEASE && ent->jobno == jobno
+	    && ent->ctm != index && array_taken(a, ent->ctm))
+	    n++;
+    if (errno != 0)
+	n = -1;
+    spool_close(spool);
+    return n;
+}
+
+/* Global functions */
+
+int
+array_parse(const char *spec, struct job_array *a)
+{
+/* "first-last[%limit]", as at -A takes it, optionally followed by the
+ * next index, the failed count and the started bits as they are kept in
+ * the header.  Returns -1, leaving a alone, if spec is malformed.
+ */
+    struct job_array arr;
+    const char *p = spec;
+    unsigned long first, last, ul;
+
+    memset(&arr, 0, sizeof(arr));
+    if (number(&p, &first) == -1 || *p++ != '-'
+	|| number(&p, &last) == -1
+	|| first > last || last > ARRAY_INDEX_MAX)
+	return -1;
+    arr.first = first;
+    arr.n = last - first + 1;
+    arr.next = first;
+
+    if (*p == '%') {
+	p++;
+	if (number(&p, &ul) == -1 || ul > UINT_MAX)
+	    return -1;
+	arr.limit = ul;
+    }
+    if (*p == ' ') {
+	p++;
+	if (number(&p, &arr.next) == -1 || *p++ != ' '
+	    || number(&p, &arr.failed) == -1 || *p++ != ' '
+	    || hex_bits(&p, arr.taken) == -1
+	    || arr.next < first || arr.next > last + 1 || arr.failed > arr.n)
+	    return -1;
+    }
+    if (*p != '\0')
+	return -1;
+
+    *a = arr;
+    return 0;
+}
+
+int
+array_format(const struct job_array *a, char *buf, size_t len)
+{
+/* The inverse of array_parse().  Returns -1 if buf is too short. */
+    char tail[TAIL_WIDTH + 1];
+    int n;
+
+    format_tail(tail, sizeof(tail), a);
+    n = snprintf(buf, len, "%lu-%lu%%%u %s", a->first, a->first + a->n - 1,
+		 a->limit, tail);
+    return n < 0 || (size_t) n >= len ? -1 : 0;
+}
+
+int
+array_read(const char *name, struct job_array *a)
+{
+/* Where the array job in the file name has got to. */
+    off_t off;
+    int fd, rc;
+
+    if ((fd = open(name, O_RDONLY)) < 0)
+	return -1;
+    rc = lock_file(fd, F_RDLCK) == -1 ? -1 : locate(fd, a, &off);
+    close(fd);
+    return rc;
+}
+
+int
+array_taken(const struct job_array *a, unsigned long index)
+{
+/* Whether the task with this index has been started.  Those beyond the
+ * window haven't.
+ */
+    unsigned long i;
+
+    if (index < a->next)
+	return 1;
+    if ((i = index - a->next) >= ARRAY_WINDOW)
+	return 0;
+    return (a->taken[i / 8] >> (i % 8)) & 1;
+}
+
+int
+array_started(const struct job_array *a)
+{
+/* Whether any task at all has been started. */
+    size_t i;
+
+    if (a->next > a->first)
+	return 1;
+    for (i = 0; i < ARRAY_WINDOW / 8; i++)
+	if (a->taken[i] != 0)
+	    return 1;
+    return 0;
+}
+
+int
+array_take(int fd, unsigned long jobno, unsigned long index)
+{
+/* Record that the task with this index is starting, on the job file
+ * open for writing on fd, whose lease the caller holds already.  Returns
+ * 1 if it may not start: it has been started already, it is not in the
+ * window yet, or as many tasks as the limit allows are running.  As the
+ * count is taken under the lock, atds sharing the spool keep to the
+ * limit between them.
+ */
+    struct job_array a;
+    unsigned long i;
+    off_t off;
+    long running = 0;
+    int rc = 1;
+
+    if (lock_file(fd, F_WRLCK) == -1)
+	return -1;
+    if (locate(fd, &a, &off) == -1)
+	rc = -1;
+    else if (index < a.first || index - a.first >= a.n
+	     || array_taken(&a, index) || index - a.next >= ARRAY_WINDOW)
+	rc = 1;
+    else if (a.limit > 0
+	     && (running = running_tasks(&a, jobno, index)) != 0
+	     && (running == -1 || running >= (long) a.limit))
+	rc = running == -1 ? -1 : 1;
+    else {
+	i = index - a.next;
+	a.taken[i / 8] |= 1 << (i % 8);
+	advance(&a);
+	rc = store(fd, &a, off);
+    }
+    lock_file(fd, F_UNLCK);
+    return rc;
+}
+
+int
+array_fail(int fd)
+{
+/* Count one more task as failed. */
+    struct job_array a;
+    off_t off;
+    int rc;
+
+    if (lock_file(fd, F_WRLCK) == -1)
+	return -1;
+    if ((rc = locate(fd, &a, &off)) == 0 && a.failed < a.n) {
+	a.failed++;
+	rc = store(fd, &a, off);
+    }
+    lock_file(fd, F_UNLCK);
+    return rc;
+}
+
+#ifdef TEST_ARRAY
+
+int
+main(int argc, char **argv)
+{
+/* Write a job file for the array job spec, start the tasks given by
+ * their index in turn, or count one as failed for "f", printing what
+ * each returns, and then where the job has got to.
+ */
+    char name[] = "/tmp/arraytestXXXXXX";
+    char spec[JOBATTR_MAX], buf[JOBATTR_MAX];
+    struct job_array a;
+    unsigned long i;
+    off_t off;
+    int fd, rc, n;
+
+    if (argc < 2) {
+	fprintf(stderr, "usage: arraytest [array] [index|f ...]\n");
+	exit(EXIT_FAILURE);
+    }
+    if (array_parse(argv[1], &a) == -1) {
+	printf("Ooops...\n");
+	return 1;
+    }
+    if ((fd = mkstemp(name)) == -1) {
+	perror(name);
+	exit(EXIT_FAILURE);
+    }
+    unlink(name);
+    array_format(&a, spec, sizeof(spec));
+    n = snprintf(buf, sizeof(buf), "#!/bin/sh\n# array %s\ntrue\n", spec);
+    if (write(fd, buf, n) != n) {
+	perror(name);
+	exit(EXIT_FAILURE);
+    }
+
+    for (argv += 2; *argv != NULL; argv++) {
+	if (strcmp(*argv, "f") == 0)
+	    rc = array_fail(fd);
+	else
+	    rc = array_take(fd, 1, strtoul(*argv, NULL, 10));
+	printf("%s: %d\n", *argv, rc);
+    }
+
+    if (locate(fd, &a, &off) == -1) {
+	printf("Ooops...\n");
+	return 1;
+    }
+    printf("%lu-%lu%%%u next %lu failed %lu taken", a.first,
+	   a.first + a.n - 1, a.limit, a.next, a.failed);
+    for (i = a.next; i < a.next + ARRAY_WINDOW && i - a.first < a.n; i++)
+	if (array_taken(&a, i))
+	    printf(" %lu", i);
+    printf("\n");
+    close(fd);
+    return 0;
+}
+#endif
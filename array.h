@@ -0,0 +1,60 @@
+/*
+ *  array.h - jobs which run once for each index in a range
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _ARRAY_H
+#define _ARRAY_H
+
+#include <sys/types.h>
+#include <stddef.h>
+
+/* An array job stays in the spool as one file, whose commands atd runs
+ * once for each index from first to last, at most limit at a time (0 for
+ * no limit), with the index in ARRAY_ENV.  Its header line reads
+ * "# array first-last%limit next failed taken"; the last three fields
+ * have a fixed width, so that they can be kept up to date in place:
+ * every index below next has been started, taken has a bit for each of
+ * the ARRAY_WINDOW indices from next on which has been started ahead of
+ * it, and failed counts the tasks so far which failed.  Only indices in
+ * that window are started, so one which was passed over, as its start
+ * fell through, is still started later.  Each task has a lease of its
+ * own, named ARRAY_LEASE followed by the job number and the index, where
+ * a plain job's has the run time.
+ */
+#define ARRAY_INDEX_MAX 99999999UL
+#define ARRAY_ENV "AT_ARRAY_INDEX"
+#define ARRAY_LEASE '+'
+#define ARRAY_WINDOW 256	/* indices which may start ahead of next */
+
+struct job_array {
+    unsigned long n;		/* how many tasks, 0 if not an array */
+    unsigned long first;
+    unsigned int limit;
+    unsigned long next;
+    unsigned long failed;
+    unsigned char taken[ARRAY_WINDOW / 8];
+};
+
+int array_parse(const char *spec, struct job_array *a);
+int array_format(const struct job_array *a, char *buf, size_t len);
+int array_read(const char *name, struct job_array *a);
+int array_taken(const struct job_array *a, unsigned long index);
+int array_started(const struct job_array *a);
+int array_take(int fd, unsigned long jobno, unsigned long index);
+int array_fail(int fd);
+
+#endif
@@ -0,0 +1,71 @@
+#! /usr/bin/perl
+#
+# array.pl - test suite for the header of array jobs
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+
+use strict;
+use warnings;
+
+use Test::More 0.87;
+
+my $arraytest = "./arraytest 2>/dev/null";
+
+sub test {
+	my ($spec, $ops, $expected, $test_name) = @_;
+	$test_name = "$spec: @$ops" unless defined $test_name;
+
+	my $got = qx{$arraytest '$spec' @$ops};
+	chomp $got;
+	is($got, join("\n", @$expected), $test_name);
+}
+
+sub header {
+	my ($next, $failed, $taken) = @_;
+	return sprintf("%010d %010d %064s", $next, $failed, $taken);
+}
+
+# as at -A takes them, and as they are kept in the header
+test("1-10", [], ["1-10%0 next 1 failed 0 taken"]);
+test("0-5%3", [], ["0-5%3 next 0 failed 0 taken"]);
+test("1-10 " . header(3, 1, "05"), [],
+     ["1-10%0 next 3 failed 1 taken"], "bits beyond the last index");
+test("1-300%2 " . header(3, 1, "05" . "0" x 62), [],
+     ["1-300%2 next 3 failed 1 taken 3 5"]);
+
+# malformed specs
+test("5-4", [], ["Ooops..."]);
+test("1-", [], ["Ooops..."]);
+test("1-10%", [], ["Ooops..."]);
+test("1-100000000", [], ["Ooops..."]);
+test("1-10 0000000001 0000000000 00", [], ["Ooops..."], "short taken");
+test("1-10 " . header(12, 0, "0"), [], ["Ooops..."], "next past the end");
+test("1-10 " . header(1, 11, "0"), [], ["Ooops..."], "too many failed");
+
+# each index starts once, and only those in the range
+test("1-3", [1, 2, 3, 4, 0, 2],
+     ["1: 0", "2: 0", "3: 0", "4: 1", "0: 1", "2: 1",
+      "1-3%0 next 4 failed 0 taken"]);
+
+# started out of order, next moves up once the gap is filled
+test("1-10", [2, 4, 3],
+     ["2: 0", "4: 0", "3: 0", "1-10%0 next 1 failed 0 taken 2 3 4"]);
+test("1-10", [2, 4, 3, 1],
+     ["2: 0", "4: 0", "3: 0", "1: 0", "1-10%0 next 5 failed 0 taken"]);
+
+# only indices within ARRAY_WINDOW of next start, until the window moves
+test("1-1000", [3, 2, 258, 1, 257, 258, 259, 260],
+     ["3: 0", "2: 0", "258: 1", "1: 0", "257: 0", "258: 0", "259: 0",
+      "260: 1", "1-1000%0 next 4 failed 0 taken 257 258 259"]);
+
+# failed tasks are counted up to the number of tasks
+test("1-3", ["f", 1, "f"],
+     ["f: 0", "1: 0", "f: 0", "1-3%0 next 2 failed 2 taken"]);
+test("1-2", ["f", "f", "f"],
+     ["f: 0", "f: 0", "f: 0", "1-2%0 next 1 failed 2 taken"]);
+
+done_testing();
+1;
@@ -54,6 +54,7 @@
 #include <sys/fcntl.h>
 #endif
 
+#include <limits.h>
 #include <pwd.h>
 #include <grp.h>
 #include <signal.h>
@@ -74,12 +75,21 @@
 
 /* Local headers */
 
+#include "array.h"
 #include "at.h"
+#include "conf.h"
+#include "depend.h"
+#include "jobattr.h"
+#include "journal.h"
 #include "panic.h"
 #include "parsetime.h"
 #include "perm.h"
 #include "posixtm.h"
 #include "privs.h"
+#include "quota.h"
+#include "runtime.h"
+#include "spool.h"
+#include "window.h"
 
 /* Macros */
 
@@ -117,11 +127,22 @@ gid_t daemon_gid = (gid_t) - 3;
 
 /* File scope variables */
 
+/* Jobs live in the spool proper or, if atd has put them there, in the
+ * cold tier; everything which looks for jobs has to look in both.
+ */
+static const char *spool_dirs[] =
+{
+    ATJOB_DIR, ATCOLD_DIR
+};
+
 char *no_export[] =
 {
-    "TERM", "DISPLAY", "_", "SHELLOPTS", "BASH_VERSINFO", "EUID", "GROUPS", "PPID", "UID"
+    "TERM", "DISPLAY", "_", "SHELLOPTS", "BASH_VERSINFO", "EUID", "GROUPS", "PPID", "UID",
+    ARRAY_ENV
 };
 static int send_mail = 0;
+static struct job_attr job_attr;
+static struct quota_usage user_used, queue_used;	/* before this job */
 
 /* External variables */
 
@@ -135,13 +156,32 @@ char atqueue = 0;		/* which queue to examine for jobs (atq) */
 char atverify = 0;		/* verify time instead of queuing job */
 char *mail_rcpt = (char *) 0;   /* user to send mail to */
 char *timeformat = TIMEFORMAT_POSIX;	/* time format (atq) */
+char show_estimates = 0;	/* show atd's predictions (atq) */
+
+struct estimate {
+    char name[JOBNAME_LEN + 1];
+    time_t start;
+    long est;
+};
 
 /* Function declarations */
 
 static void sigc(int signo);
 static void alarmc(int signo);
 static char *cwdname(void);
+static int signal_atd(const char *pidfile);
+static void check_deadline(time_t runtimer);
+static void check_array(void);
+static void check_after(void);
+static void check_quota(char queue);
+static void check_size(int fd, char queue);
+static int lock_jobs(void);
+static void unlock_jobs(int fd);
+static int supersede_job(const char *name);
+static void coalesce_job(long jobno, char queue);
+static struct spool_scan *open_spool(unsigned int d);
 static void writefile(time_t runtimer, char queue);
+static struct estimate *load_estimates(size_t *);
 static void list_jobs(long *, int);
 static int in_job_list(long, long *, int);
 static long *get_job_list(int, char *[], int *);
@@ -232,6 +272,492 @@ nextjob()
     return jobno;
 }
 
+static int
+signal_atd(const char *pidfile)
+{
+/* Tell the atd whose pid is in pidfile that there is a new job.  Usual
+ * precautions taken...  Returns 0 if there is no such file.
+ */
+    struct stat statbuf;
+    FILE *fp;
+    pid_t pid;
+    int fd;
+    int kill_errno;
+
+    fd = open(pidfile, O_RDONLY);
+    if (fd == -1)
+	return 0;
+
+    if (fstat(fd, &statbuf) == -1) {
+	close(fd);
+	return 1;
+    }
+    if ((statbuf.st_uid != 0) || !S_ISREG(statbuf.st_mode) ||
+	(statbuf.st_mode & (S_IWGRP | S_IWOTH))) {
+	close(fd);
+	return 1;
+    }
+
+    fp = fdopen(fd, "r");
+    if (fp == NULL) {
+	close(fd);
+	return 1;
+    }
+    if (fscanf(fp, "%d", &pid) != 1) {
+	fclose(fp);
+	return 1;
+    } else {
+	fclose(fp);
+    }
+
+    kill_errno = 0;
+
+    PRIV_START
+	if (kill(pid, SIGHUP) == -1)
+	    kill_errno = errno;
+    PRIV_END
+
+	switch (kill_errno) {
+    case 0:
+	break;
+
+    case EINVAL:
+	panic("kill returned EINVAL");
+	break;
+
+    case EPERM:
+	fprintf(stderr,"Can't signal atd (permission denied)\n");
+	break;
+
+    case ESRCH:
+	fprintf(stderr, "Warning: at daemon not running\n");
+	break;
+
+    default:
+	panic("kill returned impossible error number");
+	break;
+    }
+    return 1;
+}
+
+static void
+take_calendar(void)
+{
+/* A time such as "every weekday at 09:30" makes the job recur. */
+    struct calendar cal;
+
+    if (!parsetime_every(&cal))
+	return;
+    if (job_attr.every.unit != 0) {
+	fprintf(stderr, "Cannot give a repeat interval and a calendar.\n");
+	exit(EXIT_FAILURE);
+    }
+    job_attr.every.unit = RECUR_CALENDAR;
+    job_attr.every.n = 1;
+    job_attr.every.cal = cal;
+}
+
+static void
+take_spread(void)
+{
+/* A time such as "between 02:00 and 03:00" lets atd start the job any
+ * time in that hour.
+ */
+    long spread;
+
+    if ((spread = parsetime_spread()) == 0)
+	return;
+    if (job_attr.spread != 0) {
+	fprintf(stderr, "Cannot give a spread and a time range.\n");
+	exit(EXIT_FAILURE);
+    }
+    job_attr.spread = spread < JOBATTR_SPREAD_MAX ? spread : JOBATTR_SPREAD_MAX;
+}
+
+static void
+check_array(void)
+{
+/* The tasks of an array job all run off the one job file, which a
+ * recurring job would need for its next run.
+ */
+    if (job_attr.array.n != 0 && job_attr.every.unit != 0) {
+	fprintf(stderr, "An array job cannot recur.\n");
+	exit(EXIT_FAILURE);
+    }
+}
+
+static void
+check_deadline(time_t runtimer)
+{
+/* A deadline must leave the job time to run, and only makes sense for a
+ * job which runs once.
+ */
+    if (job_attr.deadline == 0)
+	return;
+
+    if (job_attr.every.unit != 0) {
+	fprintf(stderr, "A recurring job cannot have a deadline.\n");
+	exit(EXIT_FAILURE);
+    }
+
+    if (job_attr.deadline <= runtimer) {
+	fprintf(stderr, "Deadline is before the job is due.\n");
+	exit(EXIT_FAILURE);
+    }
+    if (job_attr.runtime >= 0
+	&& runtimer + job_attr.runtime > job_attr.deadline)
+	fprintf(stderr, "warning: job cannot finish by its deadline\n");
+}
+
+static void
+check_quota(char queue)
+{
+/* Refuse a job which would take its owner or its queue over a limit in
+ * at.conf.  We hold the lock on the job sequence file, so nobody else
+ * can queue one in the meantime.  How big the job is isn't known yet;
+ * check_size() sees to that once it has been written.
+ */
+    const struct conf_ent *u, *q;
+    char msg[160];
+    unsigned int d;
+    int badline;
+    time_t t = time(NULL);
+
+    (void) conf_load(&badline);
+    u = conf_user(real_uid);
+    q = conf_queue(queue);
+    memset(&user_used, 0, sizeof(user_used));
+    memset(&queue_used, 0, sizeof(queue_used));
+
+    if (u->maxjobs != 0 || u->maxbytes != 0
+	|| q->maxjobs != 0 || q->maxbytes != 0)
+	for (d = 0; d < sizeof(spool_dirs) / sizeof(spool_dirs[0]); d++)
+	    if (quota_count(spool_dirs[d], real_uid, queue, &user_used,
+			    &queue_used) == -1)
+		perr("Cannot read %s", spool_dirs[d]);
+    if ((u->maxrate != 0 || q->maxrate != 0)
+	&& quota_recent(real_uid, queue, t, &user_used, &queue_used) == -1)
+	perr("Cannot read " ATSUBMITS);
+
+    msg[0] = '\0';
+    if (u->maxjobs != 0 && user_used.jobs >= u->maxjobs)
+	snprintf(msg, sizeof(msg),
+		 "Quota exceeded: you have %lu jobs queued (limit %u)",
+		 user_used.jobs, u->maxjobs);
+    else if (q->maxjobs != 0 && queue_used.jobs >= q->maxjobs)
+	snprintf(msg, sizeof(msg),
+		 "Quota exceeded: queue %c has %lu jobs queued (limit %u)",
+		 queue, queue_used.jobs, q->maxjobs);
+    else if (u->maxbytes != 0 && user_used.bytes >= u->maxbytes)
+	snprintf(msg, sizeof(msg),
+		 "Quota exceeded: your jobs take %llu bytes (limit %llu)",
+		 user_used.bytes, u->maxbytes);
+    else if (q->maxbytes != 0 && queue_used.bytes >= q->maxbytes)
+	snprintf(msg, sizeof(msg), "Quota exceeded: the jobs in queue %c "
+		 "take %llu bytes (limit %llu)",
+		 queue, queue_used.bytes, q->maxbytes);
+    else if (u->maxrate != 0 && user_used.recent >= u->maxrate)
+	snprintf(msg, sizeof(msg), "Quota exceeded: you have queued %lu "
+		 "jobs in the last hour (limit %u)",
+		 user_used.recent, u->maxrate);
+    else if (q->maxrate != 0 && queue_used.recent >= q->maxrate)
+	snprintf(msg, sizeof(msg), "Quota exceeded: %lu jobs have been "
+		 "queued in queue %c in the last hour (limit %u)",
+		 queue_used.recent, queue, q->maxrate);
+    if (msg[0] != '\0')
+	panic(msg);
+
+    if ((u->maxrate != 0 || q->maxrate != 0)
+	&& quota_note(real_uid, queue, t) == -1)
+	perr("Cannot write " ATSUBMITS);
+}
+
+static void
+check_size(int fd, char queue)
+{
+/* Take the job back out if it is too big to fit in its owner's or its
+ * queue's share of the spool.
+ */
+    const struct conf_ent *u = conf_user(real_uid), *q = conf_queue(queue);
+    struct stat st;
+    char msg[160];
+
+    if (u->maxbytes == 0 && q->maxbytes == 0)
+	return;
+    if (fstat(fd, &st) == -1)
+	perr("Cannot stat job file");
+
+    if (u->maxbytes != 0 && user_used.bytes + st.st_size > u->maxbytes) {
+	snprintf(msg, sizeof(msg), "Quota exceeded: your jobs would take "
+		 "%llu bytes (limit %llu)", user_used.bytes + st.st_size,
+		 u->maxbytes);
+	panic(msg);
+    }
+    if (q->maxbytes != 0 && queue_used.bytes + st.st_size > q->maxbytes) {
+	snprintf(msg, sizeof(msg), "Quota exceeded: the jobs in queue %c "
+		 "would take %llu bytes (limit %llu)", queue,
+		 queue_used.bytes + st.st_size, q->maxbytes);
+	panic(msg);
+    }
+}
+
+static int
+lock_jobs(void)
+{
+/* Take the lock on the job sequence file, which is held while a job
+ * number is picked and while jobs are put into or taken out of the spool
+ * on behalf of a new one.
+ */
+    struct sigaction act;
+    struct flock lock;
+    int fd;
+
+    if ((fd = open(LFILE, O_WRONLY)) < 0)
+	perr("Cannot open lockfile " LFILE);
+
+    lock.l_type = F_WRLCK;
+    lock.l_whence = SEEK_SET;
+    lock.l_start = 0;
+    lock.l_len = 0;
+
+    memset(&act, 0, sizeof act);
+    act.sa_handler = alarmc;
+    sigemptyset(&(act.sa_mask));
+    act.sa_flags = 0;
+
+    /* Set an alarm so a timeout occurs after ALARMC seconds, in case
+     * something is seriously broken.
+     */
+    sigaction(SIGALRM, &act, NULL);
+    alarm(ALARMC);
+    fcntl(fd, F_SETLKW, &lock);
+    alarm(0);
+
+    return fd;
+}
+
+static void
+unlock_jobs(int fd)
+{
+    struct flock lock;
+
+    lock.l_type = F_UNLCK;
+    lock.l_whence = SEEK_SET;
+    lock.l_start = 0;
+    lock.l_len = 0;
+    fcntl(fd, F_SETLKW, &lock);
+    close(fd);
+}
+
+static int
+supersede_job(const char *name)
+{
+/* Take a queued job out of the spool, unless atd has already started it.
+ * Holding its lease meanwhile keeps atd from starting it now; we look for
+ * it in both tiers twice over, in case atd is moving it between them.
+ * Returns 1 if it was taken out.
+ */
+    char lease[sizeof(ATJOB_DIR) + JOBNAME_LEN + 1];
+    char path[sizeof(ATCOLD_DIR) + JOBNAME_LEN + 1];
+    unsigned int d, tries;
+    int fd, removed = 0;
+
+    snprintf(lease, sizeof(lease), ATJOB_DIR "/=%s", name + 1);
+
+    PRIV_START
+
+	fd = open(lease, O_WRONLY | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+
+    PRIV_END
+
+    if (fd < 0) {
+	if (errno == EEXIST)
+	    return 0;		/* running, or being started */
+	perr("Cannot lock job %.100s", name);
+    }
+
+    PRIV_START
+
+	for (tries = 0; tries < 2 && !removed; tries++)
+	    for (d = 0; d < sizeof(spool_dirs) / sizeof(spool_dirs[0]); d++) {
+		snprintf(path, sizeof(path), "%s/%s", spool_dirs[d], name);
+		if (unlink(path) == 0) {
+		    removed = 1;
+		    break;
+		}
+		if (errno != ENOENT) {
+		    unlink(lease);
+		    perr("Cannot unlink %.500s", path);
+		}
+	    }
+	unlink(lease);
+	close(fd);
+
+    PRIV_END
+
+    return removed;
+}
+
+static void
+coalesce_job(long jobno, char queue)
+{
+/* Deal with our queued jobs which have the same key as this one, before
+ * atd can see it.  We hold the lock on the job sequence file, so of two
+ * jobs with one key which are being queued at once, the second to get
+ * here finds the first.  Under the "keep" policy this one is dropped in
+ * favour of the one queued already, and we don't return; otherwise it
+ * supersedes them.  Jobs atd has started are left alone either way.
+ */
+    const struct conf_ent *u = conf_user(real_uid), *q = conf_queue(queue);
+    struct spool_scan *spool;
+    const struct spool_ent *ent;
+    struct job_attr other;
+    char path[sizeof(ATCOLD_DIR) + JOBNAME_LEN + 1];
+    unsigned int policy, d;
+    int fd, rc;
+
+    policy = u->coalesce != 0 ? u->coalesce : q->coalesce;
+
+    for (d = 0; d < sizeof(spool_dirs) / sizeof(spool_dirs[0]); d++) {
+	PRIV_START
+	spool = spool_open(spool_dirs[d]);
+	PRIV_END
+
+	if (spool == NULL) {
+	    if (d > 0 && errno == ENOENT)
+		continue;
+	    perr("Cannot open %s", spool_dirs[d]);
+	}
+
+	for (;;) {
+	    PRIV_START
+	    ent = spool_next(spool);
+	    PRIV_END
+
+	    if (ent == NULL) {
+		if (errno != 0)
+		    perr("Cannot read %s", spool_dirs[d]);
+		break;
+	    }
+
+	    /* Only whole jobs of ours; a running one has a lease instead,
+	     * or, if it recurs, is found to have one below.
+	     */
+	    if (!S_ISREG(ent->st.st_mode) || !isalpha((unsigned char) ent->queue)
+		|| ent->st.st_uid != real_uid || !(ent->st.st_mode & S_IXUSR)
+		|| ent->jobno == (unsigned long) jobno)
+		continue;
+
+	    /* Our own files, which we read as ourselves. */
+	    snprintf(path, sizeof(path), "%s/%s", spool_dirs[d], ent->name);
+	    if ((fd = open(path, O_RDONLY)) < 0)
+		continue;
+	    rc = jobattr_read(fd, &other);
+	    close(fd);
+	    if (rc == -1 || strcmp(other.key, job_attr.key) != 0)
+		continue;
+
+	    if (policy == CONF_COALESCE_KEEP) {
+		setregid(real_gid, effective_gid);
+		unlink(atfile);
+		setregid(effective_gid, real_gid);
+		fprintf(stderr, "job %lu with key %s is queued already\n",
+			ent->jobno, job_attr.key);
+		exit(EXIT_SUCCESS);
+	    }
+	    if (supersede_job(ent->name)) {
+		PRIV_START
+		depend_note(ent->jobno, real_uid, STATUS_REMOVED);
+		PRIV_END
+		fprintf(stderr, "job %lu superseded\n", ent->jobno);
+	    }
+	}
+	spool_close(spool);
+    }
+}
+
+static int
+find_job(unsigned long jobno, uid_t *uid)
+{
+/* Look for a job in the spool, queued or running. */
+    struct spool_scan *spool;
+    const struct spool_ent *ent;
+    unsigned int d;
+    int found = 0;
+
+    for (d = 0; d < sizeof(spool_dirs) / sizeof(spool_dirs[0]) && !found;
+	 d++) {
+	PRIV_START
+	spool = spool_open(spool_dirs[d]);
+	PRIV_END
+
+	if (spool == NULL)
+	    continue;
+
+	for (;;) {
+	    PRIV_START
+	    ent = spool_next(spool);
+	    PRIV_END
+
+	    if (ent == NULL) {
+		if (errno != 0)
+		    perr("Cannot read %s", spool_dirs[d]);
+		break;
+	    }
+	    if (ent->jobno == jobno) {
+		*uid = ent->st.st_uid;
+		found = 1;
+		break;
+	    }
+	}
+	spool_close(spool);
+    }
+    return found;
+}
+
+static void
+check_after(void)
+{
+/* The jobs a new one waits for must exist, or have existed, and belong to
+ * the same user.  Jobs queued by an at which didn't record them are
+ * recorded as pending now.
+ */
+    unsigned long jobno;
+    uid_t uid;
+    int i, status, cwd;
+
+    if (job_attr.after.n == 0)
+	return;
+
+    if ((cwd = open(".", O_RDONLY)) < 0)
+	perr("Cannot open current directory");
+
+    PRIV_START
+	depend_load();
+    PRIV_END
+
+    for (i = 0; i < job_attr.after.n; i++) {
+	jobno = job_attr.after.d[i].jobno;
+	if (!depend_status(jobno, &uid, &status)) {
+	    if (!find_job(jobno, &uid)) {
+		fprintf(stderr, "Cannot find jobid %lu\n", jobno);
+		exit(EXIT_FAILURE);
+	    }
+	    PRIV_START
+		depend_note(jobno, uid, STATUS_PENDING);
+	    PRIV_END
+	}
+	if (uid != real_uid && real_uid != 0) {
+	    fprintf(stderr, "%lu: Not owner\n", jobno);
+	    exit(EXIT_FAILURE);
+	}
+    }
+
+    if (fchdir(cwd) == -1)
+	perr("Cannot change back to the current directory");
+    close(cwd);
+}
+
 static void
 writefile(time_t runtimer, char queue)
 {
@@ -247,12 +773,11 @@ writefile(time_t runtimer, char queue)
     char **atenv;
     int ch;
     mode_t cmask;
-    struct flock lock;
     struct tm *runtime;
     char timestr[TIMESIZE];
-    pid_t pid;
+    char pidfile[sizeof(PIDFILE) + 4];
     int istty;
-    int kill_errno;
+    int found, i;
     int rc;
     int mailsize = 128;
 
@@ -286,25 +811,9 @@ writefile(time_t runtimer, char queue)
 
     PRIV_START
 
-	if ((lockdes = open(LFILE, O_WRONLY)) < 0)
-	    perr("Cannot open lockfile " LFILE);
+	lockdes = lock_jobs();
 
-	lock.l_type = F_WRLCK;
-	lock.l_whence = SEEK_SET;
-	lock.l_start = 0;
-	lock.l_len = 0;
-
-	act.sa_handler = alarmc;
-	sigemptyset(&(act.sa_mask));
-	act.sa_flags = 0;
-
-	/* Set an alarm so a timeout occurs after ALARMC seconds, in case
-	 * something is seriously broken.
-	 */
-	sigaction(SIGALRM, &act, NULL);
-	alarm(ALARMC);
-	fcntl(lockdes, F_SETLKW, &lock);
-	alarm(0);
+	check_quota(queue);
 
 	if ((jobno = nextjob()) == EOF)
 	    perr("Cannot generate job number");
@@ -353,12 +862,7 @@ writefile(time_t runtimer, char queue)
 
     /* Now we can release the lock, so other people can access it
      */
-    lock.l_type = F_UNLCK;
-    lock.l_whence = SEEK_SET;
-    lock.l_start = 0;
-    lock.l_len = 0;
-    fcntl(lockdes, F_SETLKW, &lock);
-    close(lockdes);
+    unlock_jobs(lockdes);
 
     if ((fp = fdopen(fd, "w")) == NULL)
 	panic("Cannot reopen atjob file");
@@ -402,6 +906,11 @@ writefile(time_t runtimer, char queue)
     fprintf(fp, "#!/bin/sh\n# atrun uid=%d gid=%d\n# mail %s %d\n",
 	    real_uid, real_gid, mailname, send_mail);
 
+    /* A recurring job counts its runs from the first. */
+    if (job_attr.every.unit != 0)
+	job_attr.every.start = runtimer / 60 * 60;
+    jobattr_write(fp, &job_attr);
+
     /* Write out the umask at the time of invocation
      */
     fprintf(fp, "umask %lo\n", (unsigned long) cmask);
@@ -533,14 +1042,34 @@ writefile(time_t runtimer, char queue)
 	panic("Input error");
 
     fclose(fp);
+    check_size(fd2, queue);
+
+    /* A job with a key goes in together with taking out the one it
+     * supersedes.
+     */
+    if (job_attr.key[0] != '\0') {
+	PRIV_START
+	    lockdes = lock_jobs();
+	PRIV_END
+	coalesce_job(jobno, queue);
+    }
 
-    /* Set the x bit so that we're ready to start executing
+    /* Set the x bit so that we're ready to start executing.  The file
+     * belongs to the daemon group, which may read it to find out how
+     * long the same commands took before.
      */
 
-    if (fchmod(fd2, S_IRUSR | S_IWUSR | S_IXUSR) < 0)
+    PRIV_START
+	depend_note(jobno, real_uid, STATUS_PENDING);
+	journal_note(JOURNAL_QUEUED, ppos, getpid());
+    PRIV_END
+
+    if (fchmod(fd2, S_IRUSR | S_IWUSR | S_IXUSR | S_IRGRP) < 0)
 	perr("Cannot give away file");
 
     close(fd2);
+    if (job_attr.key[0] != '\0')
+	unlock_jobs(lockdes);
 
     /* This line maybe superfluous after commit 11cb731bb560eb7bff4889c5528d5f776606b0d3 */
     runtime = localtime(&runtimer);
@@ -548,62 +1077,16 @@ writefile(time_t runtimer, char queue)
     strftime(timestr, TIMESIZE, timeformat, runtime);
     fprintf(stderr, "job %ld at %s\n", jobno, timestr);
 
-    /* Signal atd, if present. Usual precautions taken... */
-    fd = open(PIDFILE, O_RDONLY);
-    if (fd == -1) {
-	fprintf(stderr, "Can't open " PIDFILE " to signal atd. No atd running?\n");
-	return;
-    }
-
-    if (fstat(fd, &statbuf) == -1) {
-	close(fd);
-	return;
-    }
-    if ((statbuf.st_uid != 0) || !S_ISREG(statbuf.st_mode) ||
-	(statbuf.st_mode & (S_IWGRP | S_IWOTH))) {
-	close(fd);
-	return;
-    }
-
-    fp = fdopen(fd, "r");
-    if (fp == NULL) {
-	close(fd);
-	return;
-    }
-    if (fscanf(fp, "%d", &pid) != 1) {
-	fclose(fp);
-	return;
-    } else {
-	fclose(fp);
-    }
-
-    kill_errno = 0;
-
-    PRIV_START
-	if (kill(pid, SIGHUP) == -1)
-	    kill_errno = errno;
-    PRIV_END
-
-	switch (kill_errno) {
-    case 0:
-	break;
-
-    case EINVAL:
-	panic("kill returned EINVAL");
-	break;
-
-    case EPERM:
-	fprintf(stderr,"Can't signal atd (permission denied)\n");
-	break;
-
-    case ESRCH:
-	fprintf(stderr, "Warning: at daemon not running\n");
-	break;
-
-    default:
-	panic("kill returned impossible error number");
-	break;
+    /* Signal atd, if present, and every instance of it sharing the
+     * spool.
+     */
+    found = signal_atd(PIDFILE);
+    for (i = 0; i < ATD_INSTANCES_MAX; i++) {
+	snprintf(pidfile, sizeof(pidfile), PIDFILE ".%d", i);
+	found += signal_atd(pidfile);
     }
+    if (!found)
+	fprintf(stderr, "Can't open " PIDFILE " to signal atd. No atd running?\n");
     return;
 }
 
@@ -619,65 +1102,157 @@ in_job_list(long job, long *joblist, int len)
     return 0;
 }
 
+static struct spool_scan *
+open_spool(unsigned int d)
+{
+    /* Change into and open the d-th spool directory.  The cold tier
+     * only exists once atd has put something there.
+     */
+    struct spool_scan *spool;
+
+    if (chdir(spool_dirs[d]) != 0) {
+	if (d > 0 && errno == ENOENT)
+	    return NULL;
+	perr("Cannot change to %s", spool_dirs[d]);
+    }
+
+    if ((spool = spool_open(".")) == NULL)
+	perr("Cannot open %s", spool_dirs[d]);
+
+    return spool;
+}
+
+static int
+estimate_cmp(const void *a, const void *b)
+{
+    return strcmp(((const struct estimate *) a)->name,
+		  ((const struct estimate *) b)->name);
+}
+
+static struct estimate *
+load_estimates(size_t *n)
+{
+    /* Read atd's latest predictions, sorted by job file name.
+     */
+    struct estimate *e = NULL, *p;
+    size_t alloc = 0;
+    char line[64];
+    long start;
+    FILE *fp;
+
+    *n = 0;
+    if ((fp = fopen(ATESTIMATES, "r")) == NULL)
+	return NULL;
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+	if (*n == alloc) {
+	    alloc = alloc ? 2 * alloc : 64;
+	    if ((p = realloc(e, alloc * sizeof(*e))) == NULL)
+		break;
+	    e = p;
+	}
+	if (sscanf(line, "%14s %ld %ld", e[*n].name, &start, &e[*n].est) != 3
+	    || strlen(e[*n].name) != JOBNAME_LEN)
+	    continue;
+	e[(*n)++].start = (time_t) start;
+    }
+    fclose(fp);
+
+    if (*n > 0)
+	qsort(e, *n, sizeof(*e), estimate_cmp);
+    return e;
+}
+
 static void
 list_jobs(long *joblist, int len)
 {
     /* List all a user's jobs in the queue, by looping through ATJOB_DIR, 
      * or everybody's if we are root
      */
-    DIR *spool;
-    struct dirent *dirent;
-    struct stat buf;
+    struct spool_scan *spool;
+    const struct spool_ent *ent;
     struct tm *runtime;
-    unsigned long ctm;
-    char queue;
-    long jobno;
     time_t runtimer;
     char timestr[TIMESIZE];
     struct passwd *pwd;
+    unsigned int d;
+    struct estimate *estimates = NULL, key, *e;
+    size_t nestimates = 0;
 
     PRIV_START
 
-    if (chdir(ATJOB_DIR) != 0)
-	perr("Cannot change to " ATJOB_DIR);
-
-    if ((spool = opendir(".")) == NULL)
-	perr("Cannot open " ATJOB_DIR);
+    if (show_estimates)
+	estimates = load_estimates(&nestimates);
 
-    /*  Loop over every file in the directory 
-     */
-    while ((dirent = readdir(spool)) != NULL) {
-	if (stat(dirent->d_name, &buf) != 0)
-	    perr("Cannot stat in " ATJOB_DIR);
-
-	/* See it's a regular file and is the user's */
-	if (!S_ISREG(buf.st_mode)
-	    || ((buf.st_uid != real_uid) && !(real_uid == 0))
-	    || atverify)
-	    continue;
-
-	if (sscanf(dirent->d_name, "%c%5lx%8lx", &queue, &jobno, &ctm) != 3)
-	    continue;
-
-	/* If jobs are given, only list those jobs */
-	if (joblist && !in_job_list(jobno, joblist, len))
-	    continue;
-
-	if (atqueue && (queue != atqueue))
+    for (d = 0; d < sizeof(spool_dirs) / sizeof(spool_dirs[0]); d++) {
+	if ((spool = open_spool(d)) == NULL)
 	    continue;
 
-	runtimer = 60 * (time_t) ctm;
-	runtime = localtime(&runtimer);
-
-	strftime(timestr, TIMESIZE, timeformat, runtime);
+	/*  Loop over every job in the directory 
+	 */
+	while ((ent = spool_next(spool)) != NULL) {
+
+	    /* See it's a regular file and is the user's; the tasks of an
+	     * array job show as the job itself.
+	     */
+	    if (!S_ISREG(ent->st.st_mode)
+		|| ((ent->st.st_uid != real_uid) && !(real_uid == 0))
+		|| ent->queue == ARRAY_LEASE || atverify)
+		continue;
+
+	    /* If jobs are given, only list those jobs */
+	    if (joblist && !in_job_list(ent->jobno, joblist, len))
+		continue;
+
+	    if (atqueue && (ent->queue != atqueue))
+		continue;
+
+	    runtimer = 60 * (time_t) ent->ctm;
+	    runtime = localtime(&runtimer);
+
+	    strftime(timestr, TIMESIZE, timeformat, runtime);
+
+	    if ((pwd = getpwuid(ent->st.st_uid)))
+	      printf("%ld\t%s %c %s", ent->jobno, timestr, ent->queue,
+		     pwd->pw_name);
+	    else
+	      printf("%ld\t%s %c", ent->jobno, timestr, ent->queue);
+
+	    /* Jobs atd hasn't looked at yet start when they're due, as
+	     * far as we know.
+	     */
+	    if (show_estimates) {
+		memcpy(key.name, ent->name, sizeof(key.name));
+		e = estimates == NULL ? NULL
+		    : bsearch(&key, estimates, nestimates, sizeof(*e),
+			      estimate_cmp);
+		if (e != NULL)
+		    runtimer = e->start;
+		else if (runtimer < time(NULL))
+		    runtimer = 0;
+
+		if (runtimer != 0) {
+		    runtime = localtime(&runtimer);
+		    strftime(timestr, TIMESIZE, timeformat, runtime);
+		    printf("\t%s", timestr);
+		}
+		else
+		    printf("\t?");
+
+		if (e != NULL && e->est >= 0)
+		    printf(" %ld:%02ld:%02ld", e->est / 3600, e->est / 60 % 60,
+			   e->est % 60);
+		else
+		    printf(" ?");
+	    }
+	    putchar('\n');
+	}
+	if (errno != 0)
+	    perr("Cannot read %s", spool_dirs[d]);
 
-	if ((pwd = getpwuid(buf.st_uid)))
-	  printf("%ld\t%s %c %s\n", jobno, timestr, queue, pwd->pw_name);
-	else
-	  printf("%ld\t%s %c\n", jobno, timestr, queue);
+	spool_close(spool);
     }
-
-    closedir(spool);
+    free(estimates);
 
     PRIV_END
 }
@@ -688,41 +1263,40 @@ process_jobs(int argc, char **argv, int what)
     /* Delete every argument (job - ID) given
      */
     int i;
-    struct stat buf;
-    DIR *spool;
-    struct dirent *dirent;
-    unsigned long ctm;
-    char queue;
-    long jobno;
+    struct spool_scan *spool;
+    const struct spool_ent *ent;
     int rc = EXIT_SUCCESS;
     int done;
+    unsigned int d;
 
     for (i = optind; i < argc; i++) {
 	done = 0;
+      for (d = 0; d < sizeof(spool_dirs) / sizeof(spool_dirs[0]); d++) {
     PRIV_START
 
-    if (chdir(ATJOB_DIR) != 0)
-	perr("Cannot change to " ATJOB_DIR);
-
-    if ((spool = opendir(".")) == NULL)
-	perr("Cannot open " ATJOB_DIR);
+    spool = open_spool(d);
 
     PRIV_END
 
-    /*  Loop over every file in the directory 
+	if (spool == NULL)
+	    continue;
+
+    /*  Loop over every job in the directory 
      */
-	while ((dirent = readdir(spool)) != NULL) {
+	for (;;) {
 
 	PRIV_START
-	if (stat(dirent->d_name, &buf) != 0)
-	    perr("Cannot stat in " ATJOB_DIR);
+	ent = spool_next(spool);
 	PRIV_END
 
-	    if (sscanf(dirent->d_name, "%c%5lx%8lx", &queue, &jobno, &ctm) != 3)
-	    continue;
+	    if (ent == NULL) {
+		if (errno != 0)
+		    perr("Cannot read %s", spool_dirs[d]);
+		break;
+	    }
 
-	    if (atoi(argv[i]) == jobno) {
-		if ((buf.st_uid != real_uid) && !(real_uid == 0)) {
+	    if (atoi(argv[i]) == ent->jobno) {
+		if ((ent->st.st_uid != real_uid) && !(real_uid == 0)) {
 		    fprintf(stderr, "%s: Not owner\n", argv[i]);
 		    exit(EXIT_FAILURE);
 		}
@@ -735,17 +1309,26 @@ process_jobs(int argc, char **argv, int what)
                     */
                     setregid(real_gid, effective_gid);
 
-		    if (queue == '=') {
+		    if (ent->queue == '=' || ent->queue == ARRAY_LEASE) {
 			fprintf(stderr, "Warning: deleting running job\n");
 		    }
-		    if (unlink(dirent->d_name) != 0) {
-			perr("Cannot unlink %.500s", dirent->d_name);
+		    if (unlink(ent->name) != 0) {
+			perr("Cannot unlink %.500s", ent->name);
 			rc = EXIT_FAILURE;
 		    }
 
                     setregid(effective_gid, real_gid);
 		    done = 1;
 
+		    /* Jobs waiting for this one need to know it won't run;
+		     * a running one still records how it ends.
+		     */
+		    if (ent->queue != '=' && ent->queue != ARRAY_LEASE) {
+			PRIV_START
+			depend_note(ent->jobno, ent->st.st_uid, STATUS_REMOVED);
+			PRIV_END
+		    }
+
 		    break;
 
 		case CAT:
@@ -753,8 +1336,12 @@ process_jobs(int argc, char **argv, int what)
 			FILE *fp;
 			int ch;
 
+			/* A running job's lease holds no script. */
+			if (ent->queue == '=' || ent->queue == ARRAY_LEASE)
+			    break;
+
 			setregid(real_gid, effective_gid);
-			fp = fopen(dirent->d_name, "r");
+			fp = fopen(ent->name, "r");
 
 			if (fp) {
 			    while ((ch = getc(fp)) != EOF) {
@@ -765,7 +1352,7 @@ process_jobs(int argc, char **argv, int what)
 			    fp = NULL;
 			}
 			else {
-			    perr("Cannot open %.500s", dirent->d_name);
+			    perr("Cannot open %.500s", ent->name);
 			    rc = EXIT_FAILURE;
 			}
 			setregid(effective_gid, real_gid);
@@ -780,7 +1367,8 @@ process_jobs(int argc, char **argv, int what)
 		}
 	    }
 	}
-	closedir(spool);
+	spool_close(spool);
+      }
 	if (done != 1) {
 	    fprintf(stderr, "Cannot find jobid %s\n", argv[i] );
 	    rc = EXIT_FAILURE;
@@ -834,9 +1422,10 @@ main(int argc, char **argv)
     char *pgm;
 
     int program = AT;		/* our default program */
-    char *options = "q:f:Mmu:bvlrdhVct:";	/* default options for at */
+    char *options = "q:f:Mmu:bvlrdhVct:a:A:D:E:K:L:R:T:W:w:";	/* default options for at */
     int disp_version = 0;
     time_t timer = 0;
+    char *ep;
     long *joblist = NULL;
     int joblen = 0;
     struct passwd *pwe;
@@ -844,6 +1433,8 @@ main(int argc, char **argv)
 
     RELINQUISH_PRIVS
 
+    jobattr_init(&job_attr);
+
     if ((pwe = getpwnam(DAEMON_USERNAME)) == NULL)
 	perr("Cannot get uid for " DAEMON_USERNAME);
 
@@ -867,7 +1458,7 @@ main(int argc, char **argv)
      */
     if (strcmp(pgm, "atq") == 0) {
 	program = ATQ;
-	options = "hq:Vo:";
+	options = "hq:Vo:e";
     } else if (strcmp(pgm, "atrm") == 0) {
 	program = ATRM;
 	options = "hV";
@@ -934,7 +1525,7 @@ main(int argc, char **argv)
 		usage();
 
 	    program = BATCH;
-	    options = "";
+	    options = "a:A:D:E:K:L:R:T:W:w:";
 	    break;
 
 	case 'V':
@@ -957,6 +1548,95 @@ main(int argc, char **argv)
 	    timeformat = optarg;
             break;
 
+	case 'A':
+	    if (array_parse(optarg, &job_attr.array) == -1) {
+		fprintf(stderr, "invalid index range: %s\n", optarg);
+		exit(EXIT_FAILURE);
+	    }
+	    break;
+
+	case 'D':
+	    if (!posixtime(&job_attr.deadline, optarg,
+			   PDS_LEADING_YEAR | PDS_CENTURY | PDS_SECONDS)) {
+		fprintf(stderr, "invalid date format: %s\n", optarg);
+		exit(EXIT_FAILURE);
+	    }
+	    break;
+
+	case 'E':
+	    job_attr.runtime = strtol(optarg, &ep, 10);
+	    if (ep == optarg || *ep != '\0' || job_attr.runtime <= 0
+		|| job_attr.runtime > LONG_MAX / 60) {
+		fprintf(stderr, "invalid duration: %s\n", optarg);
+		exit(EXIT_FAILURE);
+	    }
+	    job_attr.runtime *= 60;
+	    break;
+
+	case 'K':
+	    if (!jobattr_key_valid(optarg)) {
+		fprintf(stderr, "invalid key: %s\n", optarg);
+		exit(EXIT_FAILURE);
+	    }
+	    strcpy(job_attr.key, optarg);
+	    break;
+
+	case 'L':
+	    job_attr.maxlate = strtol(optarg, &ep, 10);
+	    if (ep == optarg || *ep != '\0' || job_attr.maxlate <= 0
+		|| job_attr.maxlate > LONG_MAX / 60) {
+		fprintf(stderr, "invalid lateness: %s\n", optarg);
+		exit(EXIT_FAILURE);
+	    }
+	    job_attr.maxlate *= 60;
+	    break;
+
+	case 'R':
+	    if (recur_parse(optarg, &job_attr.every) == -1
+		|| job_attr.every.start != 0) {
+		fprintf(stderr, "invalid repeat interval: %s\n", optarg);
+		exit(EXIT_FAILURE);
+	    }
+	    break;
+
+	case 'T':
+	    job_attr.timeout = strtol(optarg, &ep, 10);
+	    if (ep == optarg || *ep != '\0' || job_attr.timeout <= 0
+		|| job_attr.timeout > LONG_MAX / 60) {
+		fprintf(stderr, "invalid time limit: %s\n", optarg);
+		exit(EXIT_FAILURE);
+	    }
+	    job_attr.timeout *= 60;
+	    break;
+
+	case 'W':
+	    job_attr.spread = strtol(optarg, &ep, 10);
+	    if (ep == optarg || *ep != '\0' || job_attr.spread <= 0
+		|| job_attr.spread > JOBATTR_SPREAD_MAX / 60) {
+		fprintf(stderr, "invalid spread: %s\n", optarg);
+		exit(EXIT_FAILURE);
+	    }
+	    job_attr.spread *= 60;
+	    break;
+
+	case 'w':
+	    if (window_parse(optarg, &job_attr.window) == -1) {
+		fprintf(stderr, "invalid time window: %s\n", optarg);
+		exit(EXIT_FAILURE);
+	    }
+	    break;
+
+	case 'a':
+	    if (depend_parse(optarg, &job_attr.after) == -1) {
+		fprintf(stderr, "invalid job list: %s\n", optarg);
+		exit(EXIT_FAILURE);
+	    }
+	    break;
+
+	case 'e':
+	    show_estimates = 1;
+	    break;
+
 	default:
 	    usage();
 	    break;
@@ -1023,6 +1703,8 @@ main(int argc, char **argv)
                 exit(EXIT_FAILURE);
             }
 	    timer = parsetime(time(0), argc - optind, argv + optind);
+	    take_calendar();
+	    take_spread();
 	}
 
 	if (timer == 0) {
@@ -1042,6 +1724,9 @@ main(int argc, char **argv)
 
 	fprintf(stderr, "warning: commands will be executed using /bin/sh\n");
 
+	check_deadline(timer);
+	check_array();
+	check_after();
 	writefile(timer, queue);
 	break;
 
@@ -1057,6 +1742,8 @@ main(int argc, char **argv)
                 exit(EXIT_FAILURE);
             }
 	    timer = parsetime(time(0), argc, argv);
+	    take_calendar();
+	    take_spread();
         } else if (timer == 0)
 	    timer = time(NULL);
 
@@ -1064,6 +1751,9 @@ main(int argc, char **argv)
 	    struct tm *tm = localtime(&timer);
 	    fprintf(stderr, "%s\n", asctime(tm));
 	}
+	check_deadline(timer);
+	check_array();
+	check_after();
 	writefile(timer, queue);
 	break;
 
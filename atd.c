@@ -53,6 +53,7 @@
 #include <errno.h>
 #endif
 
+#include <math.h>
 #include <pwd.h>
 #include <grp.h>
 #include <signal.h>
@@ -74,10 +75,29 @@
 #include <syslog.h>
 #endif
 
+#include "ring.h"
+
+#ifdef USE_THREADS
+#include <pthread.h>
+#endif
+
 /* Local headers */
 
 #include "privs.h"
+#include "array.h"
+#include "cgroup.h"
+#include "conf.h"
 #include "daemon.h"
+#include "depend.h"
+#include "fairshare.h"
+#include "jobattr.h"
+#include "journal.h"
+#include "lease.h"
+#include "level.h"
+#include "runtime.h"
+#include "spool.h"
+#include "suspend.h"
+#include "window.h"
 
 #ifndef HAVE_GETLOADAVG
 #include "getloadavg.h"
@@ -93,6 +113,18 @@ int selinux_enabled = 0;
 
 #define BATCH_INTERVAL_DEFAULT 60
 #define CHECK_INTERVAL 3600
+#define RESCAN_INTERVAL 60
+#define STEAL_DELAY 30
+#define JOB_RING_SIZE 1024
+#define EVENT_RING_SIZE 256
+#define ESTIMATE_INTERVAL 10
+#define WINDOW_ROUNDS 16
+#define TIMEOUT_GRACE 30
+
+/* When the earliest job in the cold tier is due, shared by all atds on
+ * the spool.  Its leading dot keeps it from looking like a job.
+ */
+#define COLD_NEXT ATCOLD_NAME "/.next"
 
 /* Global variables */
 
@@ -106,14 +138,68 @@ gid_t daemon_gid = (gid_t) - 3;
 
 static char *namep;
 static double load_avg = LOADAVG_MX;
+static double suspend_load = 0.;
+static double suspend_cpu = 0.;
+static int use_cgroups = 0;
+static int node_jobs[PLACE_NODES_MAX];	/* our running jobs on each node */
+static struct sched_job *arrays = NULL;	/* array jobs due this pass */
+static size_t narrays = 0, arrays_alloc = 0;
 static time_t now;
 static time_t last_chg;
 static int nothing_to_do = 0;
 unsigned int batch_interval;
 static int run_as_daemon = 0;
 static int hupped = 0;
+static unsigned int cold_horizon = 0;
+static time_t cold_next = 0;
+static int cold_scan = 1;
+static time_t cold_chg = 0;
+static time_t cold_walked = 0;
+static unsigned int instance_id = 0;
+static unsigned int instances = 0;
+static FILE *estimates = NULL;
+static time_t estimates_next = 0;
+static int estimates_pending = 0;
 
 static volatile sig_atomic_t term_signal = 0;
+static volatile sig_atomic_t job_suspend = 0;
+
+#ifdef USE_THREADS
+/* The daemon proper runs as three threads: the index thread scans the
+ * spool and decides what is due, the main thread claims the jobs and
+ * forks their supervisors, and the completion thread takes all signals
+ * with sigwait() and reaps the supervisors.
+ *
+ * The main thread holds the big lock while it claims a job and forks.
+ * The index thread holds it too, except while it waits for something to
+ * do and while it reads the spool directory and stat()s its entries,
+ * which make nothing but system calls.  So no supervisor is forked while
+ * the index thread is in the middle of stdio, syslog() or a lookup,
+ * whose locks the child would inherit taken, or reloading the
+ * configuration, which supervisors go by, while a long scan of the spool
+ * doesn't hold up the jobs which are due meanwhile.  PRIV_START affects
+ * the whole process, so privileges are only switched under the lock.
+ */
+struct job_req {
+    char name[JOBNAME_LEN + 1];
+    uid_t uid;
+    gid_t gid;
+    int node;			/* NUMA node picked for it, or -1 */
+    long task;			/* index of an array job's task, or -1 */
+};
+
+struct event {
+    pid_t pid;			/* 0 for SIGHUP */
+    int status;
+};
+
+static int threaded = 0;
+static pthread_mutex_t big_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct ring job_ring;	/* index thread -> main thread */
+static struct ring event_ring;	/* completion thread -> index thread */
+static sigset_t waited;		/* what the completion thread takes */
+static sigset_t orig_mask;	/* what the jobs should get */
+#endif
 
 #ifdef HAVE_PAM
 #include <security/pam_appl.h>
@@ -150,14 +236,96 @@ set_hup(int dummy)
     return;
 }
 
-/* SIGCHLD handler - discards completion status of children */
-RETSIGTYPE
-release_zombie(int dummy)
+static unsigned long long
+lower(unsigned long long a, unsigned long long b)
 {
-  int status;
-  pid_t pid;
+/* The lower of two limits, where 0 means none. */
+    if (a == 0 || (b != 0 && b < a))
+	return b;
+    return a;
+}
+
+static void
+job_limits(char queue, uid_t uid, struct cgroup_limits *lim)
+{
+/* Where the queue and the job's owner both have a limit, the lower one
+ * applies; the owner's io_max replaces the queue's.
+ */
+    const struct cgroup_limits *q = &conf_queue(queue)->limits;
+    const struct cgroup_limits *u = &conf_user(uid)->limits;
+
+    lim->memory_high = lower(q->memory_high, u->memory_high);
+    lim->memory_max = lower(q->memory_max, u->memory_max);
+    lim->cpu_weight = lower(q->cpu_weight, u->cpu_weight);
+    lim->cpu_max = lower(q->cpu_max, u->cpu_max);
+    strcpy(lim->io_max, u->io_max[0] != '\0' ? u->io_max : q->io_max);
+}
+
+static void
+queue_prio(char queue, uid_t uid, struct job_prio *prio)
+{
+/* The owner's policy and I/O class replace the queue's; the lower
+ * utilization clamp applies.
+ */
+    const struct job_prio *q = &conf_queue(queue)->prio;
+    const struct job_prio *u = &conf_user(uid)->prio;
+
+    *prio = *q;
+    if (u->policy != 0)
+	prio->policy = u->policy;
+    if (u->ioclass != 0) {
+	prio->ioclass = u->ioclass;
+	prio->iolevel = u->iolevel;
+    }
+    if (u->uclamp_max < prio->uclamp_max)
+	prio->uclamp_max = u->uclamp_max;
+}
+
+static void
+job_place(char queue, uid_t uid, struct job_place *place)
+{
+/* Whatever placement the owner sets replaces the queue's. */
+    const struct job_place *q = &conf_queue(queue)->place;
+    const struct job_place *u = &conf_user(uid)->place;
+
+    *place = *q;
+    if (u->cpus[0] != '\0')
+	strcpy(place->cpus, u->cpus);
+    if (u->nodes[0] != '\0')
+	strcpy(place->nodes, u->nodes);
+    if (u->mempolicy != 0)
+	place->mempolicy = u->mempolicy;
+    if (u->placement != 0)
+	place->placement = u->placement;
+}
+
+static void
+signal_job(pid_t pid, int cg, int sig)
+{
+/* Signal everything belonging to a job: its cgroup if it has one, or
+ * else its process group.
+ */
+    PRIV_START
+	if (cg == -1 || cgroup_signal(cg, sig) == -1)
+	    killpg(pid, sig);
+    PRIV_END
+}
 
-  while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+static RETSIGTYPE
+set_suspend(int sig)
+{
+    job_suspend = (sig == SUSPEND_STOP);
+}
+
+static RETSIGTYPE
+job_exited(int sig)
+{
+/* Only there to wake the supervisor, which reaps the job itself. */
+}
+
+static void
+note_exit(pid_t pid, int status)
+{
 #ifdef DEBUG_ZOMBIE
     if (WIFEXITED(status))
       syslog(LOG_INFO, "pid %ld exited with status %d.", pid, WEXITSTATUS(status));
@@ -168,7 +336,17 @@ release_zombie(int dummy)
     else
       syslog(LOG_WARNING, "pid %ld unknown reason for SIGCHLD", pid);
 #endif
-  }
+}
+
+/* SIGCHLD handler - discards completion status of children */
+RETSIGTYPE
+release_zombie(int dummy)
+{
+  int status;
+  pid_t pid;
+
+  while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+    note_exit(pid, status);
   return;
 }
     
@@ -269,18 +447,46 @@ selinux_log_callback (int type, const char *fmt, ...)
 #endif
 
 static void
-run_file(const char *filename, uid_t uid, gid_t gid)
+requeue(const char *filename, const struct recur *every)
+{
+/* Put a recurring job back in the queue under the name which says when
+ * it runs next.  If it was removed while it ran, that was its last run.
+ */
+    char name[JOBNAME_LEN + 1];
+    unsigned long jobno;
+    char queue;
+    time_t next;
+
+    sscanf(filename, "%c%5lx", &queue, &jobno);
+    if ((next = recur_next(every, time(NULL))) == 0) {
+	syslog(LOG_WARNING, "Job %8lu has no next run", jobno);
+	unlink(filename);
+	return;
+    }
+    snprintf(name, sizeof(name), "%c%05lx%08lx", queue, jobno,
+	     (unsigned long) (next / 60));
+    journal_note(JOURNAL_QUEUED, name, getpid());
+    if (rename(filename, name) == -1 && errno != ENOENT)
+	syslog(LOG_ERR, "Cannot requeue job %8lu: %m", jobno);
+}
+
+static void
+run_file(const char *filename, uid_t uid, gid_t gid, int node, long task)
 {
 /* Run a file by by spawning off a process which redirects I/O,
  * spawns a subshell, then waits for it to complete and sends
- * mail to the user.
+ * mail to the user.  node is where to place the job when spreading
+ * jobs over NUMA nodes, or -1.  task is the index to run an array
+ * job for, or -1.
  */
     pid_t pid;
     int fd_out, fd_in;
-    char jobbuf[9];
+    char jobbuf[48];
     char *mailname = NULL;
     int mailsize = 128;
     char *newname;
+    const char *runname;
+    int fd;
     FILE *stream;
     int send_mail = 0;
     struct stat buf, lbuf;
@@ -293,6 +499,24 @@ run_file(const char *filename, uid_t uid, gid_t gid)
     char fmt[64];
     unsigned long jobno;
     int rc;
+    int lease_fd;
+    unsigned long long hash;
+    struct job_attr attr;
+    time_t started;
+    struct sigaction act;
+    sigset_t wake, waitmask;
+    pid_t parent, reaped;
+    int stopped, wstatus = 0, exit_status;
+    int cg = -1;
+    char cgname[32];
+    struct cgroup_limits limits;
+    struct cgroup_usage usage;
+    struct job_prio prio;
+    struct job_place place;
+    long limit;
+    time_t kill_at;
+    int timed_out = 0, sig = 0;
+    char note[80];
 #ifdef HAVE_PAM
     int retcode;
 #endif
@@ -311,39 +535,84 @@ run_file(const char *filename, uid_t uid, gid_t gid)
     if ((mailname = malloc(mailsize+1)) == NULL)
 	pabort("Job %8lu : out of virtual memory", jobno);
 
-    sprintf(jobbuf, "%8lu", jobno);
+    if (task >= 0)
+	sprintf(jobbuf, "%8lu task %ld", jobno, task);
+    else
+	sprintf(jobbuf, "%8lu", jobno);
 
     if ((newname = strdup(filename)) == 0)
 	pabort("Job %8lu : out of virtual memory", jobno);
     newname[0] = '=';
 
-    /* We try to make a hard link to lock the file.  If we fail, then
-     * somebody else has already locked or deleted it (a second atd?); log the
-     * fact and return.
+    /* Each task of an array job has a lease of its own, which is also
+     * what the journal and its output file go by; the job file stays.
      */
-    PRIV_START
-    rc = link(filename, newname);
-    PRIV_END
-    if (rc == -1) {
-	syslog(LOG_WARNING, "could not lock job %lu: %m", jobno);
+    if (task >= 0)
+	sprintf(newname, "%c%05lx%08lx", ARRAY_LEASE, jobno,
+		(unsigned long) task);
+    runname = task >= 0 ? newname : filename;
+
+    /* We claim the job by creating its lease.  If we fail, then somebody
+     * else (a second atd?) holds it already; leave it to them.
+     */
+    if ((lease_fd = lease_claim(newname, uid)) == -1) {
+	if (errno != EEXIST)
+	    syslog(LOG_WARNING, "could not lock job %lu: %m", jobno);
 	free(mailname);
 	free(newname);
 	return;
     }
+
+    /* Another atd sharing the spool may have run the job and dropped
+     * its lease between our scan and our claim.
+     */
+    if (stat(filename, &buf) == -1) {
+	unlink(newname);
+	close(lease_fd);
+	free(mailname);
+	free(newname);
+	return;
+    }
+
     /* If something goes wrong between here and the unlink() call,
-     * the job gets restarted as soon as the "=" entry is cleared
-     * by the main atd loop.
+     * the lease goes stale and the main atd loop removes it, so
+     * the job gets restarted.  The supervisor must not write out our
+     * buffered predictions again when it exits; in threaded mode the
+     * index thread, which writes them, waits for us meanwhile.
      */
 
+    if (estimates != NULL)
+	fflush(estimates);
     pid = fork();
     if (pid == -1)
 	perr("Cannot fork");
 
     else if (pid != 0) {
+	close(lease_fd);
 	free(mailname);
 	free(newname);
 	return;
     }
+
+    /* atd finds us through the lease, so be ready for it first. */
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = set_suspend;
+    sigemptyset(&act.sa_mask);
+    sigaction(SUSPEND_STOP, &act, NULL);
+    sigaction(SUSPEND_CONT, &act, NULL);
+
+    /* The master's SIGCHLD handler, which we inherited, would reap the
+     * job before we could find out how it went.
+     */
+    act.sa_handler = job_exited;
+    act.sa_flags = SA_NOCLDSTOP;
+    sigaction(SIGCHLD, &act, NULL);
+    lease_hold(lease_fd, queue, node);
+#ifdef USE_THREADS
+    if (threaded)
+	sigprocmask(SIG_SETMASK, &orig_mask, NULL);
+#endif
+    journal_note(JOURNAL_CLAIMED, runname, getpid());
     /* Let's see who we mail to.  Hopefully, we can read it from
      * the command file; if not, send it to the owner, or, failing that,
      * to root.
@@ -382,7 +651,7 @@ run_file(const char *filename, uid_t uid, gid_t gid)
 	perr("Somebody changed files from under us for job %8lu (%.500s) - "
 	     "aborting", jobno, filename);
 
-    if (buf.st_nlink > 2) {
+    if (buf.st_nlink > 1) {
 	perr("Somebody is trying to run a linked script for job %8lu (%.500s)",
 	     jobno, filename);
     }
@@ -415,10 +684,33 @@ run_file(const char *filename, uid_t uid, gid_t gid)
 	       jobno, filename, nuid, uid);
 
     /* We are now committed to executing this script.  Unlink the
-     * original.
+     * original, unless the job is to run again or has more tasks; our
+     * lease keeps it from being started twice.  A task takes its index
+     * in the job file instead, unless it has been started already or
+     * has to wait, for its window or its limit; then it goes back.
      */
 
-    unlink(filename);
+    jobattr_read(fd_in, &attr);
+    journal_note(JOURNAL_STARTED, runname, getpid());
+    if (task >= 0) {
+	PRIV_START
+	    fd = open(filename, O_RDWR);
+	PRIV_END
+	rc = fd < 0 ? -1 : array_take(fd, jobno, (unsigned long) task);
+	if (rc == -1)
+	    syslog(LOG_WARNING, "Cannot start task %ld of job %8lu: %m",
+		   task, jobno);
+	if (fd >= 0)
+	    close(fd);
+	if (rc != 0) {
+	    journal_note(JOURNAL_MAILED, runname, getpid());
+	    lease_drop();
+	    unlink(newname);
+	    exit(EXIT_SUCCESS);
+	}
+    }
+    else if (attr.every.unit == 0)
+	unlink(filename);
 
     fclose(stream);
     if (chdir(ATSPOOL_DIR) < 0)
@@ -428,12 +720,12 @@ run_file(const char *filename, uid_t uid, gid_t gid)
      * Write the mail header.  Complain in case 
      */
 
-    if (unlink(filename) != -1) {
+    if (unlink(runname) != -1) {
 	syslog(LOG_WARNING,"Warning: for duplicate output file for %.100s (dead job?)",
-	       filename);
+	       runname);
     }
 
-    if ((fd_out = open(filename,
+    if ((fd_out = open(runname,
 		    O_RDWR | O_CREAT | O_EXCL, S_IWUSR | S_IRUSR)) < 0)
 	perr("Cannot create output file");
     PRIV_START
@@ -467,6 +759,28 @@ run_file(const char *filename, uid_t uid, gid_t gid)
     close(STDOUT_FILENO);
     close(STDERR_FILENO);
 
+    hash = runtime_hash(fd_in);
+    started = time(NULL);
+
+    /* In a cgroup of its own, the job is held to its limits, we can tell
+     * what it used, and nothing it starts outlives it.
+     */
+    if (use_cgroups) {
+	job_limits(queue, uid, &limits);
+	if (task >= 0)
+	    snprintf(cgname, sizeof(cgname), "job.%lu.%ld", jobno, task);
+	else
+	    snprintf(cgname, sizeof(cgname), "job.%lu", jobno);
+	PRIV_START
+	    if ((cg = cgroup_create(cgname)) == -1)
+		syslog(LOG_WARNING, "Cannot create cgroup for job %8lu: %m",
+		       jobno);
+	    else if (cgroup_limit(cg, &limits) == -1)
+		syslog(LOG_WARNING, "Cannot set all limits for job %8lu: %m",
+		       jobno);
+	PRIV_END
+    }
+
     pid = fork();
     if (pid < 0)
 	perr("Error in fork");
@@ -474,6 +788,16 @@ run_file(const char *filename, uid_t uid, gid_t gid)
     else if (pid == 0) {
 	char *nul = NULL;
 	char **nenvp = &nul;
+	char taskvar[sizeof(ARRAY_ENV) + 24];
+	char *taskenv[2];
+
+	/* A task learns its index from the environment. */
+	if (task >= 0) {
+	    snprintf(taskvar, sizeof(taskvar), ARRAY_ENV "=%ld", task);
+	    taskenv[0] = taskvar;
+	    taskenv[1] = NULL;
+	    nenvp = taskenv;
+	}
 
 	/* Set up things for the child; we want standard input from the
 	 * input file, and standard output and error sent to our output file.
@@ -493,10 +817,27 @@ run_file(const char *filename, uid_t uid, gid_t gid)
 	close(fd_in);
 	close(fd_out);
 
+	/* The job gets a process group of its own, which we can stop. */
+	setpgid(0, 0);
+
 	PRIV_START
 
+	    if (cg != -1 && cgroup_enter(cg) == -1)
+		syslog(LOG_WARNING, "Cannot move job %8lu into its cgroup: %m",
+		       jobno);
+
 	    nice((tolower((int) queue) - 'a') * 2);
 
+	    queue_prio(queue, uid, &prio);
+	    if (prio_apply(&prio) == -1)
+		syslog(LOG_WARNING, "Cannot set scheduling class for job "
+		       "%8lu: %m", jobno);
+
+	    job_place(queue, uid, &place);
+	    if (place_apply(&place, node) == -1)
+		syslog(LOG_WARNING, "Cannot set CPU or memory placement for "
+		       "job %8lu: %m", jobno);
+
 #ifdef WITH_SELINUX
 	    if (selinux_enabled > 0) {
 	        if (set_selinux_context(pentry->pw_name, filename) < 0)
@@ -520,15 +861,90 @@ run_file(const char *filename, uid_t uid, gid_t gid)
 
 	PRIV_END
     }
-    /* We're the parent.  Let's wait.
+    /* We're the parent.  Let's wait, and stop the job or let it carry
+     * on when atd asks us to.  Should atd go away, nobody would let a
+     * stopped job carry on, so we do that ourselves.
      */
     close(fd_in);
+    setpgid(pid, pid);
 
-    /* We inherited the master's SIGCHLD handler, which does a
-       non-blocking waitpid. So this blocking one will eventually
-       return with an ECHILD error. 
+    sigemptyset(&wake);
+    sigaddset(&wake, SIGCHLD);
+    sigaddset(&wake, SUSPEND_STOP);
+    sigaddset(&wake, SUSPEND_CONT);
+    sigprocmask(SIG_BLOCK, &wake, &waitmask);
+
+    parent = getppid();
+    stopped = 0;
+
+    /* A job which runs for longer than it may is asked to stop, and
+     * killed if it is still there TIMEOUT_GRACE seconds later.  The
+     * lease heartbeat wakes us often enough to notice.
      */
-    waitpid(pid, (int *) NULL, 0);
+    limit = (long) lower(attr.timeout, 60ULL
+			 * lower(conf_queue(queue)->timeout,
+				 conf_user(uid)->timeout));
+    kill_at = limit > 0 ? started + limit : 0;
+
+    while ((reaped = waitpid(pid, &wstatus, WNOHANG)) == 0) {
+	if (getppid() != parent) {
+	    parent = getppid();
+	    job_suspend = 0;
+	}
+	if (kill_at != 0 && time(NULL) >= kill_at) {
+	    if (!timed_out)
+		syslog(LOG_NOTICE, "Job %8lu ran out of time, terminating it",
+		       jobno);
+	    sig = timed_out ? SIGKILL : SIGTERM;
+	    kill_at = timed_out ? 0 : kill_at + TIMEOUT_GRACE;
+	    timed_out = 1;
+	}
+	if (timed_out)
+	    job_suspend = 0;	/* it has to run to die */
+	if (job_suspend != stopped) {
+	    stopped = job_suspend;
+	    PRIV_START
+		if (cg == -1 || cgroup_freeze(cg, stopped) == -1)
+		    killpg(pid, stopped ? SIGSTOP : SIGCONT);
+	    PRIV_END
+	}
+	if (sig != 0) {
+	    signal_job(pid, cg, sig);
+	    sig = 0;
+	}
+	sigsuspend(&waitmask);
+    }
+    sigprocmask(SIG_SETMASK, &waitmask, NULL);
+
+    if (cg != -1) {
+	if (cgroup_usage(cg, &usage) == 0)
+	    syslog(LOG_INFO, "Job %8lu used %llu.%03llus user, "
+		   "%llu.%03llus system CPU, %llu kB peak memory", jobno,
+		   usage.user_usec / 1000000, usage.user_usec / 1000 % 1000,
+		   usage.system_usec / 1000000, usage.system_usec / 1000 % 1000,
+		   usage.memory_peak / 1024);
+	PRIV_START
+	    cgroup_destroy(cg, cgname);
+	PRIV_END
+    }
+    if (timed_out) {
+	snprintf(note, sizeof(note),
+		 "\nat: job killed at its time limit of %ld min\n",
+		 limit / 60);
+	write_string(fd_out, note);
+    }
+    runtime_note(hash, uid, (long) (time(NULL) - started));
+    if (attr.deadline != 0 && time(NULL) > attr.deadline)
+	syslog(LOG_WARNING, "Job %8lu finished after its deadline", jobno);
+    if (reaped != pid)
+	exit_status = STATUS_LOST;
+    else if (WIFSIGNALED(wstatus))
+	exit_status = 128 + WTERMSIG(wstatus);
+    else
+	exit_status = WEXITSTATUS(wstatus);
+    if (task < 0)
+	depend_note(jobno, uid, exit_status);
+    journal_note(JOURNAL_FINISHED, runname, getpid());
 
 #ifdef HAVE_PAM
     PRIV_START
@@ -558,13 +974,29 @@ run_file(const char *filename, uid_t uid, gid_t gid)
     if (fd_in != STDOUT_FILENO && fd_in != STDERR_FILENO)
 	close(fd_in);
 
-    if (unlink(filename) == -1)
+    if (unlink(runname) == -1)
         syslog(LOG_WARNING, "Warning: removing output file for job %li failed: %s",
                 jobno, strerror(errno));
 
-    /* The job is now finished.  We can delete its input file.
+    /* The job is now finished.  We can delete its input file.  A failed
+     * task is counted in the array's, before its lease goes, so that the
+     * count is complete once atd finds no more tasks running.
      */
     chdir(ATJOB_DIR);
+    if (attr.every.unit != 0)
+	requeue(filename, &attr.every);
+    if (task >= 0 && exit_status != 0) {
+	PRIV_START
+	    fd = open(filename, O_RDWR);
+	PRIV_END
+	if ((fd < 0 && errno != ENOENT) || (fd >= 0 && array_fail(fd) == -1))
+	    syslog(LOG_WARNING, "Cannot count failed task %ld of job %8lu: %m",
+		   task, jobno);
+	if (fd >= 0)
+	    close(fd);
+    }
+    journal_note(JOURNAL_MAILED, runname, getpid());
+    lease_drop();
     unlink(newname);
     free(newname);
 
@@ -596,21 +1028,620 @@ run_file(const char *filename, uid_t uid, gid_t gid)
 }
 
 static time_t
-run_loop()
+cold_update(time_t when, int walked)
 {
-    DIR *spool;
+/* Read the earliest due time in the cold tier, lowered to when if that
+ * is earlier, or replaced by it if we have just walked the whole tier.
+ * A when of 0 only reads it.  Returns the time now on record, 0 for none.
+ */
+    struct flock lock;
+    char buf[32];
+    long on_file = 0;
+    ssize_t len;
+    int fd;
+
+    if ((fd = open(COLD_NEXT, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR)) < 0)
+	return when;
+
+    lock.l_type = F_WRLCK;
+    lock.l_whence = SEEK_SET;
+    lock.l_start = 0;
+    lock.l_len = 0;
+    if (fcntl(fd, F_SETLKW, &lock) == 0) {
+	if ((len = pread(fd, buf, sizeof(buf) - 1, 0)) > 0) {
+	    buf[len] = '\0';
+	    sscanf(buf, "%ld", &on_file);
+	}
+	if (walked || (when != 0 && (on_file == 0 || when < on_file))) {
+	    on_file = (long) when;
+	    len = snprintf(buf, sizeof(buf), "%ld\n", on_file);
+	    if (ftruncate(fd, 0) == -1 || pwrite(fd, buf, len, 0) != len)
+		lerr("Cannot write " ATJOB_DIR "/" COLD_NEXT);
+	}
+    }
+    close(fd);
+    return (time_t) on_file;
+}
+
+static void
+demote_job(const char *name)
+{
+/* Move a job which is due beyond the horizon into the cold tier.  rename()
+ * keeps the inode, so owner, mode and contents are untouched.
+ */
+    char coldname[sizeof(ATCOLD_NAME) + JOBNAME_LEN + 1];
+
+    if (strlen(name) != JOBNAME_LEN)
+	return;
+
+    snprintf(coldname, sizeof(coldname), ATCOLD_NAME "/%.*s", JOBNAME_LEN, name);
+    if (rename(name, coldname) == -1)
+	lerr("Cannot move job %.100s to " ATCOLD_DIR, name);
+}
+
+static void
+promote_cold(void)
+{
+/* Walk the cold tier, move every job which has come within the horizon
+ * back into the spool proper, and record when the earliest remaining
+ * one is due, so that no atd has to look in here again before then.
+ */
+    DIR *cold;
     struct dirent *dirent;
-    struct stat buf;
+    struct stat st;
     unsigned long ctm;
     unsigned long jobno;
     char queue;
-    char batch_queue = '\0';
+    time_t run_time;
+    char coldname[sizeof(ATCOLD_NAME) + JOBNAME_LEN + 1];
+
+    cold_next = 0;
+    cold_scan = 0;
+    cold_walked = now;
+
+    if ((cold = opendir(ATCOLD_NAME)) == NULL) {
+	if (errno != ENOENT)
+	    lerr("Cannot read " ATCOLD_DIR);
+	return;
+    }
+    while ((dirent = readdir(cold)) != NULL) {
+	if (strlen(dirent->d_name) != JOBNAME_LEN
+	    || sscanf(dirent->d_name, "%c%5lx%8lx", &queue, &jobno, &ctm) != 3)
+	    continue;
+
+	run_time = (time_t) ctm *60;
+	if (run_time > now + cold_horizon) {
+	    if (cold_next == 0 || run_time < cold_next)
+		cold_next = run_time;
+	    continue;
+	}
+	snprintf(coldname, sizeof(coldname), ATCOLD_NAME "/%.*s", JOBNAME_LEN,
+		 dirent->d_name);
+	if (rename(coldname, dirent->d_name) == -1)
+	    lerr("Cannot move job %.100s out of " ATCOLD_DIR, dirent->d_name);
+    }
+    closedir(cold);
+
+    /* What we moved ourselves needn't make us look again. */
+    if (stat(ATCOLD_NAME, &st) == 0)
+	cold_chg = st.st_mtime;
+    cold_next = cold_update(cold_next, 1);
+}
+
+static int
+pick_node(char queue, uid_t uid)
+{
+/* For jobs which are spread over the NUMA nodes, the node with the
+ * fewest of our jobs running, counting this one from now on; otherwise
+ * -1, leaving the placement to the settings.
+ */
+    struct job_place place;
+    int i, best = -1, nodes;
+
+    job_place(queue, uid, &place);
+    if (place.placement != PLACE_SPREAD || (nodes = place_nodes()) < 2)
+	return -1;
+
+    for (i = 0; i < nodes && i < PLACE_NODES_MAX; i++)
+	if (place_node_usable(i)
+	    && (best == -1 || node_jobs[i] < node_jobs[best]))
+	    best = i;
+    if (best != -1)
+	node_jobs[best]++;
+    return best;
+}
+
+static void
+dispatch(const char *filename, uid_t uid, gid_t gid, long task,
+	 time_t *next_job)
+{
+/* Run a job which is due, or hand it to the main thread for that.  If
+ * the main thread is too far behind, leave the job for the next scan.
+ */
+    int node = pick_node(filename[0], uid);
+#ifdef USE_THREADS
+    struct job_req req;
+
+    if (threaded) {
+	memcpy(req.name, filename, sizeof(req.name));
+	req.uid = uid;
+	req.gid = gid;
+	req.node = node;
+	req.task = task;
+	if (ring_push(&job_ring, &req) == 0)
+	    ring_wake(&job_ring);
+	else {
+	    if (node != -1)
+		node_jobs[node]--;
+	    if (*next_job > now + 1)
+		*next_job = now + 1;
+	}
+	return;
+    }
+#endif
+    run_file(filename, uid, gid, node, task);
+}
+
+static const struct spool_ent *
+next_entry(struct spool_scan *spool)
+{
+/* spool_next(), during which the main thread may fork. */
+    const struct spool_ent *ent;
+#ifdef USE_THREADS
+    int save_errno;
+
+    if (threaded)
+	pthread_mutex_unlock(&big_lock);
+#endif
+    ent = spool_next(spool);
+#ifdef USE_THREADS
+    if (threaded) {
+	save_errno = errno;
+	pthread_mutex_lock(&big_lock);
+	errno = save_errno;
+    }
+#endif
+    return ent;
+}
+
+static struct job_info *
+job_details(struct sched_job *job, const struct spool_ent *ent)
+{
+/* Fill in what the scheduler needs to know about a job besides its name.
+ * The latest start which still makes a deadline allows for the runtime
+ * the user gave, or failing that the one we expect.
+ */
+    struct job_info *info;
+    long need;
+
+    memcpy(job->name, ent->name, sizeof(job->name));
+    job->uid = ent->st.st_uid;
+    job->gid = ent->st.st_gid;
+    job->queue = ent->queue;
+    job->run_time = (time_t) ent->ctm * 60;
+    job->latest = 0;
+    job->task = -1;
+
+    if ((info = runtime_job(ent->name, &ent->st)) == NULL) {
+	job->est = runtime_estimate(0, job->uid);
+	return NULL;
+    }
+    job->est = runtime_estimate(info->hash, job->uid);
+    if (job->est < 0)
+	job->est = info->attr.runtime;
+
+    if (info->attr.deadline != 0) {
+	need = info->attr.runtime >= 0 ? info->attr.runtime : job->est;
+	job->latest = info->attr.deadline - (need > 0 ? need : 0);
+	if (job->latest <= 0)
+	    job->latest = 1;
+    }
+    return info;
+}
+
+static time_t
+window_opens(const struct job_info *info, char queue, uid_t uid)
+{
+/* The earliest a job may start going by its own time window and those of
+ * its queue and owner: now if they are all open, 0 if never.  Windows
+ * which never overlap leave us with a time at which at least one of them
+ * is open, where we will look again.
+ */
+    const struct window_set *ws[3];
+    time_t t = now, next;
+    int i, n = 0, round, moved;
+
+    ws[n++] = &conf_queue(queue)->window;
+    ws[n++] = &conf_user(uid)->window;
+    if (info != NULL)
+	ws[n++] = &info->attr.window;
+
+    for (round = 0; round < WINDOW_ROUNDS; round++) {
+	moved = 0;
+	for (i = 0; i < n; i++) {
+	    if ((next = window_next(ws[i], t)) == 0)
+		return 0;
+	    if (next != t) {
+		t = next;
+		moved = 1;
+	    }
+	}
+	if (!moved)
+	    break;
+    }
+    return t;
+}
+
+static void
+plan_job(const char *filename, time_t start, time_t *next_job)
+{
+/* Move a job which may start late to the time levelling has found for
+ * it, so that atq shows it and we needn't plan it again.
+ */
+    char name[JOBNAME_LEN + 1];
+    unsigned long jobno;
+    char queue;
+
+    sscanf(filename, "%c%5lx", &queue, &jobno);
+    snprintf(name, sizeof(name), "%c%05lx%08lx", queue, jobno,
+	     (unsigned long) (start / 60));
+    journal_note(JOURNAL_PLANNED, name, getpid());
+    if (strcmp(name, filename) != 0 && rename(filename, name) == -1) {
+	if (errno != ENOENT)
+	    syslog(LOG_ERR, "Cannot plan job %8lu: %m", jobno);
+	return;
+    }
+    level_mark(name);
+    if (start < *next_job)
+	*next_job = start;
+}
+
+static int
+expire_job(const struct spool_ent *ent, const struct job_info *info,
+	   time_t *next_job)
+{
+/* A job which is later than its own, its queue's or its owner's
+ * lateness limit allows is not started at all.  A recurring one skips
+ * this run; any other goes into the queue set aside for such jobs, if
+ * there is one, or is dropped.  Returns 1 if the job was dealt with.
+ */
+    const struct conf_ent *q = conf_queue(ent->queue);
+    const struct conf_ent *u = conf_user(ent->st.st_uid);
+    char name[JOBNAME_LEN + 1], lease[JOBNAME_LEN + 1];
+    struct job_array a;
+    long maxlate, late;
+    int divert, fd;
+
+    maxlate = (long) lower(info != NULL ? info->attr.maxlate : 0,
+			   60ULL * lower(q->maxlate, u->maxlate));
+    late = (long) (now - (time_t) ent->ctm * 60);
+    if (maxlate == 0 || late <= maxlate)
+	return 0;
+
+    /* An array job is late only until its first task has started. */
+    if (info != NULL && info->attr.array.n != 0
+	&& array_read(ent->name, &a) == 0 && array_started(&a))
+	return 0;
+
+    /* Hold the job's lease while we deal with it, so that no supervisor
+     * can claim it meanwhile; one which has got there first keeps it.
+     * The lease is ours, so another atd leaves it alone while we live.
+     */
+    memcpy(lease, ent->name, sizeof(lease));
+    lease[0] = '=';
+    if ((fd = lease_claim(lease, ent->st.st_uid)) == -1)
+	return 1;
+    lease_hold(fd, ent->queue, -1);
+
+    divert = u->divert != 0 ? u->divert : q->divert;
+    if (info != NULL && info->attr.every.unit != 0) {
+	syslog(LOG_NOTICE, "Job %8lu is %ld minutes late - run skipped",
+	       ent->jobno, late / 60);
+	requeue(ent->name, &info->attr.every);
+	*next_job = now;
+    }
+    else if (divert != 0 && divert != ent->queue) {
+	snprintf(name, sizeof(name), "%c%05lx%08lx", divert, ent->jobno,
+		 (unsigned long) (now / 60));
+	journal_note(JOURNAL_QUEUED, name, getpid());
+	if (rename(ent->name, name) == 0) {
+	    syslog(LOG_NOTICE, "Job %8lu is %ld minutes late - moved to "
+		   "queue %c", ent->jobno, late / 60, divert);
+	    *next_job = now;
+	}
+	else if (errno != ENOENT)
+	    syslog(LOG_ERR, "Cannot move job %8lu: %m", ent->jobno);
+    }
+    else {
+	syslog(LOG_NOTICE, "Job %8lu is %ld minutes late - removed",
+	       ent->jobno, late / 60);
+	if (unlink(ent->name) == 0)
+	    depend_note(ent->jobno, ent->st.st_uid, STATUS_EXPIRED);
+    }
+
+    lease_drop();
+    unlink(lease);
+    close(fd);
+    return 1;
+}
+
+static void
+note_array(const struct sched_job *job)
+{
+/* An array job is due; its tasks are offered once the whole spool has
+ * been seen, when we know how many of them are running.
+ */
+    struct sched_job *a;
+    size_t alloc;
+
+    if (narrays == arrays_alloc) {
+	alloc = arrays_alloc ? 2 * arrays_alloc : 16;
+	if ((a = realloc(arrays, alloc * sizeof(*arrays))) == NULL)
+	    return;
+	arrays = a;
+	arrays_alloc = alloc;
+    }
+    arrays[narrays++] = *job;
+}
+
+static void
+expand_arrays(time_t *next_job)
+{
+/* Offer the scheduler the next tasks of each array job which is due, as
+ * many as its limit leaves room for besides those running.  One whose
+ * tasks have all been started goes once the last of them has finished,
+ * and counts as failed if any of them did.
+ */
+    struct sched_job task;
+    struct job_array a;
+    unsigned long jobno, running, last, room, i;
+    size_t j;
+
+    for (j = 0; j < narrays; j++) {
+	if (array_read(arrays[j].name, &a) == -1)
+	    continue;
+	sscanf(arrays[j].name + 1, "%5lx", &jobno);
+	running = sched_tasks(jobno);
+	last = a.first + a.n - 1;
+
+	if (a.next > last) {
+	    /* A task we handed out may have come and gone unseen. */
+	    if (running > 0) {
+		if (now + LEASE_TTL < *next_job)
+		    *next_job = now + LEASE_TTL;
+		continue;
+	    }
+	    if (unlink(arrays[j].name) == 0) {
+		syslog(LOG_INFO, "Array job %8lu done, %lu of %lu tasks "
+		       "failed", jobno, a.failed, a.n);
+		depend_note(jobno, arrays[j].uid, a.failed > 0 ? 1 : 0);
+	    }
+	    continue;
+	}
+
+	/* Indices passed over before are offered again, as they were
+	 * never taken; those started ahead of them are skipped.
+	 */
+	room = ARRAY_WINDOW;
+	if (a.limit > 0)
+	    room = running < a.limit ? a.limit - running : 0;
+
+	task = arrays[j];
+	for (i = 0; room > 0 && i < ARRAY_WINDOW && a.next + i <= last; i++) {
+	    if (array_taken(&a, a.next + i))
+		continue;
+	    task.task = (long) (a.next + i);
+	    sched_add(isbatch(task.queue), &task);
+	    room--;
+	}
+    }
+}
+
+static int
+pressure_level(void)
+{
+/* 1 if the system is busy enough for batch jobs to make way, -1 once it
+ * has calmed down below the load at which batch jobs start (or half the
+ * CPU pressure it took), 0 in between.
+ */
+    double la, cpu;
+    int busy = 0, calm = 1;
+
+    if (suspend_load > 0.) {
+#ifdef GETLOADAVG_PRIVILEGED
+	START_PRIV
+#endif
+	if (getloadavg(&la, 1) < 1)
+	    la = 0.0;
+#ifdef GETLOADAVG_PRIVILEGED
+	END_PRIV
+#endif
+	if (la > suspend_load)
+	    busy = 1;
+	if (la >= load_avg)
+	    calm = 0;
+    }
+    if (suspend_cpu > 0. && (cpu = suspend_cpu_pressure()) >= 0.) {
+	if (cpu > suspend_cpu)
+	    busy = 1;
+	if (cpu >= suspend_cpu / 2.)
+	    calm = 0;
+    }
+    return busy ? 1 : calm ? -1 : 0;
+}
+
+static double
+batch_load_limit(time_t latest)
+{
+/* The load limit for starting a batch job, relaxed as the latest start
+ * of the most urgent one comes closer: up to twice the usual limit within
+ * SCHED_SLACK seconds of it, and none at all once it has passed.
+ */
+    time_t slack;
+
+    if (latest == 0 || (slack = latest - now) >= SCHED_SLACK)
+	return load_avg;
+    if (slack <= 0)
+	return HUGE_VAL;
+    return load_avg * (2. - (double) slack / SCHED_SLACK);
+}
+
+static void
+note_estimate(const struct sched_job *job, time_t start)
+{
+    if (estimates != NULL)
+	fprintf(estimates, "%s %ld %ld\n", job->name, (long) start, job->est);
+}
+
+static void
+open_estimates(void)
+{
+/* Predictions for atq -e are written out at most every ESTIMATE_INTERVAL
+ * seconds, and with several atds on the spool only by the first one.  A
+ * pass which had to skip them leaves another one pending.
+ */
+    int fd;
+
+    if (instance_id != 0)
+	return;
+    if (estimates_next > now) {
+	estimates_pending = 1;
+	return;
+    }
+    estimates_pending = 0;
+
+    unlink(ATESTIMATES ".new");
+    if ((fd = open(ATESTIMATES ".new", O_WRONLY | O_CREAT | O_EXCL,
+		   S_IRUSR | S_IWUSR)) < 0)
+	return;
+    if ((estimates = fdopen(fd, "w")) == NULL)
+	close(fd);
+}
+
+static void
+close_estimates(void)
+{
+    if (estimates == NULL)
+	return;
+
+    if (fclose(estimates) == 0)
+	rename(ATESTIMATES ".new", ATESTIMATES);
+    else
+	unlink(ATESTIMATES ".new");
+    estimates = NULL;
+    estimates_next = now + ESTIMATE_INTERVAL;
+}
+
+static int
+committed(const char *name)
+{
+/* Whether a job the journal has as started can have run: once it has,
+ * its spool file is gone, unless it is a recurring one which keeps it.
+ */
+    struct job_attr attr;
+    int fd, rc;
+
+    if ((fd = open(name, O_RDONLY)) < 0)
+	return 1;
+    rc = jobattr_read(fd, &attr) == 0 && attr.every.unit != 0;
+    close(fd);
+    return rc;
+}
+
+static void
+recover_job(const struct journal_ent *je)
+{
+/* Pick up where a previous atd left off, going by the last thing the
+ * journal says happened to a job.  Only jobs which still have a lease
+ * but nobody left to look after them need anything done.
+ */
+    char lease[JOBNAME_LEN + 1];
+    unsigned long jobno, task = 0;
+    struct stat st;
+    enum journal_state state;
+
+    if (je->state == JOURNAL_PLANNED)
+	level_mark(je->name);
+    if (je->state == JOURNAL_QUEUED || je->state == JOURNAL_PLANNED
+	|| je->state == JOURNAL_MAILED)
+	return;
+
+    memcpy(lease, je->name, sizeof(lease));
+    if (lease[0] != ARRAY_LEASE)
+	lease[0] = '=';
+    if (lstat(lease, &st) == -1)
+	return;
+
+    /* If the supervisor never got to write its pid, the journal tells us
+     * which atd took the lease.
+     */
+    if (!lease_dead(lease, (pid_t) je->pid))
+	return;
+
+    sscanf(je->name + 1, "%5lx", &jobno);
+    unlink(lease);
+
+    /* An array job's task takes its index once it has been noted as
+     * started, and its job file stays, so one which was only claimed is
+     * offered again anyway.  One which may have run is lost.
+     */
+    if (je->name[0] == ARRAY_LEASE && je->state != JOURNAL_FINISHED) {
+	sscanf(je->name + 6, "%8lx", &task);
+	if (je->state == JOURNAL_CLAIMED)
+	    syslog(LOG_NOTICE, "Task %lu of job %8lu was claimed but not "
+		   "started - requeued", task, jobno);
+	else
+	    syslog(LOG_WARNING, "Task %lu of job %8lu was interrupted while "
+		   "running - lost", task, jobno);
+	return;
+    }
+
+    /* STARTED is noted before the spool file goes; if it is still
+     * there, the job never got going after all.
+     */
+    state = je->state;
+    if (state == JOURNAL_STARTED && !committed(je->name))
+	state = JOURNAL_CLAIMED;
+
+    switch (state) {
+    case JOURNAL_CLAIMED:
+	/* It never got started, so its spool file is still there. */
+	syslog(LOG_NOTICE, "Job %8lu was claimed but not started - requeued",
+	       jobno);
+	journal_note(JOURNAL_QUEUED, je->name, getpid());
+	break;
+
+    case JOURNAL_STARTED:
+	syslog(LOG_WARNING, "Job %8lu was interrupted while running", jobno);
+	depend_note(jobno, st.st_uid, STATUS_LOST);
+	break;
+
+    default:
+	syslog(LOG_WARNING, "Output of job %8lu may not have been mailed",
+	       jobno);
+	break;
+    }
+}
+
+static time_t
+run_loop()
+{
+    struct spool_scan *spool;
+    const struct spool_ent *ent;
+    struct stat buf;
+    unsigned long ctm;
+    char queue;
     time_t run_time, next_job;
-    char batch_name[] = "z2345678901234";
-    char lock_name[] = "z2345678901234";
-    uid_t batch_uid;
-    gid_t batch_gid;
+    time_t recheck, batch_latest, opens, latest;
+    pid_t pid;
+    char lease_q;
+    int level, held, stopped, suspending, node;
+    char lease[JOBNAME_LEN + 1];
+    enum depend_state state;
+    struct sched_job job;
+    struct job_info *info;
     int run_batch;
+    int badline;
     static time_t next_batch = 0;
     double currlavg[3];
 
@@ -620,19 +1651,43 @@ run_loop()
      * and execs a /bin/sh, which executes the shell.  The function will
      * then remove the script (hopefully).
      *
-     * Also, pick the oldest batch job to run, at most one per run of
-     * the main loop.
+     * Due jobs are collected first and then started in fair share
+     * order, batch jobs at most one per run of the main loop.  How long
+     * each is expected to take comes from the runtimes of earlier jobs.
      */
 
     next_job = now + CHECK_INTERVAL;
     if (next_batch == 0)
 	next_batch = now;
 
+    /* Bring in cold jobs which have come within the horizon.  Other atds
+     * on the spool demote jobs as well, so the earliest due time is kept
+     * in the cold tier, and we walk it again whenever it changes, and once
+     * per horizon in case a change got past us.  Moving jobs touches the
+     * spool directory, so the check below will rescan it.
+     */
+    cold_next = cold_update(0, 0);
+    if (stat(ATCOLD_NAME, &buf) == 0 && buf.st_mtime != cold_chg) {
+	cold_chg = buf.st_mtime;
+	cold_scan = 1;
+    }
+    if (cold_scan || (cold_next != 0 && cold_next <= now + cold_horizon)
+	|| (cold_horizon > 0 && cold_walked + cold_horizon <= now))
+	promote_cold();
+
+    if (cold_next != 0 && cold_next - cold_horizon < next_job)
+	next_job = cold_next - cold_horizon;
+    if (cold_horizon > 0 && cold_walked + cold_horizon < next_job)
+	next_job = cold_walked + cold_horizon;
+
     /* To avoid spinning up the disk unnecessarily, stat the directory and
      * return immediately if it hasn't changed since the last time we woke
      * up.
      */
 
+    if (conf_load(&badline) == -1)
+	syslog(LOG_WARNING, ATCONF " line %d: bad entry ignored", badline);
+
     if (stat(".", &buf) == -1)
 	perr("Cannot stat " ATJOB_DIR);
 
@@ -640,76 +1695,85 @@ run_loop()
 	return next_job;
     last_chg = buf.st_mtime;
 
+    if (journal_checkpoint(JOURNAL_MAX) == -1)
+	syslog(LOG_WARNING, "Cannot checkpoint " ATJOURNAL ": %m");
+    if (runtime_compact(RUNTIME_MAX) == -1)
+	syslog(LOG_WARNING, "Cannot compact " ATRUNTIMES ": %m");
+    runtime_load();
+    if (depend_compact(STATUS_MAX, now) == -1)
+	syslog(LOG_WARNING, "Cannot compact " ATSTATUS ": %m");
+    depend_load();
+
     hupped = 0;
-    if ((spool = opendir(".")) == NULL)
+    if ((spool = spool_open(".")) == NULL)
 	perr("Cannot read " ATJOB_DIR);
 
     run_batch = 0;
+    batch_latest = 0;
     nothing_to_do = 1;
+    sched_begin(now);
+    suspend_begin();
+    memset(node_jobs, 0, sizeof(node_jobs));
+    open_estimates();
+    level_begin(now);
+    narrays = 0;
+
+    /* The scanner only hands us entries which look like job files and
+     * which still existed when it stat()ed them.
+     */
+    while ((ent = next_entry(spool)) != NULL) {
+	queue = ent->queue;
+	ctm = ent->ctm;
 
-    batch_uid = (uid_t) - 1;
-    batch_gid = (gid_t) - 1;
-
-    while ((dirent = readdir(spool)) != NULL) {
-
-	/* Avoid the stat if this doesn't look like a job file */
-	if (sscanf(dirent->d_name, "%c%5lx%8lx", &queue, &jobno, &ctm) != 3)
+	if (!S_ISREG(ent->st.st_mode))
 	    continue;
 
-	/* Chances are a '=' file has been deleted from under us.
-	 * Ignore.
+	/* Leases on running jobs and array tasks.  Remove those which
+	 * have gone stale; if the job never got going, it is still in the
+	 * spool and will be picked up again.
 	 */
-	if (stat(dirent->d_name, &buf) != 0)
-	    continue;
+	if (queue == '=' || queue == ARRAY_LEASE) {
+	    nothing_to_do = 0;
+	    sched_running(ent->name, ent->st.st_uid);
+	    if (lease_stale(ent->name, &ent->st, now, &recheck)) {
+		syslog(LOG_NOTICE, "Removing stale lease %.100s", ent->name);
+		unlink(ent->name);
+		next_job = now;
+		continue;
+	    }
+	    if (recheck < next_job)
+		next_job = recheck;
 
-	if (!S_ISREG(buf.st_mode))
+	    /* Count the jobs on each node for spreading new ones.  Running
+	     * batch jobs may have to make way; with several atds on the
+	     * spool, the first looks after all of them.
+	     */
+	    suspending = (suspend_load > 0. || suspend_cpu > 0.)
+		&& instance_id == 0;
+	    if ((suspending || place_nodes() > 1)
+		&& (pid = lease_read(ent->name, &lease_q, &node)) != 0) {
+		if (node >= 0 && node < PLACE_NODES_MAX)
+		    node_jobs[node]++;
+		if (suspending && isbatch(lease_q))
+		    suspend_job(ent->jobno, lease_q, pid);
+	    }
 	    continue;
+	}
 
 	/* We don't want files which at(1) hasn't yet marked executable. */
-	if (!(buf.st_mode & S_IXUSR)) {
+	if (!(ent->st.st_mode & S_IXUSR)) {
 	    nothing_to_do = 0;  /* it will probably become executable soon */
 	    continue;
 	}
 
 	run_time = (time_t) ctm *60;
 
-	/* Skip lock files */
-	if (queue == '=') {
-            /* FIXME: calhariz */
-            /* I think the following code is broken, but commenting it
-               may cause unknow side effects.  Make a release and see
-               in the wild how it works. For more information see:
-               https://bugs.debian.org/cgi-bin/bugreport.cgi?bug=818508 */
-
-	    /* if ((buf.st_nlink == 1) && (run_time + CHECK_INTERVAL <= now)) { */
-	    /*     /\* Remove stale lockfile FIXME: lock the lockfile, if you fail, it's still in use. *\/ */
-	    /*     unlink(dirent->d_name); */
-	    /* } */
-	    continue;
-	}
 	/* Skip any other file types which may have been invented in
 	 * the meantime.
 	 */
 	if (!(isupper(queue) || islower(queue))) {
 	    continue;
 	}
-	/* Is the file already locked?
-	 */
-	if (buf.st_nlink > 1) {
-	    if (run_time + CHECK_INTERVAL <= now) {
-
-		/* Something went wrong the last time this was executed.
-		 * Let's remove the lockfile and reschedule.
-		 */
-		strncpy(lock_name, dirent->d_name, sizeof(lock_name));
-		lock_name[0] = '=';
-		unlink(lock_name);
-		next_job = now;
-		nothing_to_do = 0;
-	    }
-	    continue;
-	}
-
 	/* If we got here, then there are jobs of some kind waiting.
 	 * We could try to be smarter and leave nothing_to_do set if
 	 * we end up processing all the jobs, but that's risky (run_file
@@ -717,40 +1781,160 @@ run_loop()
 	 * gain us much. */
 	nothing_to_do = 0;
 
+	/* Jobs beyond the horizon go to the cold tier, so that we don't
+	 * have to stat them on every scan until they come close.
+	 */
+	if (cold_horizon > 0 && run_time > now + cold_horizon) {
+	    demote_job(ent->name);
+	    cold_next = cold_update(run_time, 0);
+	    if (cold_next - cold_horizon < next_job)
+		next_job = cold_next - cold_horizon;
+	    continue;
+	}
+
+	info = job_details(&job, ent);
+
+	/* A job which may start late is planned first, if it's ours to
+	 * run; the rest go towards the load it is planned around.
+	 */
+	if (info != NULL && info->attr.spread > 0 && !level_planned(ent->name)
+	    && (instances == 0 || ent->jobno % instances == instance_id)) {
+	    latest = run_time + (info->attr.spread < JOBATTR_SPREAD_MAX
+				 ? info->attr.spread : JOBATTR_SPREAD_MAX);
+	    if (job.latest != 0 && job.latest < latest)
+		latest = job.latest;
+	    if (level_want(ent->name, run_time, latest, job.est) == 0)
+		continue;
+	}
+	level_load(run_time > now ? run_time : now, job.est);
+
 	/* There's a job for later.  Note its execution time if it's
 	 * the earliest so far.
 	 */
 	if (run_time > now) {
+	    note_estimate(&job, run_time);
 	    if (next_job > run_time) {
 		next_job = run_time;
 	    }
 	    continue;
 	}
 
-	if (isbatch(queue)) {
+	/* A recurring job stays in the spool while it runs, and any other
+	 * until its supervisor has got it going; its lease says whether it
+	 * does.  Such a job must not be expired or moved under it either.
+	 */
+	memcpy(lease, ent->name, sizeof(lease));
+	lease[0] = '=';
+	if (lstat(lease, &buf) == 0)
+	    continue;
 
-	    /* We could potentially run this batch job.  If it's scheduled
-	     * at a higher priority than anything before, keep its
-	     * filename.
-	     */
-	    run_batch++;
-	    if (strcmp(batch_name, dirent->d_name) > 0) {
-		strncpy(batch_name, dirent->d_name, sizeof(batch_name));
-		batch_uid = buf.st_uid;
-		batch_gid = buf.st_gid;
-		batch_queue = queue;
+	/* With several atds on the spool, each runs its own share of the
+	 * jobs and only takes over another's share once it has been left
+	 * waiting for STEAL_DELAY seconds.
+	 */
+	if (instances > 0 && ent->jobno % instances != instance_id
+	    && run_time + STEAL_DELAY > now) {
+	    if (next_job > run_time + STEAL_DELAY)
+		next_job = run_time + STEAL_DELAY;
+	    continue;
+	}
+
+	/* One which has been waiting for too long doesn't start at all. */
+	if (expire_job(ent, info, &next_job))
+	    continue;
+
+	/* A job waits for the jobs it depends on; we rescan when one of
+	 * them is done, as its lease goes.  One which never can run goes.
+	 */
+	if (info != NULL && info->attr.after.n > 0
+	    && (state = depend_check(&info->attr.after)) != DEPEND_READY) {
+	    if (state == DEPEND_NEVER) {
+		syslog(LOG_NOTICE, "Job %8lu can never run as a job it waits "
+		       "for did not end as required - removed", ent->jobno);
+		if (unlink(ent->name) == 0)
+		    depend_note(ent->jobno, ent->st.st_uid, STATUS_REMOVED);
 	    }
+	    continue;
 	}
-	else {
-	    if (run_time <= now) {
-		run_file(dirent->d_name, buf.st_uid, buf.st_gid);
+
+	/* Outside its time windows a job waits, and we sleep until the
+	 * next one opens.
+	 */
+	if ((opens = window_opens(info, queue, job.uid)) != now) {
+	    if (opens != 0) {
+		note_estimate(&job, opens);
+		if (opens < next_job)
+		    next_job = opens;
 	    }
+	    continue;
+	}
+
+	/* The job is due; leave it to the fair share scheduler. */
+	if (job.latest != 0 && job.latest < now && info != NULL
+	    && !info->late) {
+	    syslog(LOG_WARNING, "Job %8lu can no longer make its deadline",
+		   ent->jobno);
+	    info->late = 1;
+	}
+	if (isbatch(queue)) {
+	    run_batch++;
+	    if (job.latest != 0
+		&& (batch_latest == 0 || job.latest < batch_latest))
+		batch_latest = job.latest;
 	}
+	if (info != NULL && info->attr.array.n != 0)
+	    note_array(&job);
+	else
+	    sched_add(isbatch(queue), &job);
+    }
+
+    /* If the directory could only be read in part, the jobs we missed
+     * are still there; look again soon rather than at its next change.
+     */
+    if (errno != 0) {
+	syslog(LOG_ERR, "Cannot read " ATJOB_DIR ": %m");
+	last_chg = 0;
+	if (next_job > now + RESCAN_INTERVAL)
+	    next_job = now + RESCAN_INTERVAL;
     }
-    closedir(spool);
-    /* run the single batch file, if any
+    spool_close(spool);
+    expand_arrays(&next_job);
+
+    /* Plan the jobs which may start late, one after the other so that
+     * they spread out among themselves as well.  Moving them touches the
+     * spool directory, so the next pass will pick them up.
+     */
+    while (level_next(lease, &run_time))
+	plan_job(lease, run_time, &next_job);
+
+    /* Start the due at jobs, as far as the users' maxrun limits allow.
+     * The ones held back are still in the spool for the next pass.
      */
-    if (run_batch  && (next_batch <= now)) {
+    while (sched_next(0, &job)) {
+	note_estimate(&job, now);
+	dispatch(job.name, job.uid, job.gid, job.task, &next_job);
+    }
+
+    /* Stop the batch jobs which are running if the system is busy, or
+     * let them carry on if it isn't any more.  No new ones start while
+     * it is busy or some are still stopped.
+     */
+    level = -1;
+    stopped = 0;
+    if (suspend_load > 0. || suspend_cpu > 0.) {
+	level = pressure_level();
+	if (instance_id == 0) {
+	    held = suspend_settle(level, &stopped);
+	    if (held > 0 && now + SUSPEND_INTERVAL < next_job)
+		next_job = now + SUSPEND_INTERVAL;
+	}
+    }
+
+    /* run the single batch file, if any.  One which would miss its
+     * deadline otherwise doesn't wait for the batch interval.
+     */
+    if (run_batch
+	&& (next_batch <= now || (batch_latest != 0 && batch_latest <= now))) {
 	next_batch = now + batch_interval;
 #ifdef GETLOADAVG_PRIVILEGED
 	START_PRIV
@@ -761,18 +1945,140 @@ run_loop()
 #ifdef GETLOADAVG_PRIVILEGED
 	END_PRIV
 #endif
-	if (currlavg[0] < load_avg) {
-	    run_file(batch_name, batch_uid, batch_gid);
+	if (currlavg[0] < batch_load_limit(batch_latest)
+	    && level <= 0 && stopped == 0 && sched_next(1, &job)) {
+	    note_estimate(&job, now);
+	    dispatch(job.name, job.uid, job.gid, job.task, &next_job);
 	    run_batch--;
         }
     }
+    if (estimates != NULL) {
+	sched_predict(note_estimate, next_batch, batch_interval);
+	close_estimates();
+    }
+    else if (estimates_pending && estimates_next < next_job) {
+	nothing_to_do = 0;
+	next_job = estimates_next;
+    }
     if (run_batch && (next_batch < next_job)) {
 	nothing_to_do = 0;
 	next_job = next_batch;
     }
+    if (run_batch && batch_latest > now && batch_latest < next_job)
+	next_job = batch_latest;
     return next_job;
 }
 
+#ifdef USE_THREADS
+static void *
+index_thread(void *arg)
+{
+/* Scan the spool whenever something is due, a job has finished, or at
+ * has told us about a new one.
+ */
+    struct event ev;
+    time_t next_invocation;
+
+    pthread_mutex_lock(&big_lock);
+    while (!term_signal) {
+	now = time(NULL);
+	next_invocation = run_loop();
+	pthread_mutex_unlock(&big_lock);
+	if (next_invocation > now)
+	    ring_wait(&event_ring, (int) (next_invocation - now) * 1000);
+	pthread_mutex_lock(&big_lock);
+	while (ring_pop(&event_ring, &ev) == 0) {
+	    if (ev.pid != 0)
+		note_exit(ev.pid, ev.status);
+	    nothing_to_do = 0;
+	}
+    }
+    pthread_mutex_unlock(&big_lock);
+    return NULL;
+}
+
+static void *
+completion_thread(void *arg)
+{
+    struct event ev;
+    int sig;
+
+    for (;;) {
+	if (sigwait(&waited, &sig) != 0)
+	    continue;
+
+	switch (sig) {
+	case SIGCHLD:
+	    while ((ev.pid = waitpid(-1, &ev.status, WNOHANG)) > 0)
+		if (ring_push(&event_ring, &ev) == -1) {
+		    pthread_mutex_lock(&big_lock);
+		    note_exit(ev.pid, ev.status);
+		    pthread_mutex_unlock(&big_lock);
+		}
+	    break;
+
+	case SIGHUP:
+	    ev.pid = 0;
+	    ev.status = 0;
+	    ring_push(&event_ring, &ev);
+	    break;
+
+	default:
+	    term_signal = 1;
+	    ring_wake(&job_ring);
+	    ring_wake(&event_ring);
+	    return NULL;
+	}
+	ring_wake(&event_ring);
+    }
+}
+
+static int
+start_threads(void)
+{
+/* Returns 0 if we are to carry on single threaded. */
+    pthread_t tid;
+
+    if (ring_init(&job_ring, JOB_RING_SIZE, sizeof(struct job_req)) == -1
+	|| ring_init(&event_ring, EVENT_RING_SIZE, sizeof(struct event)) == -1)
+	return 0;
+
+    sigemptyset(&waited);
+    sigaddset(&waited, SIGCHLD);
+    sigaddset(&waited, SIGHUP);
+    sigaddset(&waited, SIGTERM);
+    sigaddset(&waited, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &waited, &orig_mask);
+
+    if (pthread_create(&tid, NULL, completion_thread, NULL) != 0) {
+	pthread_sigmask(SIG_SETMASK, &orig_mask, NULL);
+	return 0;
+    }
+    pthread_detach(tid);
+    threaded = 1;
+
+    if (pthread_create(&tid, NULL, index_thread, NULL) != 0)
+	perr("Cannot start index thread");
+    pthread_detach(tid);
+    return 1;
+}
+
+static void
+dispatch_loop(void)
+{
+    struct job_req req;
+
+    while (!term_signal) {
+	while (ring_pop(&job_ring, &req) == 0) {
+	    pthread_mutex_lock(&big_lock);
+	    run_file(req.name, req.uid, req.gid, req.node, req.task);
+	    pthread_mutex_unlock(&big_lock);
+	}
+	ring_wait(&job_ring, -1);
+    }
+}
+#endif
+
 /* Global functions */
 
 int
@@ -793,6 +2099,7 @@ main(int argc, char *argv[])
     struct sigaction act;
     struct passwd *pwe;
     struct group *ge;
+    char *pidfile;
 
 #ifdef WITH_SELINUX
     selinux_enabled=is_selinux_enabled();
@@ -829,7 +2136,7 @@ main(int argc, char *argv[])
     run_as_daemon = 1;
     batch_interval = BATCH_INTERVAL_DEFAULT;
 
-    while ((c = getopt(argc, argv, "sdl:b:f")) != EOF) {
+    while ((c = getopt(argc, argv, "sdl:b:fH:i:S:P:c")) != EOF) {
 	switch (c) {
 	case 'l':
 	    if (sscanf(optarg, "%lf", &load_avg) != 1)
@@ -842,6 +2149,37 @@ main(int argc, char *argv[])
 	    if (sscanf(optarg, "%ud", &batch_interval) != 1)
 		pabort("garbled option -b");
 	    break;
+
+	case 'S':
+	    if (sscanf(optarg, "%lf", &suspend_load) != 1 || suspend_load < 0.)
+		pabort("garbled option -S");
+	    break;
+
+	case 'P':
+	    if (sscanf(optarg, "%lf", &suspend_cpu) != 1 || suspend_cpu < 0.
+		|| suspend_cpu > 100.)
+		pabort("garbled option -P");
+	    break;
+	case 'H':
+	    if (sscanf(optarg, "%u", &cold_horizon) != 1)
+		pabort("garbled option -H");
+	    break;
+
+	case 'i':
+	    if (sscanf(optarg, "%u/%u", &instance_id, &instances) != 2
+		|| instances == 0 || instances > ATD_INSTANCES_MAX
+		|| instance_id >= instances)
+		pabort("garbled option -i");
+	    if ((pidfile = malloc(sizeof(PIDFILE) + 11)) == NULL)
+		pabort("out of memory");
+	    sprintf(pidfile, PIDFILE ".%u", instance_id);
+	    daemon_pidfile = pidfile;
+	    break;
+
+	case 'c':
+	    use_cgroups = 1;
+	    break;
+
 	case 'd':
 	    daemon_debug++;
 	    daemon_foreground++;
@@ -872,6 +2210,33 @@ main(int argc, char *argv[])
     if (optind < argc)
 	pabort("non-option arguments - not allowed");
 
+    if (suspend_load > 0. && suspend_load <= load_avg)
+	pabort("-S must be above the load limit for batch jobs");
+
+    if (use_cgroups) {
+	PRIV_START
+	    c = cgroup_init();
+	PRIV_END
+	if (c == -1) {
+	    syslog(LOG_WARNING, "Cannot set up cgroups, running jobs "
+		   "without: %m");
+	    use_cgroups = 0;
+	}
+    }
+
+    if (cold_horizon > 0 && mkdir(ATCOLD_NAME, S_IRWXU | S_IRWXG | S_ISVTX) == -1
+	&& errno != EEXIST)
+	perr("Cannot create " ATCOLD_DIR);
+
+    /* Replay the journal before looking at the spool, so jobs a crashed
+     * atd left half-launched are dealt with straight away.  Checkpoint
+     * first, which also gets rid of a record a crash may have cut short.
+     */
+    if (journal_checkpoint(0) == -1)
+	syslog(LOG_WARNING, "Cannot checkpoint " ATJOURNAL ": %m");
+    else if (journal_replay(recover_job) == -1)
+	syslog(LOG_WARNING, "Cannot replay " ATJOURNAL ": %m");
+
     sigaction(SIGCHLD, NULL, &act);
     act.sa_handler = release_zombie;
     act.sa_flags   = SA_NOCLDSTOP;
@@ -903,6 +2268,14 @@ main(int argc, char *argv[])
 
     daemon_setup();
 
+#ifdef USE_THREADS
+    if (start_threads()) {
+	dispatch_loop();
+	daemon_cleanup();
+	exit(EXIT_SUCCESS);
+    }
+#endif
+
     do {
 	now = time(NULL);
 	next_invocation = run_loop();
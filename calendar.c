@@ -0,0 +1,474 @@
+/*
+ *  calendar.c - calendar expressions for recurring jobs
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/* System Headers */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Local headers */
+
+#include "calendar.h"
+
+/* Macros */
+
+#define DAY_SECS (24 * 60 * 60)
+#define DAY_MINUTES (24 * 60)
+#define SEARCH_MONTHS (32 * 12)	/* a date which can match comes round
+				   within 28 years, barring century years */
+
+/* File scope variables */
+
+static const unsigned long long all_set[] = {
+    CALENDAR_ALL_MINUTES, CALENDAR_ALL_HOURS, CALENDAR_ALL_MDAYS,
+    CALENDAR_ALL_MONTHS, CALENDAR_ALL_WDAYS
+};
+
+/* Local functions */
+
+static int
+lowest_bit(uint64_t x)
+{
+/* The number of the lowest bit set in x, which must not be 0. */
+#ifdef __GNUC__
+    return __builtin_ctzll(x);
+#else
+    int n = 0;
+
+    while (!(x & 1)) {
+	x >>= 1;
+	n++;
+    }
+    return n;
+#endif
+}
+
+static int
+month_days(int year, int mon)
+{
+    static const int days[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+
+    if (mon == 1 && year % 4 == 0 && (year % 100 != 0 || year % 400 == 0))
+	return 29;
+    return days[mon];
+}
+
+static int
+week_day(int year, int mon, int mday)
+{
+/* Day of the week of a date in the Gregorian calendar, Sunday being 0,
+ * worked out without going near the time zone.
+ */
+    static const int t[] = { 0, 3, 2, 5, 0, 3, 5, 1, 4, 6, 2, 4 };
+
+    if (mon < 2)
+	year--;
+    return (year + year / 4 - year / 100 + year / 400 + t[mon] + mday) % 7;
+}
+
+static uint32_t
+month_mask(const struct calendar *cal, int year, int mon)
+{
+/* The days of a month which the calendar fires on, as bits 1 to 31. */
+    uint32_t week = 0, mask;
+    int first, d;
+
+    first = week_day(year, mon, 1);
+    for (d = 0; d < 7; d++)
+	if (cal->wdays & 1 << (first + d) % 7)
+	    week |= 1 << d;
+
+    mask = week << 1 | week << 8 | week << 15 | week << 22 | week << 29;
+    mask &= cal->mdays;
+    if (month_days(year, mon) < 31)
+	mask &= (2UL << month_days(year, mon)) - 1;
+    return mask;
+}
+
+static int
+find_day(const struct calendar *cal, struct tm *day)
+{
+/* Move day on to the first date from it on which the calendar fires.
+ * Returns -1 if there is none within SEARCH_MONTHS.
+ */
+    int year = day->tm_year + 1900, mon = day->tm_mon, mday = day->tm_mday;
+    uint32_t mask;
+    int i;
+
+    if (mday > month_days(year, mon)) {
+	mday = 1;
+	if (++mon == 12) {
+	    mon = 0;
+	    year++;
+	}
+    }
+
+    for (i = 0; i < SEARCH_MONTHS; i++) {
+	if (cal->months & 1 << mon) {
+	    mask = month_mask(cal, year, mon) & ~((1UL << mday) - 1);
+	    if (mask != 0) {
+		day->tm_year = year - 1900;
+		day->tm_mon = mon;
+		day->tm_mday = lowest_bit(mask);
+		return 0;
+	    }
+	}
+	mday = 1;
+	if (++mon == 12) {
+	    mon = 0;
+	    year++;
+	}
+    }
+    return -1;
+}
+
+static time_t
+midnight(const struct tm *day, int offset)
+{
+    struct tm tm;
+
+    memset(&tm, 0, sizeof(tm));
+    tm.tm_year = day->tm_year;
+    tm.tm_mon = day->tm_mon;
+    tm.tm_mday = day->tm_mday + offset;
+    tm.tm_isdst = -1;
+    return mktime(&tm);
+}
+
+static int
+fires_at(const struct calendar *cal, int hour, int min)
+{
+    return (cal->hours & 1UL << hour) && (cal->minutes & 1ULL << min);
+}
+
+static time_t
+plain_day(struct calendar_iter *it, time_t from)
+{
+/* The first fire time from from on in a day of exactly 24 hours, where
+ * the time of day is simply the seconds since midnight.  0 if there is
+ * none left.
+ */
+    const struct calendar *cal = it->cal;
+    long pos = (from - it->day_start + 59) / 60;
+    uint64_t mins;
+    uint32_t hours;
+    int hour, min;
+
+    if (pos < 0)
+	pos = 0;
+    hour = pos / 60;
+    min = pos % 60;
+    if (hour >= 24)
+	return 0;
+
+    if (cal->hours & 1UL << hour) {
+	mins = cal->minutes & ~((1ULL << min) - 1);
+	if (mins != 0)
+	    return it->day_start + hour * 3600L + lowest_bit(mins) * 60L;
+    }
+    hours = cal->hours & ~((2UL << hour) - 1);
+    if (hours == 0 || cal->minutes == 0)
+	return 0;
+    return it->day_start + lowest_bit(hours) * 3600L
+	+ lowest_bit(cal->minutes) * 60L;
+}
+
+static time_t
+changing_day(struct calendar_iter *it, time_t from)
+{
+/* The same for a day on which the clocks change, going through it a
+ * minute at a time.  A time given to the hour fires once even when the
+ * clocks go back over it, and when they skip it, fires as soon as they
+ * have; times which only give the minute fire on every hour there is.
+ */
+    const struct calendar *cal = it->cal;
+    int every_hour = (cal->hours & CALENDAR_ALL_HOURS) == CALENDAR_ALL_HOURS;
+    struct tm tm, prev, before;
+    time_t t, u;
+    int m, now;
+
+    if (from < it->day_start)
+	from = it->day_start;
+    t = (from + 59) / 60 * 60 - 60;
+    localtime_r(&t, &prev);
+
+    for (t += 60; t < it->day_end; t += 60, prev = tm) {
+	localtime_r(&t, &tm);
+	if (fires_at(cal, tm.tm_hour, tm.tm_min)) {
+	    if (every_hour || tm.tm_isdst > 0)
+		return t;
+
+	    /* Did the clocks show this time an hour ago, before they went
+	     * back?
+	     */
+	    u = t - 3600;
+	    localtime_r(&u, &before);
+	    if (before.tm_isdst <= 0 || before.tm_hour != tm.tm_hour
+		|| before.tm_min != tm.tm_min)
+		return t;
+	    continue;
+	}
+	if (every_hour || prev.tm_mday != tm.tm_mday)
+	    continue;
+
+	/* Did the clocks go forward over a time it fires at? */
+	now = tm.tm_hour * 60 + tm.tm_min;
+	for (m = prev.tm_hour * 60 + prev.tm_min + 1; m < now; m++)
+	    if (fires_at(cal, m / 60, m % 60))
+		return t;
+    }
+    return 0;
+}
+
+/* Global functions */
+
+void
+calendar_every(struct calendar *cal)
+{
+/* Every minute of every day. */
+    cal->minutes = CALENDAR_ALL_MINUTES;
+    cal->hours = CALENDAR_ALL_HOURS;
+    cal->mdays = CALENDAR_ALL_MDAYS;
+    cal->months = CALENDAR_ALL_MONTHS;
+    cal->wdays = CALENDAR_ALL_WDAYS;
+}
+
+int
+calendar_parse(const char *spec, struct calendar *cal)
+{
+/* "minutes/hours/mdays/months/wdays", each a bitmask in hex or * for
+ * all of them.  Returns -1, leaving cal alone, if spec is malformed.
+ */
+    unsigned long long v[5];
+    const char *p = spec;
+    char *end;
+    int i;
+
+    for (i = 0; i < 5; i++) {
+	if (i > 0 && *p++ != '/')
+	    return -1;
+	if (*p == '*') {
+	    v[i] = all_set[i];
+	    p++;
+	    continue;
+	}
+	v[i] = strtoull(p, &end, 16);
+	if (end == p || v[i] == 0 || (v[i] & ~all_set[i]) != 0)
+	    return -1;
+	p = end;
+    }
+    if (*p != '\0')
+	return -1;
+
+    cal->minutes = v[0];
+    cal->hours = v[1];
+    cal->mdays = v[2];
+    cal->months = v[3];
+    cal->wdays = v[4];
+    return 0;
+}
+
+int
+calendar_format(const struct calendar *cal, char *buf, size_t len)
+{
+/* The inverse of calendar_parse().  Returns -1 if buf is too short. */
+    const unsigned long long v[] = {
+	cal->minutes, cal->hours, cal->mdays, cal->months, cal->wdays
+    };
+    size_t used = 0;
+    int i, n;
+
+    for (i = 0; i < 5; i++) {
+	if (v[i] == all_set[i])
+	    n = snprintf(buf + used, len - used, "%s*", i ? "/" : "");
+	else
+	    n = snprintf(buf + used, len - used, "%s%llx", i ? "/" : "", v[i]);
+	if (n < 0 || (size_t) n >= len - used)
+	    return -1;
+	used += n;
+    }
+    return 0;
+}
+
+time_t
+calendar_mktime(const struct tm *wall, int last)
+{
+/* mktime() for a time as the clock on the wall shows it, whatever its
+ * tm_isdst.  A time which the clocks show twice, as they go back, is the
+ * first of the two, or the last if last is set, where mktime() may take
+ * either.  One which they skip as they go forward is the moment they do,
+ * as for calendar_step(), where mktime() would go on by the whole gap.
+ */
+    struct tm tm, at;
+    time_t t, best = (time_t) -1, lo, hi, mid;
+    int isdst, want, shift;
+
+    want = ((wall->tm_hour * 60 + wall->tm_min) % DAY_MINUTES + DAY_MINUTES)
+	% DAY_MINUTES;
+    for (isdst = 0; isdst <= 1; isdst++) {
+	tm = *wall;
+	tm.tm_isdst = isdst;
+	if ((t = mktime(&tm)) == (time_t) -1 || tm.tm_isdst != isdst
+	    || tm.tm_hour * 60 + tm.tm_min != want)
+	    continue;
+	if (best == (time_t) -1 || (last ? t > best : t < best))
+	    best = t;
+    }
+    if (best != (time_t) -1)
+	return best;
+
+    tm = *wall;
+    tm.tm_isdst = -1;
+    if ((t = mktime(&tm)) == (time_t) -1)
+	return t;
+    shift = (tm.tm_hour * 60 + tm.tm_min - want + DAY_MINUTES) % DAY_MINUTES;
+    if (shift == 0)
+	return t;
+
+    /* The clocks went forward somewhere in the shift before t. */
+    lo = t - shift * 60L;
+    hi = t;
+    localtime_r(&lo, &at);
+    isdst = at.tm_isdst;
+    while (hi - lo > 1) {
+	mid = lo + (hi - lo) / 2;
+	localtime_r(&mid, &at);
+	if (at.tm_isdst == isdst)
+	    lo = mid;
+	else
+	    hi = mid;
+    }
+    return hi;
+}
+
+void
+calendar_start(struct calendar_iter *it, const struct calendar *cal,
+	       time_t now)
+{
+/* Get ready to go through the fire times after now. */
+    it->cal = cal;
+    it->last = now;
+    localtime_r(&now, &it->day);
+    it->day_start = 0;
+    it->day_end = 0;
+}
+
+time_t
+calendar_step(struct calendar_iter *it)
+{
+/* The next fire time, or 0 if there is none.  Going by the bitmasks,
+ * this takes one mktime() call for each day it fires on, however often
+ * it fires that day, unless the clocks change.
+ */
+    time_t t;
+    int days, mday, mon, year;
+
+    for (days = 0; days < SEARCH_MONTHS * 31; days++) {
+	if (it->day_start == 0) {
+	    mday = it->day.tm_mday;
+	    mon = it->day.tm_mon;
+	    year = it->day.tm_year;
+	    if (find_day(it->cal, &it->day) == -1)
+		return 0;
+
+	    /* The day after the last one starts where that ended. */
+	    if (it->day_end != 0 && it->day.tm_mday == mday
+		&& it->day.tm_mon == mon && it->day.tm_year == year)
+		it->day_start = it->day_end;
+	    else
+		it->day_start = midnight(&it->day, 0);
+	    it->day_end = midnight(&it->day, 1);
+	    if (it->day_start == (time_t) -1 || it->day_end == (time_t) -1)
+		return 0;
+	}
+
+	if (it->last >= it->day_end)
+	    t = 0;
+	else if (it->day_end - it->day_start == DAY_SECS)
+	    t = plain_day(it, it->last + 1);
+	else
+	    t = changing_day(it, it->last + 1);
+	if (t != 0)
+	    return it->last = t;
+
+	it->day.tm_mday++;
+	it->day_start = 0;
+    }
+    return 0;
+}
+
+time_t
+calendar_next(const struct calendar *cal, time_t now)
+{
+/* The first fire time after now, 0 if there is none. */
+    struct calendar_iter it;
+
+    calendar_start(&it, cal, now);
+    return calendar_step(&it);
+}
+
+#ifdef TEST_CALENDAR
+
+int
+main(int argc, char **argv)
+{
+/* The next count fire times after now of the calendar expression spec,
+ * stepping through them and looking each up afresh, which must agree.
+ */
+    struct calendar cal;
+    struct calendar_iter it;
+    time_t t, prev, next;
+    int i, count = 1;
+
+    if (argc < 3 || argc > 4) {
+	fprintf(stderr, "usage: calendartest [now] [calendar] [count]\n");
+	exit(EXIT_FAILURE);
+    }
+    if (argc == 4)
+	count = atoi(argv[3]);
+
+    if (calendar_parse(argv[2], &cal) == -1) {
+	printf("Ooops...\n");
+	return 1;
+    }
+    prev = (time_t) atoll(argv[1]);
+    calendar_start(&it, &cal, prev);
+    for (i = 0; i < count; i++, prev = t) {
+	t = calendar_step(&it);
+	if ((next = calendar_next(&cal, prev)) != t) {
+	    printf("calendar_step() gives %ld, calendar_next() %ld\n",
+		   (long) t, (long) next);
+	    return 1;
+	}
+	if (t == 0) {
+	    printf("never\n");
+	    break;
+	}
+	printf("%s", ctime(&t));
+    }
+    return 0;
+}
+#endif
@@ -0,0 +1,65 @@
+/*
+ *  calendar.h - calendar expressions for recurring jobs
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _CALENDAR_H
+#define _CALENDAR_H
+
+#include <sys/types.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/* A calendar expression such as "every weekday at 09:30" is kept as one
+ * bit for each minute, hour, day of the month, month and day of the week
+ * it fires on, in local time; it fires whenever all five match.
+ */
+#define CALENDAR_ALL_MINUTES 0x0fffffffffffffffULL
+#define CALENDAR_ALL_HOURS 0x00ffffffUL
+#define CALENDAR_ALL_MDAYS 0xfffffffeUL	/* bits 1 to 31 */
+#define CALENDAR_ALL_MONTHS 0x0fff
+#define CALENDAR_ALL_WDAYS 0x7f
+
+struct calendar {
+    uint64_t minutes;
+    uint32_t hours;
+    uint32_t mdays;
+    uint16_t months;
+    uint8_t wdays;		/* bit 0 is Sunday */
+};
+
+/* Where calendar_step() has got to.  It keeps the day it is in, so that
+ * running through many fire times only goes to mktime() once a day.
+ */
+struct calendar_iter {
+    const struct calendar *cal;
+    time_t last;		/* the last fire time returned */
+    struct tm day;		/* local date of the day being looked at */
+    time_t day_start;		/* its midnight, 0 if not worked out yet */
+    time_t day_end;		/* the next midnight */
+};
+
+void calendar_every(struct calendar *cal);
+time_t calendar_mktime(const struct tm *wall, int last);
+int calendar_parse(const char *spec, struct calendar *cal);
+int calendar_format(const struct calendar *cal, char *buf, size_t len);
+time_t calendar_next(const struct calendar *cal, time_t now);
+void calendar_start(struct calendar_iter *it, const struct calendar *cal,
+		    time_t now);
+time_t calendar_step(struct calendar_iter *it);
+
+#endif
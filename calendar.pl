@@ -0,0 +1,73 @@
+#! /usr/bin/perl
+#
+# calendar.pl - test suite for the calendar expressions of at jobs
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+
+use strict;
+use warnings;
+
+use Test::More 0.87;
+
+my $calendartest = "./calendartest 2>/dev/null";
+
+sub test {
+	my ($now, $spec, $count, $expected, $test_name) = @_;
+	$test_name = "$now: $spec" unless defined $test_name;
+
+	my $got = qx{$calendartest $now '$spec' $count};
+	chomp $got;
+	is($got, join("\n", @$expected), $test_name);
+}
+
+$ENV{TZ} = "America/New_York";
+
+# malformed expressions
+test(1, "0/*/*/*/*", 1, ["Ooops..."]);
+test(1, "1/*/*/*", 1, ["Ooops..."]);
+
+# every quarter hour, and weekdays at 09:30 from a Friday noon
+test(1705683600, "200040008001/*/*/*/*", 3,
+     ["Fri Jan 19 12:15:00 2024", "Fri Jan 19 12:30:00 2024",
+      "Fri Jan 19 12:45:00 2024"]);
+test(1705683600, "40000000/200/*/*/3e", 3,
+     ["Mon Jan 22 09:30:00 2024", "Tue Jan 23 09:30:00 2024",
+      "Wed Jan 24 09:30:00 2024"]);
+
+# days of the month are not clamped: the 31st skips shorter months, the
+# 29th of February waits for a leap year and the 30th never comes
+test(1705683600, "1/1/80000000/*/*", 3,
+     ["Wed Jan 31 00:00:00 2024", "Sun Mar 31 00:00:00 2024",
+      "Fri May 31 00:00:00 2024"]);
+test(1705683600, "1/1/20000000/2/*", 2,
+     ["Thu Feb 29 00:00:00 2024", "Tue Feb 29 00:00:00 2028"]);
+test(1705683600, "1/1/40000000/2/*", 1, ["never"]);
+
+# day of the month and day of the week must both match: Friday the 13th
+test(1705683600, "1/1/2000/*/20", 3,
+     ["Fri Sep 13 00:00:00 2024", "Fri Dec 13 00:00:00 2024",
+      "Fri Jun 13 00:00:00 2025"]);
+
+# the clocks going forward at 02:00 on Sun Mar 10 2024: 02:30 runs as
+# they do, every half hour skips the hour which does not exist
+test(1710046800, "40000000/4/*/*/*", 2,
+     ["Sun Mar 10 03:00:00 2024", "Mon Mar 11 02:30:00 2024"]);
+test(1710046800, "40000001/*/*/*/*", 5,
+     ["Sun Mar 10 00:30:00 2024", "Sun Mar 10 01:00:00 2024",
+      "Sun Mar 10 01:30:00 2024", "Sun Mar 10 03:00:00 2024",
+      "Sun Mar 10 03:30:00 2024"]);
+
+# the clocks going back at 02:00 on Sun Nov 3 2024: 01:30 runs once,
+# every half hour runs in both passes of the hour
+test(1730606400, "40000000/2/*/*/*", 2,
+     ["Sun Nov  3 01:30:00 2024", "Mon Nov  4 01:30:00 2024"]);
+test(1730606400, "40000001/*/*/*/*", 6,
+     ["Sun Nov  3 00:30:00 2024", "Sun Nov  3 01:00:00 2024",
+      "Sun Nov  3 01:30:00 2024", "Sun Nov  3 01:00:00 2024",
+      "Sun Nov  3 01:30:00 2024", "Sun Nov  3 02:00:00 2024"]);
+
+done_testing();
+1;
@@ -0,0 +1,351 @@
+/*
+ *  cgroup.c - a cgroup of its own for each job
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/* System Headers */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#elif defined(HAVE_SYS_FCNTL_H)
+#include <sys/fcntl.h>
+#endif
+
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+/* Local headers */
+
+#include "cgroup.h"
+
+/* Macros */
+
+#define CPU_PERIOD 100000	/* microseconds, for cpu.max */
+#define DESTROY_TRIES 100
+#define DESTROY_WAIT 10000	/* microseconds between them */
+
+#ifndef O_CLOEXEC
+#define O_CLOEXEC 0
+#endif
+#ifndef O_DIRECTORY
+#define O_DIRECTORY 0
+#endif
+
+/* File scope variables */
+
+static const char *controllers[] = { "cpu", "io", "memory" };
+static int jobs_fd = -1;
+
+/* Local functions */
+
+static int
+write_file(int dirfd, const char *file, const char *value)
+{
+    ssize_t len = strlen(value);
+    int fd, rc = 0;
+
+    if ((fd = openat(dirfd, file, O_WRONLY | O_CLOEXEC)) == -1)
+	return -1;
+    if (write(fd, value, len) != len)
+	rc = -1;
+    if (close(fd) == -1)
+	rc = -1;
+    return rc;
+}
+
+static ssize_t
+read_file(int dirfd, const char *file, char *buf, size_t size)
+{
+    ssize_t len;
+    int fd;
+
+    if ((fd = openat(dirfd, file, O_RDONLY | O_CLOEXEC)) == -1)
+	return -1;
+    len = read(fd, buf, size - 1);
+    close(fd);
+    if (len < 0)
+	return -1;
+    buf[len] = '\0';
+    return len;
+}
+
+static int
+open_dir(int dirfd, const char *name)
+{
+/* The callers redirect the standard descriptors, which may well be
+ * closed when we get here, so keep out of their way.
+ */
+    int fd, fd2;
+
+    if ((fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1
+	|| fd > STDERR_FILENO)
+	return fd;
+    fd2 = fcntl(fd, F_DUPFD, STDERR_FILENO + 1);
+    close(fd);
+    if (fd2 != -1)
+	fcntl(fd2, F_SETFD, FD_CLOEXEC);
+    return fd2;
+}
+
+static void
+delegate(int dirfd)
+{
+/* Hand the controllers we use down to the children of a cgroup, as far
+ * as they are available.
+ */
+    char buf[256], op[16];
+    char *p, *save;
+    size_t i;
+
+    if (read_file(dirfd, "cgroup.controllers", buf, sizeof(buf)) == -1)
+	return;
+    for (p = strtok_r(buf, " \n", &save); p != NULL;
+	 p = strtok_r(NULL, " \n", &save))
+	for (i = 0; i < sizeof(controllers) / sizeof(controllers[0]); i++)
+	    if (strcmp(p, controllers[i]) == 0) {
+		snprintf(op, sizeof(op), "+%s", p);
+		(void) write_file(dirfd, "cgroup.subtree_control", op);
+	    }
+}
+
+static int
+find_own(char *path, size_t size)
+{
+/* Where our cgroup on the unified hierarchy is in the file system. */
+    char mnt[PATH_MAX], type[64], rel[PATH_MAX];
+    char line[3 * PATH_MAX];
+    FILE *fp;
+    int found = 0;
+
+    if ((fp = fopen("/proc/self/mounts", "r")) == NULL)
+	return -1;
+    while (!found && fgets(line, sizeof(line), fp) != NULL)
+	if (sscanf(line, "%*s %4095s %63s", mnt, type) == 2
+	    && strcmp(type, "cgroup2") == 0)
+	    found = 1;
+    fclose(fp);
+    if (!found)
+	goto nocgroup;
+
+    if ((fp = fopen("/proc/self/cgroup", "r")) == NULL)
+	return -1;
+    found = 0;
+    while (!found && fgets(line, sizeof(line), fp) != NULL)
+	if (sscanf(line, "0::%4095s", rel) == 1)
+	    found = 1;
+    fclose(fp);
+    if (!found)
+	goto nocgroup;
+
+    if (snprintf(path, size, "%s%s", mnt, strcmp(rel, "/") ? rel : "")
+	>= (int) size) {
+	errno = ENAMETOOLONG;
+	return -1;
+    }
+    return 0;
+
+nocgroup:
+    errno = ENOENT;
+    return -1;
+}
+
+/* Global functions */
+
+int
+cgroup_init(void)
+{
+/* Set up a "jobs" cgroup next to ourselves to put the jobs in.  Only the
+ * root cgroup may both hold processes and hand controllers down, so
+ * unless we are in it, we move into a "daemon" cgroup first.  Under
+ * systemd, this needs Delegate=yes.  Returns -1 if cgroups can't be
+ * used.
+ */
+    char path[PATH_MAX], type[64];
+    int own, fd;
+
+    if (find_own(path, sizeof(path)) == -1)
+	return -1;
+    if ((own = open_dir(AT_FDCWD, path)) == -1)
+	return -1;
+
+    /* The root has no type. */
+    if (read_file(own, "cgroup.type", type, sizeof(type)) != -1) {
+	if ((mkdirat(own, "daemon", 0755) == -1 && errno != EEXIST)
+	    || (fd = open_dir(own, "daemon")) == -1) {
+	    close(own);
+	    return -1;
+	}
+	if (write_file(fd, "cgroup.procs", "0") == -1) {
+	    close(fd);
+	    close(own);
+	    return -1;
+	}
+	close(fd);
+    }
+    delegate(own);
+
+    if ((mkdirat(own, "jobs", 0755) == -1 && errno != EEXIST)
+	|| (jobs_fd = open_dir(own, "jobs")) == -1) {
+	close(own);
+	return -1;
+    }
+    close(own);
+    delegate(jobs_fd);
+    return 0;
+}
+
+int
+cgroup_create(const char *name)
+{
+/* Make a cgroup for a job and return a descriptor for it.  One left
+ * over from an earlier attempt at the same job is cleared out first.
+ */
+    if (mkdirat(jobs_fd, name, 0755) == -1) {
+	if (errno != EEXIST)
+	    return -1;
+	cgroup_destroy(open_dir(jobs_fd, name), name);
+	if (mkdirat(jobs_fd, name, 0755) == -1)
+	    return -1;
+    }
+    return open_dir(jobs_fd, name);
+}
+
+int
+cgroup_limit(int cg, const struct cgroup_limits *lim)
+{
+/* Apply whatever limits are set.  Returns -1 if any of them could not
+ * be, typically because the controller isn't there.
+ */
+    char buf[CGROUP_IO_MAX + 32];
+    char *p;
+    int rc = 0;
+
+    if (lim->memory_high != 0) {
+	snprintf(buf, sizeof(buf), "%llu", lim->memory_high);
+	rc |= write_file(cg, "memory.high", buf);
+    }
+    if (lim->memory_max != 0) {
+	snprintf(buf, sizeof(buf), "%llu", lim->memory_max);
+	rc |= write_file(cg, "memory.max", buf);
+    }
+    if (lim->cpu_weight != 0) {
+	snprintf(buf, sizeof(buf), "%u", lim->cpu_weight);
+	rc |= write_file(cg, "cpu.weight", buf);
+    }
+    if (lim->cpu_max != 0) {
+	snprintf(buf, sizeof(buf), "%lu %u",
+		 (unsigned long) lim->cpu_max * CPU_PERIOD / 100, CPU_PERIOD);
+	rc |= write_file(cg, "cpu.max", buf);
+    }
+    if (lim->io_max[0] != '\0') {
+	snprintf(buf, sizeof(buf), "%s", lim->io_max);
+	for (p = buf; (p = strchr(p, ',')) != NULL; p++)
+	    *p = ' ';
+	rc |= write_file(cg, "io.max", buf);
+    }
+    return rc ? -1 : 0;
+}
+
+int
+cgroup_enter(int cg)
+{
+/* Move the calling process into the cgroup. */
+    return write_file(cg, "cgroup.procs", "0");
+}
+
+int
+cgroup_freeze(int cg, int frozen)
+{
+    return write_file(cg, "cgroup.freeze", frozen ? "1" : "0");
+}
+
+int
+cgroup_signal(int cg, int sig)
+{
+/* Send sig to every process in the cgroup.  Returns how many there were,
+ * or -1 if we can't tell.
+ */
+    char buf[4096];
+    char *p, *save;
+    int n = 0;
+
+    if (read_file(cg, "cgroup.procs", buf, sizeof(buf)) == -1)
+	return -1;
+    for (p = strtok_r(buf, "\n", &save); p != NULL;
+	 p = strtok_r(NULL, "\n", &save), n++)
+	kill((pid_t) strtol(p, NULL, 10), sig);
+    return n;
+}
+
+int
+cgroup_usage(int cg, struct cgroup_usage *usage)
+{
+/* What the job and everything it started have used. */
+    char buf[1024];
+    char *line, *save;
+
+    memset(usage, 0, sizeof(*usage));
+    if (read_file(cg, "cpu.stat", buf, sizeof(buf)) == -1)
+	return -1;
+    for (line = strtok_r(buf, "\n", &save); line != NULL;
+	 line = strtok_r(NULL, "\n", &save)) {
+	sscanf(line, "user_usec %llu", &usage->user_usec);
+	sscanf(line, "system_usec %llu", &usage->system_usec);
+    }
+    if (read_file(cg, "memory.peak", buf, sizeof(buf)) != -1)
+	usage->memory_peak = strtoull(buf, NULL, 10);
+    return 0;
+}
+
+void
+cgroup_destroy(int cg, const char *name)
+{
+/* Kill whatever is left in the cgroup, such as daemons the job started,
+ * and remove it once they are gone.  Kernels before cgroup.kill get each
+ * process killed in turn.
+ */
+    int tries;
+
+    if (cg != -1 && write_file(cg, "cgroup.kill", "1") == -1)
+	for (tries = 0; tries < DESTROY_TRIES
+	     && cgroup_signal(cg, SIGKILL) > 0; tries++)
+	    usleep(DESTROY_WAIT);
+
+    for (tries = 0; tries < DESTROY_TRIES
+	 && unlinkat(jobs_fd, name, AT_REMOVEDIR) == -1 && errno == EBUSY;
+	 tries++)
+	usleep(DESTROY_WAIT);
+    if (cg != -1)
+	close(cg);
+}
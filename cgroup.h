@@ -0,0 +1,52 @@
+/*
+ *  cgroup.h - a cgroup of its own for each job
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _CGROUP_H
+#define _CGROUP_H
+
+#include <sys/types.h>
+
+/* Limits for a job's cgroup, as at.conf gives them.  Zero or an empty
+ * string leaves the kernel's default alone.
+ */
+#define CGROUP_IO_MAX 64
+
+struct cgroup_limits {
+    unsigned long long memory_high;	/* bytes */
+    unsigned long long memory_max;	/* bytes */
+    unsigned int cpu_weight;		/* 1 to 10000, 100 being normal */
+    unsigned int cpu_max;		/* percent of one CPU */
+    char io_max[CGROUP_IO_MAX];		/* "major:minor,key=value,..." */
+};
+
+struct cgroup_usage {
+    unsigned long long user_usec;
+    unsigned long long system_usec;
+    unsigned long long memory_peak;	/* bytes, 0 if not known */
+};
+
+int cgroup_init(void);
+int cgroup_create(const char *name);
+int cgroup_limit(int cg, const struct cgroup_limits *lim);
+int cgroup_enter(int cg);
+int cgroup_freeze(int cg, int frozen);
+int cgroup_signal(int cg, int sig);
+int cgroup_usage(int cg, struct cgroup_usage *usage);
+void cgroup_destroy(int cg, const char *name);
+
+#endif
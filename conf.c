@@ -0,0 +1,387 @@
+/*
+ *  conf.c - per-queue and per-user settings from at.conf
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/* System Headers */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <ctype.h>
+#include <limits.h>
+#include <pwd.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Local headers */
+
+#include "conf.h"
+
+/* Structures and unions */
+
+enum conf_type {
+    CONF_UINT,
+    CONF_SIZE,
+    CONF_IO,
+    CONF_NAME,
+    CONF_LIST,
+    CONF_WINDOW,
+    CONF_QUEUE
+};
+
+struct conf_key {
+    const char *name;
+    enum conf_type type;
+    size_t offset;
+    const char *const *names;	/* for CONF_NAME, stored as 1 + index */
+};
+
+struct user_conf {
+    uid_t uid;
+    struct conf_ent ent;
+};
+
+/* File scope variables */
+
+static const char *const policies[] = { "other", "batch", "idle", NULL };
+static const char *const ioclasses[] = {
+    "realtime", "best-effort", "idle", NULL
+};
+static const char *const mempolicies[] = {
+    "preferred", "bind", "interleave", NULL
+};
+static const char *const placements[] = { "fixed", "spread", NULL };
+static const char *const coalescing[] = { "replace", "keep", NULL };
+
+static const struct conf_key keys[] = {
+    { "weight", CONF_UINT, offsetof(struct conf_ent, weight) },
+    { "maxrun", CONF_UINT, offsetof(struct conf_ent, maxrun) },
+    { "timeout", CONF_UINT, offsetof(struct conf_ent, timeout) },
+    { "maxjobs", CONF_UINT, offsetof(struct conf_ent, maxjobs) },
+    { "maxbytes", CONF_SIZE, offsetof(struct conf_ent, maxbytes) },
+    { "maxrate", CONF_UINT, offsetof(struct conf_ent, maxrate) },
+    { "coalesce", CONF_NAME, offsetof(struct conf_ent, coalesce), coalescing },
+    { "maxlate", CONF_UINT, offsetof(struct conf_ent, maxlate) },
+    { "divert", CONF_QUEUE, offsetof(struct conf_ent, divert) },
+    { "window", CONF_WINDOW, offsetof(struct conf_ent, window) },
+    { "memory_high", CONF_SIZE,
+      offsetof(struct conf_ent, limits.memory_high) },
+    { "memory_max", CONF_SIZE, offsetof(struct conf_ent, limits.memory_max) },
+    { "cpu_weight", CONF_UINT, offsetof(struct conf_ent, limits.cpu_weight) },
+    { "cpu_max", CONF_UINT, offsetof(struct conf_ent, limits.cpu_max) },
+    { "io_max", CONF_IO, offsetof(struct conf_ent, limits.io_max) },
+    { "policy", CONF_NAME, offsetof(struct conf_ent, prio.policy), policies },
+    { "ioclass", CONF_NAME, offsetof(struct conf_ent, prio.ioclass),
+      ioclasses },
+    { "iolevel", CONF_UINT, offsetof(struct conf_ent, prio.iolevel) },
+    { "uclamp_max", CONF_UINT, offsetof(struct conf_ent, prio.uclamp_max) },
+    { "cpus", CONF_LIST, offsetof(struct conf_ent, place.cpus) },
+    { "nodes", CONF_LIST, offsetof(struct conf_ent, place.nodes) },
+    { "mempolicy", CONF_NAME, offsetof(struct conf_ent, place.mempolicy),
+      mempolicies },
+    { "placement", CONF_NAME, offsetof(struct conf_ent, place.placement),
+      placements },
+};
+
+static const struct conf_ent builtin = {
+    1,				/* weight */
+    0,				/* maxrun */
+    0,				/* timeout */
+    0,				/* maxjobs */
+    0,				/* maxbytes */
+    0,				/* maxrate */
+    0,				/* coalesce */
+    0,				/* maxlate */
+    0,				/* divert */
+    { 0 },			/* window */
+    { 0, 0, 0, 0, "" },		/* limits */
+    { 0, 0, 4, 100 },		/* prio */
+    { "", "", 0, 0 }		/* place */
+};
+
+static struct conf_ent queue_default, user_default;
+static struct conf_ent queues[UCHAR_MAX + 1];
+static struct user_conf *users = NULL;
+static size_t nusers = 0;
+static struct stat loaded;
+static int initialized = 0;
+static int have_conf = 0;
+
+/* Local functions */
+
+static void
+reset(void)
+{
+    int i;
+
+    queue_default = builtin;
+    user_default = builtin;
+    for (i = 0; i <= UCHAR_MAX; i++)
+	queues[i] = builtin;
+    free(users);
+    users = NULL;
+    nusers = 0;
+}
+
+static struct conf_ent *
+find_user(uid_t uid, int create)
+{
+    struct user_conf *u;
+    size_t i;
+
+    for (i = 0; i < nusers; i++)
+	if (users[i].uid == uid)
+	    return &users[i].ent;
+
+    if (!create)
+	return NULL;
+
+    if ((u = realloc(users, (nusers + 1) * sizeof(*users))) == NULL)
+	return NULL;
+    users = u;
+    users[nusers].uid = uid;
+    users[nusers].ent = user_default;
+    return &users[nusers++].ent;
+}
+
+static int
+parse_size(const char *s, unsigned long long *size)
+{
+/* A number of bytes, optionally followed by K, M, G or T. */
+    unsigned long long ull;
+    char *end;
+    int shift = 0;
+
+    if (!isdigit((unsigned char) *s))
+	return -1;
+    ull = strtoull(s, &end, 10);
+    switch (toupper((unsigned char) *end)) {
+    case 'T':
+	shift += 10;
+	/* FALLTHROUGH */
+    case 'G':
+	shift += 10;
+	/* FALLTHROUGH */
+    case 'M':
+	shift += 10;
+	/* FALLTHROUGH */
+    case 'K':
+	shift += 10;
+	end++;
+    }
+    if (*end != '\0' || ull > (ULLONG_MAX >> shift))
+	return -1;
+    *size = ull << shift;
+    return 0;
+}
+
+static int
+set_key(struct conf_ent *ent, const char *setting)
+{
+    const char *eq;
+    unsigned long ul;
+    unsigned int major, minor;
+    int n;
+    char *end;
+    size_t i, len;
+
+    if ((eq = strchr(setting, '=')) == NULL)
+	return -1;
+    len = eq - setting;
+
+    for (i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+	if (strlen(keys[i].name) != len
+	    || strncmp(keys[i].name, setting, len) != 0)
+	    continue;
+
+	switch (keys[i].type) {
+	case CONF_UINT:
+	    ul = strtoul(eq + 1, &end, 10);
+	    if (eq[1] == '\0' || *end != '\0' || ul > UINT_MAX)
+		return -1;
+	    *(unsigned int *) ((char *) ent + keys[i].offset) = ul;
+	    break;
+	case CONF_SIZE:
+	    if (parse_size(eq + 1, (unsigned long long *)
+			   ((char *) ent + keys[i].offset)) == -1)
+		return -1;
+	    break;
+	case CONF_NAME:
+	    for (n = 0; keys[i].names[n] != NULL; n++)
+		if (strcmp(keys[i].names[n], eq + 1) == 0)
+		    break;
+	    if (keys[i].names[n] == NULL)
+		return -1;
+	    *(unsigned int *) ((char *) ent + keys[i].offset) = n + 1;
+	    break;
+	case CONF_IO:
+	    /* An io.max line for one device, with commas for blanks. */
+	    if (strlen(eq + 1) >= CGROUP_IO_MAX
+		|| sscanf(eq + 1, "%u:%u%n", &major, &minor, &n) != 2
+		|| (eq[1 + n] != ',' && eq[1 + n] != '\0'))
+		return -1;
+	    strcpy((char *) ent + keys[i].offset, eq + 1);
+	    break;
+	case CONF_LIST:
+	    /* CPU or node numbers such as 0-3,8. */
+	    if (!place_list_valid(eq + 1))
+		return -1;
+	    strcpy((char *) ent + keys[i].offset, eq + 1);
+	    break;
+	case CONF_WINDOW:
+	    if (window_parse(eq + 1, (struct window_set *)
+			     ((char *) ent + keys[i].offset)) == -1)
+		return -1;
+	    break;
+	case CONF_QUEUE:
+	    if (!isalpha((unsigned char) eq[1]) || eq[2] != '\0')
+		return -1;
+	    *(unsigned int *) ((char *) ent + keys[i].offset) =
+		(unsigned char) eq[1];
+	    break;
+	}
+	return 0;
+    }
+    return -1;
+}
+
+static int
+parse_line(char *line, int defaults)
+{
+/* Apply one line.  The "*" lines are applied in a first pass over the
+ * file and everything else in a second one, so that the defaults do not
+ * depend on where in the file they are.
+ */
+    struct conf_ent *ent;
+    struct passwd *pw;
+    char *scope, *name, *setting, *save, *end;
+    unsigned long ul;
+
+    if ((scope = strtok_r(line, " \t\n", &save)) == NULL || *scope == '#')
+	return 0;
+    if ((name = strtok_r(NULL, " \t\n", &save)) == NULL)
+	return -1;
+
+    if ((strcmp(name, "*") == 0) != defaults)
+	return 0;
+
+    if (strcmp(scope, "queue") == 0) {
+	if (defaults)
+	    ent = &queue_default;
+	else if (name[1] == '\0' && isalpha((unsigned char) name[0]))
+	    ent = &queues[(unsigned char) name[0]];
+	else
+	    return -1;
+    }
+    else if (strcmp(scope, "user") == 0) {
+	if (defaults)
+	    ent = &user_default;
+	else {
+	    if ((pw = getpwnam(name)) != NULL)
+		ul = pw->pw_uid;
+	    else {
+		ul = strtoul(name, &end, 10);
+		if (!isdigit((unsigned char) *name) || *end != '\0')
+		    return -1;
+	    }
+	    if ((ent = find_user((uid_t) ul, 1)) == NULL)
+		return -1;
+	}
+    }
+    else
+	return -1;
+
+    while ((setting = strtok_r(NULL, " \t\n", &save)) != NULL)
+	if (set_key(ent, setting) == -1)
+	    return -1;
+
+    if (ent->weight == 0)
+	ent->weight = 1;
+    return 0;
+}
+
+/* Global functions */
+
+int
+conf_load(int *badline)
+{
+/* (Re)read at.conf if it has changed since the last call.  Returns 0 if
+ * nothing changed, 1 if the settings were replaced, or -1 if some lines
+ * were bad, the first of which is stored in *badline; the others are
+ * still used.
+ */
+    struct stat st;
+    char line[1024];
+    FILE *fp;
+    int pass, lineno, rc = 1, i;
+
+    if (stat(ATCONF, &st) == -1) {
+	if (initialized && !have_conf)
+	    return 0;
+	reset();
+	initialized = 1;
+	have_conf = 0;
+	return 1;
+    }
+    if (have_conf && st.st_dev == loaded.st_dev && st.st_ino == loaded.st_ino
+	&& st.st_mtime == loaded.st_mtime && st.st_size == loaded.st_size)
+	return 0;
+
+    reset();
+    loaded = st;
+    initialized = 1;
+    have_conf = 1;
+
+    if ((fp = fopen(ATCONF, "r")) == NULL)
+	return 1;
+
+    for (pass = 1; pass >= 0; pass--) {
+	if (pass == 0)
+	    for (i = 0; i <= UCHAR_MAX; i++)
+		queues[i] = queue_default;
+
+	rewind(fp);
+	for (lineno = 1; fgets(line, sizeof(line), fp) != NULL; lineno++)
+	    if (parse_line(line, pass) == -1 && rc == 1) {
+		*badline = lineno;
+		rc = -1;
+	    }
+    }
+    fclose(fp);
+    return rc;
+}
+
+const struct conf_ent *
+conf_queue(char queue)
+{
+    return &queues[(unsigned char) queue];
+}
+
+const struct conf_ent *
+conf_user(uid_t uid)
+{
+    const struct conf_ent *ent;
+
+    if ((ent = find_user(uid, 0)) != NULL)
+	return ent;
+    return &user_default;
+}
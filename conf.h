@@ -0,0 +1,59 @@
+/*
+ *  conf.h - per-queue and per-user settings from at.conf
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _CONF_H
+#define _CONF_H
+
+#include <sys/types.h>
+
+#include "cgroup.h"
+#include "place.h"
+#include "prio.h"
+#include "window.h"
+
+#define ATCONF ETCDIR "/at.conf"
+
+#define CONF_COALESCE_REPLACE 1	/* a job with a key replaces the one queued */
+#define CONF_COALESCE_KEEP 2	/* the one already queued stays instead */
+
+/* Each line of at.conf is "queue <letter>" or "user <name>", followed by
+ * key=value settings.  A "*" in place of the letter or name sets the
+ * default for every queue or user; anything a line does not mention
+ * keeps that default.
+ */
+struct conf_ent {
+    unsigned int weight;	/* fair share weight */
+    unsigned int maxrun;	/* jobs running at once, 0 for no limit */
+    unsigned int timeout;	/* minutes before a job is killed, 0 for never */
+    unsigned int maxjobs;	/* jobs queued at once, 0 for no limit */
+    unsigned long long maxbytes;	/* bytes of job files queued, likewise */
+    unsigned int maxrate;	/* jobs queued in the last hour, likewise */
+    unsigned int coalesce;	/* what a job with a key does, 0 for replace */
+    unsigned int maxlate;	/* minutes late a job may start, 0 for any */
+    unsigned int divert;	/* queue for jobs later still, 0 to drop them */
+    struct window_set window;	/* when jobs may start, empty for any time */
+    struct cgroup_limits limits;	/* for each job's cgroup */
+    struct job_prio prio;	/* CPU and I/O scheduling */
+    struct job_place place;	/* CPU affinity and NUMA memory policy */
+};
+
+int conf_load(int *badline);
+const struct conf_ent *conf_queue(char queue);
+const struct conf_ent *conf_user(uid_t uid);
+
+#endif
@@ -50,6 +50,7 @@
 
 int daemon_debug = 0;
 int daemon_foreground = 0;
+const char *daemon_pidfile = PIDFILE;
 
 static int
 lock_fd(int fd)
@@ -156,19 +157,19 @@ daemon_setup()
 
     PRIV_START
 
-    fd = open(PIDFILE, O_RDWR | O_CREAT | O_EXCL, S_IWUSR | S_IRUSR | S_IRGRP | S_IROTH);
+    fd = open(daemon_pidfile, O_RDWR | O_CREAT | O_EXCL, S_IWUSR | S_IRUSR | S_IRGRP | S_IROTH);
 
     if (fd == -1) {
 
 	if (errno != EEXIST)
-	    perr("Cannot open " PIDFILE);
+	    perr("Cannot open %s", daemon_pidfile);
 
-	if ((fd = open(PIDFILE, O_RDWR)) < 0)
-	    perr("Cannot open " PIDFILE);
+	if ((fd = open(daemon_pidfile, O_RDWR)) < 0)
+	    perr("Cannot open %s", daemon_pidfile);
 
 	fp = fdopen(fd, "rw");
 	if (fp == NULL) {
-	    perr("Cannot open " PIDFILE " for reading");
+	    perr("Cannot open %s for reading", daemon_pidfile);
 	}
 	pid = -1;
 	if ((fscanf(fp, "%d", &pid) != 1) || (pid == getpid())
@@ -177,28 +178,28 @@ daemon_setup()
 
 	    syslog(LOG_NOTICE, "Removing stale lockfile for pid %d", pid);
 
-	    rc = unlink(PIDFILE);
+	    rc = unlink(daemon_pidfile);
 
 	    if (rc == -1) {
-		perr("Cannot unlink " PIDFILE);
+		perr("Cannot unlink %s", daemon_pidfile);
 	    }
 	} else {
 	    pabort("Another atd already running with pid %d", pid);
 	}
 	fclose(fp);
 
-	unlink(PIDFILE);
-	fd = open(PIDFILE, O_RDWR | O_CREAT | O_EXCL,
+	unlink(daemon_pidfile);
+	fd = open(daemon_pidfile, O_RDWR | O_CREAT | O_EXCL,
 		  S_IWUSR | S_IRUSR | S_IRGRP | S_IROTH);
 
 
 	if (fd == -1)
-	    perr("Cannot open " PIDFILE " the second time round");
+	    perr("Cannot open %s the second time round", daemon_pidfile);
 
     }
 
     if (lock_fd(fd) == -1)
-	perr("Cannot lock " PIDFILE);
+	perr("Cannot lock %s", daemon_pidfile);
 
     fp = fdopen(fd, "w");
     if (fp == NULL)
@@ -223,7 +224,7 @@ daemon_cleanup()
 {
     PRIV_START
 
-	unlink(PIDFILE);
+	unlink(daemon_pidfile);
 
     PRIV_END
 }
@@ -18,3 +18,4 @@ lerr (const char *fmt, ...);
 
 extern int daemon_debug;
 extern int daemon_foreground;
+extern const char *daemon_pidfile;
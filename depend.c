@@ -0,0 +1,429 @@
+/*
+ *  depend.c - jobs which wait for others to finish
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/* System Headers */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <ctype.h>
+
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#elif defined(HAVE_SYS_FCNTL_H)
+#include <sys/fcntl.h>
+#endif
+
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+/* Local headers */
+
+#include "depend.h"
+
+/* Macros */
+
+#define STATUS_HASH 1024
+#define RECORD_MAX 64
+
+/* Structures and unions */
+
+struct sent {
+    unsigned long jobno;
+    uid_t uid;
+    int status;
+    time_t when;
+    unsigned long seen;		/* pass in which a waiting job asked */
+    struct sent *next;
+};
+
+/* File scope variables */
+
+static const char *kind_names[] = { "after", "after-ok", "after-fail" };
+
+static struct sent *table[STATUS_HASH];
+static dev_t loaded_dev;
+static ino_t loaded_ino;
+static off_t loaded_off = 0;
+static unsigned long pass = 0;
+
+/* Local functions */
+
+static int
+open_locked(int flags, short type)
+{
+/* Open the file, creating it if flags say so, and lock it, starting over
+ * if compacting it has put a new one in place while we were waiting for
+ * the lock.
+ */
+    struct flock lock;
+    struct stat fst, pst;
+    int fd;
+
+    for (;;) {
+	if ((fd = open(ATSTATUS, flags & ~O_CREAT)) < 0) {
+	    if (errno != ENOENT || !(flags & O_CREAT)
+		|| (fd = open(ATSTATUS, flags, S_IRUSR | S_IWUSR)) < 0)
+		return -1;
+	    /* Whatever at's umask, which is set for writing jobs. */
+	    fchmod(fd, S_IRUSR | S_IWUSR);
+	}
+
+	lock.l_type = type;
+	lock.l_whence = SEEK_SET;
+	lock.l_start = 0;
+	lock.l_len = 0;
+	if (fcntl(fd, F_SETLKW, &lock) == -1
+	    || fstat(fd, &fst) == -1 || stat(ATSTATUS, &pst) == -1) {
+	    close(fd);
+	    return -1;
+	}
+	if (fst.st_dev == pst.st_dev && fst.st_ino == pst.st_ino)
+	    return fd;
+	close(fd);
+    }
+}
+
+static struct sent *
+find(unsigned long jobno, int create)
+{
+    struct sent *p;
+    unsigned int h = (unsigned int) (jobno % STATUS_HASH);
+
+    for (p = table[h]; p != NULL; p = p->next)
+	if (p->jobno == jobno)
+	    return p;
+
+    if (!create || (p = malloc(sizeof(*p))) == NULL)
+	return NULL;
+    p->jobno = jobno;
+    p->seen = 0;
+    p->next = table[h];
+    table[h] = p;
+    return p;
+}
+
+static void
+forget_all(void)
+{
+    struct sent *p, *q;
+    int h;
+
+    for (h = 0; h < STATUS_HASH; h++) {
+	for (p = table[h]; p != NULL; p = q) {
+	    q = p->next;
+	    free(p);
+	}
+	table[h] = NULL;
+    }
+}
+
+static int
+format_record(char *buf, size_t len, const struct sent *p)
+{
+    return snprintf(buf, len, "%lu %lu %d %ld\n", p->jobno,
+		    (unsigned long) p->uid, p->status, (long) p->when);
+}
+
+static void
+apply(const char *line)
+{
+    struct sent *p;
+    unsigned long jobno, uid;
+    int status;
+    long when;
+
+    if (sscanf(line, "%lu %lu %d %ld", &jobno, &uid, &status, &when) != 4
+	|| status < STATUS_EXPIRED)
+	return;
+
+    if ((p = find(jobno, 1)) == NULL)
+	return;
+    p->uid = (uid_t) uid;
+    p->status = status;
+    p->when = (time_t) when;
+}
+
+static void
+read_new(int fd)
+{
+/* Read whatever has been appended since the last call, starting over if
+ * the file has been compacted in the meantime.
+ */
+    struct stat st;
+    char *buf, *line, *nl;
+    ssize_t n;
+    size_t have, len;
+
+    if (fstat(fd, &st) == -1)
+	return;
+    if (st.st_dev != loaded_dev || st.st_ino != loaded_ino
+	|| st.st_size < loaded_off) {
+	forget_all();
+	loaded_dev = st.st_dev;
+	loaded_ino = st.st_ino;
+	loaded_off = 0;
+    }
+    if (st.st_size == loaded_off
+	|| (buf = malloc(st.st_size - loaded_off + 1)) == NULL)
+	return;
+
+    len = st.st_size - loaded_off;
+    for (have = 0; have < len; have += n) {
+	n = pread(fd, buf + have, len - have, loaded_off + have);
+	if (n == -1 && errno == EINTR) {
+	    n = 0;
+	    continue;
+	}
+	if (n <= 0)
+	    break;
+    }
+    buf[have] = '\0';
+
+    /* A line still being written is left for next time. */
+    for (line = buf; (nl = strchr(line, '\n')) != NULL; line = nl + 1) {
+	*nl = '\0';
+	apply(line);
+    }
+    loaded_off += line - buf;
+    free(buf);
+}
+
+static enum depend_state
+check_one(unsigned long jobno, int kind)
+{
+    struct sent *p;
+
+    /* A job we know nothing about may not have been recorded yet. */
+    if ((p = find(jobno, 0)) == NULL)
+	return DEPEND_WAIT;
+    p->seen = pass;
+
+    if (p->status == STATUS_PENDING)
+	return DEPEND_WAIT;
+
+    switch (kind) {
+    case DEPEND_AFTER_OK:
+	return p->status == 0 ? DEPEND_READY : DEPEND_NEVER;
+    case DEPEND_AFTER_FAIL:
+	return p->status > 0 || p->status == STATUS_LOST ? DEPEND_READY
+	    : DEPEND_NEVER;
+    default:
+	return DEPEND_READY;
+    }
+}
+
+/* Global functions */
+
+int
+depend_parse(const char *spec, struct depend_set *ds)
+{
+/* A comma separated list of job numbers, each optionally preceded by
+ * "after:", "after-ok:" or "after-fail:".  Returns -1, leaving ds alone,
+ * if spec is malformed.
+ */
+    struct depend_set set;
+    const char *p = spec, *colon;
+    char *end;
+    size_t len;
+    int kind;
+
+    set.n = 0;
+    for (;;) {
+	if (set.n == DEPEND_MAX)
+	    return -1;
+
+	kind = DEPEND_AFTER;
+	if ((colon = strchr(p, ':')) != NULL
+	    && (strchr(p, ',') == NULL || colon < strchr(p, ','))) {
+	    len = colon - p;
+	    for (kind = 0; kind <= DEPEND_AFTER_FAIL; kind++)
+		if (strlen(kind_names[kind]) == len
+		    && strncmp(kind_names[kind], p, len) == 0)
+		    break;
+	    if (kind > DEPEND_AFTER_FAIL)
+		return -1;
+	    p = colon + 1;
+	}
+
+	if (!isdigit((unsigned char) *p))
+	    return -1;
+	set.d[set.n].jobno = strtoul(p, &end, 10);
+	set.d[set.n].kind = kind;
+	set.n++;
+	p = end;
+
+	if (*p == '\0') {
+	    *ds = set;
+	    return 0;
+	}
+	if (*p != ',')
+	    return -1;
+	p++;
+    }
+}
+
+int
+depend_format(const struct depend_set *ds, char *buf, size_t len)
+{
+/* The inverse of depend_parse().  Returns -1 if buf is too short. */
+    size_t used = 0;
+    int i, n;
+
+    if (len == 0)
+	return -1;
+    buf[0] = '\0';
+
+    for (i = 0; i < ds->n; i++) {
+	n = snprintf(buf + used, len - used, "%s%s:%lu", i ? "," : "",
+		     kind_names[ds->d[i].kind], ds->d[i].jobno);
+	if (n < 0 || (size_t) n >= len - used)
+	    return -1;
+	used += n;
+    }
+    return 0;
+}
+
+void
+depend_note(unsigned long jobno, uid_t uid, int status)
+{
+/* Record how a job is doing.  A single write with O_APPEND doesn't
+ * interleave with others; the lock only keeps compaction out.
+ */
+    struct sent s;
+    char buf[RECORD_MAX];
+    int fd, len;
+
+    s.jobno = jobno;
+    s.uid = uid;
+    s.status = status;
+    s.when = time(NULL);
+    len = format_record(buf, sizeof(buf), &s);
+
+    if ((fd = open_locked(O_RDWR | O_APPEND | O_CREAT, F_RDLCK)) < 0)
+	return;
+    (void) write(fd, buf, len);
+    close(fd);
+}
+
+void
+depend_load(void)
+{
+/* Catch up with .status at the start of a pass over the spool. */
+    int fd;
+
+    pass++;
+    if ((fd = open_locked(O_RDONLY, F_RDLCK)) < 0)
+	return;
+    read_new(fd);
+    close(fd);
+}
+
+int
+depend_status(unsigned long jobno, uid_t *uid, int *status)
+{
+/* The last status recorded for a job as of depend_load(); returns 0 if
+ * there is none.
+ */
+    struct sent *p;
+
+    if ((p = find(jobno, 0)) == NULL)
+	return 0;
+    *uid = p->uid;
+    *status = p->status;
+    return 1;
+}
+
+enum depend_state
+depend_check(const struct depend_set *ds)
+{
+/* Whether a job can run yet as far as the jobs it waits for go. */
+    enum depend_state state = DEPEND_READY, s;
+    int i;
+
+    for (i = 0; i < ds->n; i++) {
+	s = check_one(ds->d[i].jobno, ds->d[i].kind);
+	if (s == DEPEND_NEVER)
+	    return s;
+	if (s == DEPEND_WAIT)
+	    state = s;
+    }
+    return state;
+}
+
+int
+depend_compact(off_t limit, time_t now)
+{
+/* Once the file has grown to limit bytes, replace it by one holding the
+ * last status of each job which is still pending, finished less than
+ * STATUS_KEEP seconds ago, or was asked about during the last pass.
+ */
+    char buf[RECORD_MAX];
+    struct stat st;
+    struct sent *p;
+    int fd, nfd, h, len, rc = 0;
+
+    if (stat(ATSTATUS, &st) == -1 || st.st_size < limit)
+	return 0;
+    if ((fd = open_locked(O_RDWR, F_WRLCK)) < 0)
+	return -1;
+    read_new(fd);
+
+    /* Closing any descriptor for the file would drop our lock, so the old
+     * one stays open until the new one is in place.
+     */
+    unlink(ATSTATUS ".new");
+    if ((nfd = open(ATSTATUS ".new", O_WRONLY | O_CREAT | O_EXCL,
+		    S_IRUSR | S_IWUSR)) < 0) {
+	close(fd);
+	return -1;
+    }
+
+    for (h = 0; h < STATUS_HASH && rc == 0; h++)
+	for (p = table[h]; p != NULL; p = p->next) {
+	    if (p->status != STATUS_PENDING && p->when + STATUS_KEEP < now
+		&& (pass == 0 || p->seen != pass))
+		continue;
+	    len = format_record(buf, sizeof(buf), p);
+	    if (write(nfd, buf, len) != len) {
+		rc = -1;
+		break;
+	    }
+	}
+
+    if (close(nfd) == -1)
+	rc = -1;
+    if (rc == 0 && rename(ATSTATUS ".new", ATSTATUS) == -1)
+	rc = -1;
+    if (rc == -1)
+	unlink(ATSTATUS ".new");
+    close(fd);
+    return rc;
+}
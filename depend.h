@@ -0,0 +1,73 @@
+/*
+ *  depend.h - jobs which wait for others to finish
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _DEPEND_H
+#define _DEPEND_H
+
+#include <sys/types.h>
+#include <stddef.h>
+#include <time.h>
+
+/* How each job ended up is appended to .status as a line
+ * "<job number> <owner> <status> <time>": at records every new job as
+ * pending, and the process looking after it records its exit status once
+ * the shell is done.  Later lines supersede earlier ones.  Compacting
+ * the file drops finished jobs after STATUS_KEEP seconds, unless a job
+ * which is still waiting refers to them.
+ */
+#define ATSTATUS ATJOB_DIR "/.status"
+#define STATUS_MAX (64 * 1024)
+#define STATUS_KEEP (7 * 24 * 60 * 60)
+
+/* Statuses other than an exit status; a job killed by a signal gets
+ * 128 plus its number, as from the shell.
+ */
+#define STATUS_PENDING (-1)	/* queued or running */
+#define STATUS_REMOVED (-2)	/* removed by atrm before it ran */
+#define STATUS_LOST (-3)	/* interrupted by a crash */
+#define STATUS_EXPIRED (-4)	/* dropped by atd as too late to start */
+
+#define DEPEND_MAX 16
+
+#define DEPEND_AFTER 0		/* once it is done, however it went */
+#define DEPEND_AFTER_OK 1	/* only if it exited with status 0 */
+#define DEPEND_AFTER_FAIL 2	/* only if it ran and failed */
+
+struct depend_set {
+    int n;
+    struct {
+	unsigned long jobno;
+	int kind;
+    } d[DEPEND_MAX];
+};
+
+enum depend_state {
+    DEPEND_WAIT,		/* something it needs hasn't finished */
+    DEPEND_READY,
+    DEPEND_NEVER		/* it can never run */
+};
+
+int depend_parse(const char *spec, struct depend_set *ds);
+int depend_format(const struct depend_set *ds, char *buf, size_t len);
+void depend_note(unsigned long jobno, uid_t uid, int status);
+void depend_load(void);
+int depend_status(unsigned long jobno, uid_t *uid, int *status);
+enum depend_state depend_check(const struct depend_set *ds);
+int depend_compact(off_t limit, time_t now);
+
+#endif
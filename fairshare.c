@@ -0,0 +1,602 @@
+/*
+ *  fairshare.c - fair share ordering of due at jobs
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/* System Headers */
+
+#include <sys/types.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Local headers */
+
+#include "array.h"
+#include "conf.h"
+#include "fairshare.h"
+#include "lease.h"
+
+/* Structures and unions */
+
+struct usage {
+    uid_t uid;
+    double used;		/* decayed count of jobs started */
+    unsigned int running;
+};
+
+struct group {
+    size_t next, end;		/* one user's jobs in one queue, best first */
+    size_t usage;		/* index into usage[] */
+};
+
+struct cands {
+    struct sched_job *job;
+    size_t n, alloc;
+    struct group *group;
+    size_t ngroup;
+    int ready;
+};
+
+struct running {
+    unsigned long jobno;
+    long task;			/* for an array job's task, else -1 */
+    uid_t uid;
+    char queue;			/* 0 if we didn't start it ourselves */
+    time_t start;
+    long est;
+    int leased;			/* its lease has turned up */
+    int seen;			/* ... during this pass */
+};
+
+struct head {
+    double key;
+    struct group *group;
+};
+
+struct reservation {
+    char queue;
+    time_t when;
+};
+
+/* File scope variables */
+
+static struct usage *usage = NULL;
+static size_t nusage = 0;
+static time_t sched_now;
+static time_t last_decay = 0;
+static struct cands cands[2];
+static struct running *running = NULL;
+static size_t nrunning = 0, running_alloc = 0;
+static unsigned int qrunning[UCHAR_MAX + 1];
+static int settled;
+static int predicting = 0;
+static time_t predict_from;
+static struct head *heads = NULL;
+static struct reservation *res = NULL;
+static size_t heads_alloc = 0;
+
+/* Local functions */
+
+static size_t
+find_usage(uid_t uid)
+{
+/* Returns nusage if we run out of memory. */
+    struct usage *u;
+    size_t i;
+
+    for (i = 0; i < nusage; i++)
+	if (usage[i].uid == uid)
+	    return i;
+
+    if ((u = realloc(usage, (nusage + 1) * sizeof(*usage))) == NULL)
+	return nusage;
+    usage = u;
+    usage[nusage].uid = uid;
+    usage[nusage].used = 0.;
+    usage[nusage].running = 0;
+    return nusage++;
+}
+
+static unsigned long
+jobno_of(const char *name)
+{
+    unsigned long jobno = 0;
+
+    sscanf(name + 1, "%5lx", &jobno);
+    return jobno;
+}
+
+static long
+task_of(const char *lease)
+{
+/* The index of the array task a lease is for, or -1 for a plain job. */
+    unsigned long task = 0;
+
+    if (lease[0] != ARRAY_LEASE)
+	return -1;
+    sscanf(lease + 6, "%8lx", &task);
+    return (long) task;
+}
+
+static struct running *
+find_running(unsigned long jobno, long task, int create)
+{
+    struct running *r;
+    size_t i, alloc;
+
+    for (i = 0; i < nrunning; i++)
+	if (running[i].jobno == jobno && running[i].task == task)
+	    return &running[i];
+
+    if (!create)
+	return NULL;
+
+    if (nrunning == running_alloc) {
+	alloc = running_alloc ? 2 * running_alloc : 64;
+	if ((r = realloc(running, alloc * sizeof(*r))) == NULL)
+	    return NULL;
+	running = r;
+	running_alloc = alloc;
+    }
+    r = &running[nrunning++];
+    r->jobno = jobno;
+    r->task = task;
+    r->queue = 0;
+    r->start = sched_now;
+    r->est = -1;
+    r->leased = 0;
+    r->seen = 0;
+    return r;
+}
+
+static time_t
+finish(const struct running *r)
+{
+/* When we expect a running job to be done, or -1 if we can't tell.  For
+ * predictions we have to guess anyway.
+ */
+    time_t when;
+
+    if (!predicting)
+	return r->est < 0 ? -1 : r->start + r->est;
+
+    when = r->start + (r->est < 0 ? SCHED_GUESS : r->est);
+    if (when <= r->start)
+	when = r->start + 1;
+    if (when <= predict_from)
+	when = predict_from + SCHED_OVERRUN;
+    return when;
+}
+
+static void
+count_running(void)
+{
+    size_t i, u;
+
+    for (i = 0; i < nusage; i++)
+	usage[i].running = 0;
+    memset(qrunning, 0, sizeof(qrunning));
+
+    for (i = 0; i < nrunning; i++) {
+	if ((u = find_usage(running[i].uid)) < nusage)
+	    usage[u].running++;
+	if (running[i].queue != 0)
+	    qrunning[(unsigned char) running[i].queue]++;
+    }
+}
+
+static void
+settle(void)
+{
+/* Once the whole spool has been seen, drop the jobs whose lease has
+ * gone.  One we handed out ourselves gets LEASE_TTL seconds for its
+ * lease to turn up.
+ */
+    size_t i, j;
+
+    if (settled)
+	return;
+    settled = 1;
+
+    for (i = j = 0; i < nrunning; i++)
+	if (running[i].seen
+	    || (!running[i].leased && running[i].start + LEASE_TTL > sched_now))
+	    running[j++] = running[i];
+    nrunning = j;
+    count_running();
+}
+
+static long
+cost(const struct sched_job *job)
+{
+    return job->est < 0 ? 0 : job->est;
+}
+
+static int
+urgent(const struct sched_job *job)
+{
+    return job->latest != 0 && job->latest - sched_now < SCHED_SLACK;
+}
+
+static int
+job_cmp(const void *a, const void *b)
+{
+/* By owner and queue; within that, urgent jobs by deadline, then the
+ * one which has waited longest for its size.
+ */
+    const struct sched_job *x = a, *y = b;
+    time_t tx, ty;
+    int c;
+
+    if (x->uid != y->uid)
+	return x->uid < y->uid ? -1 : 1;
+    if (x->queue != y->queue)
+	return x->queue < y->queue ? -1 : 1;
+    if (urgent(x) != urgent(y))
+	return urgent(x) ? -1 : 1;
+    if (urgent(x) && x->latest != y->latest)
+	return x->latest < y->latest ? -1 : 1;
+    tx = x->run_time + cost(x);
+    ty = y->run_time + cost(y);
+    if (tx != ty)
+	return tx < ty ? -1 : 1;
+    if ((c = strcmp(x->name, y->name)) != 0)
+	return c;
+    return x->task < y->task ? -1 : x->task > y->task;
+}
+
+static int
+head_cmp(const void *a, const void *b)
+{
+    const struct head *x = a, *y = b;
+
+    if (x->key != y->key)
+	return x->key < y->key ? -1 : 1;
+    return 0;
+}
+
+static void
+prepare(struct cands *c)
+{
+    struct group *g;
+    size_t i, u;
+
+    c->ready = 1;
+    c->ngroup = 0;
+    if (c->n == 0)
+	return;
+
+    qsort(c->job, c->n, sizeof(*c->job), job_cmp);
+    if ((g = realloc(c->group, c->n * sizeof(*g))) == NULL)
+	return;
+    c->group = g;
+
+    for (i = 0; i < c->n; i++) {
+	if (i > 0 && c->job[i].uid == c->job[i - 1].uid
+	    && c->job[i].queue == c->job[i - 1].queue) {
+	    c->group[c->ngroup - 1].end = i + 1;
+	    continue;
+	}
+	if ((u = find_usage(c->job[i].uid)) == nusage)
+	    return;
+	g = &c->group[c->ngroup++];
+	g->next = i;
+	g->end = i + 1;
+	g->usage = u;
+    }
+}
+
+static time_t
+user_frees(uid_t uid)
+{
+/* When the first of a user's running jobs should be done, or -1. */
+    time_t when, first = -1;
+    size_t i;
+
+    for (i = 0; i < nrunning; i++) {
+	if (running[i].uid != uid || (when = finish(&running[i])) < 0)
+	    continue;
+	if (first < 0 || when < first)
+	    first = when;
+    }
+    if (first >= 0 && first < sched_now)
+	first = sched_now;
+    return first;
+}
+
+static size_t
+remaining(const struct cands *c)
+{
+    size_t i, n = 0;
+
+    for (i = 0; i < c->ngroup; i++)
+	n += c->group[i].end - c->group[i].next;
+    return n;
+}
+
+/* Global functions */
+
+void
+sched_begin(time_t now)
+{
+/* Start collecting the jobs of a new pass over the spool. */
+    double keep = 1.;
+    size_t i, j;
+
+    if (last_decay != 0 && now > last_decay)
+	keep = exp2(-(double) (now - last_decay) / SCHED_HALF_LIFE);
+    last_decay = now;
+    sched_now = now;
+
+    for (i = j = 0; i < nusage; i++) {
+	usage[i].used *= keep;
+	usage[i].running = 0;
+	if (usage[i].used >= 0.01)
+	    usage[j++] = usage[i];
+    }
+    nusage = j;
+
+    for (i = 0; i < nrunning; i++)
+	running[i].seen = 0;
+    settled = 0;
+
+    for (i = 0; i < 2; i++) {
+	cands[i].n = 0;
+	cands[i].ready = 0;
+    }
+}
+
+void
+sched_running(const char *lease, uid_t uid)
+{
+/* Note the lease of a job which is running, for the maxrun limits. */
+    struct running *r;
+
+    if ((r = find_running(jobno_of(lease), task_of(lease), 1)) == NULL)
+	return;
+    r->uid = uid;
+    r->leased = 1;
+    r->seen = 1;
+}
+
+void
+sched_add(int batch, const struct sched_job *job)
+{
+    struct cands *c = &cands[batch != 0];
+    struct sched_job *p;
+    size_t alloc;
+
+    /* Handed out already, and not claimed yet. */
+    if (find_running(jobno_of(job->name), job->task, 0) != NULL)
+	return;
+
+    if (c->n == c->alloc) {
+	alloc = c->alloc ? 2 * c->alloc : 64;
+	if ((p = realloc(c->job, alloc * sizeof(*p))) == NULL)
+	    return;		/* it will be picked up next time */
+	c->job = p;
+	c->alloc = alloc;
+    }
+    c->job[c->n++] = *job;
+}
+
+unsigned long
+sched_tasks(unsigned long jobno)
+{
+/* How many tasks of an array job are running, or have been handed out,
+ * once the whole spool has been seen.
+ */
+    unsigned long n = 0;
+    size_t i;
+
+    settle();
+    for (i = 0; i < nrunning; i++)
+	if (running[i].jobno == jobno && running[i].task >= 0)
+	    n++;
+    return n;
+}
+
+int
+sched_next(int batch, struct sched_job *job)
+{
+/* Hand out the job which should run next, charging its owner for it.
+ * Returns 0 once there are no more jobs which may start now.
+ *
+ * The jobs are considered best first.  One which can't start because
+ * its owner is at their maxrun limit reserves a slot in its queue for
+ * when their first job should be done, and a job further down may only
+ * take a slot which isn't reserved, or one it should be done with by
+ * the time it is needed.  That way short jobs fill the gaps without
+ * holding up the ones which are waiting for their turn.
+ */
+    struct cands *c = &cands[batch != 0];
+    const struct conf_ent *uc, *qc;
+    struct sched_job *j;
+    struct running *r;
+    struct usage *u;
+    struct group *g;
+    size_t i, k, n = 0, nres = 0;
+    unsigned int qfree, taken;
+    time_t when;
+    void *p;
+
+    settle();
+    if (!c->ready)
+	prepare(c);
+
+    if (heads_alloc < c->ngroup) {
+	if ((p = realloc(heads, c->ngroup * sizeof(*heads))) == NULL)
+	    return 0;
+	heads = p;
+	if ((p = realloc(res, c->ngroup * sizeof(*res))) == NULL)
+	    return 0;
+	res = p;
+	heads_alloc = c->ngroup;
+    }
+
+    for (i = 0; i < c->ngroup; i++) {
+	g = &c->group[i];
+	if (g->next == g->end)
+	    continue;
+
+	u = &usage[g->usage];
+	j = &c->job[g->next];
+	if (urgent(j))
+	    heads[n].key = -1e9 + (double) (j->latest - sched_now);
+	else
+	    heads[n].key = (u->used + 1.)
+		/ ((double) conf_user(u->uid)->weight
+		   * conf_queue(j->queue)->weight)
+		- (double) (sched_now - j->run_time - cost(j)) / SCHED_AGE;
+	heads[n++].group = g;
+    }
+    qsort(heads, n, sizeof(*heads), head_cmp);
+
+    for (i = 0; i < n; i++) {
+	g = heads[i].group;
+	u = &usage[g->usage];
+	j = &c->job[g->next];
+	uc = conf_user(u->uid);
+	qc = conf_queue(j->queue);
+
+	if (uc->maxrun != 0 && u->running >= uc->maxrun) {
+	    if (qc->maxrun != 0 && (when = user_frees(u->uid)) >= 0) {
+		res[nres].queue = j->queue;
+		res[nres++].when = when;
+	    }
+	    continue;
+	}
+	if (qc->maxrun == 0)
+	    break;
+
+	qfree = qrunning[(unsigned char) j->queue] < qc->maxrun
+	    ? qc->maxrun - qrunning[(unsigned char) j->queue] : 0;
+	for (k = taken = 0; k < nres; k++)
+	    if (res[k].queue == j->queue
+		&& (j->est < 0 || sched_now + j->est > res[k].when))
+		taken++;
+	if (qfree > taken)
+	    break;
+    }
+    if (i == n)
+	return 0;
+
+    *job = c->job[g->next++];
+    u->used += 1.;
+    u->running++;
+    qrunning[(unsigned char) job->queue]++;
+
+    if ((r = find_running(jobno_of(job->name), job->task, 1)) != NULL) {
+	r->uid = job->uid;
+	r->queue = job->queue;
+	r->start = sched_now;
+	r->est = job->est;
+    }
+    return 1;
+}
+
+void
+sched_predict(void (*fn)(const struct sched_job *, time_t),
+	      time_t next_batch, unsigned int interval)
+{
+/* Play the rest of the pass forward, assuming jobs take as long as we
+ * expect and nothing else turns up, and tell fn when each job which is
+ * still waiting should start.  The load limit on batch jobs is not
+ * taken into account.  Everything is put back as it was afterwards.
+ */
+    struct usage *saved_usage = NULL;
+    struct running *saved_running = NULL;
+    size_t *saved_next = NULL;
+    size_t saved_nusage = nusage, saved_nrunning = nrunning;
+    unsigned int saved_qrunning[UCHAR_MAX + 1];
+    time_t saved_now = sched_now, next;
+    struct sched_job job;
+    size_t i, j, b, ngroup;
+
+    settle();
+    for (b = 0; b < 2; b++)
+	if (!cands[b].ready)
+	    prepare(&cands[b]);
+    if (remaining(&cands[0]) + remaining(&cands[1]) == 0)
+	return;
+
+    ngroup = cands[0].ngroup + cands[1].ngroup;
+    if ((saved_usage = malloc((nusage + 1) * sizeof(*usage))) == NULL
+	|| (saved_running = malloc((nrunning + 1) * sizeof(*running))) == NULL
+	|| (saved_next = malloc((ngroup + 1) * sizeof(*saved_next))) == NULL)
+	goto out;
+
+    memcpy(saved_usage, usage, nusage * sizeof(*usage));
+    memcpy(saved_running, running, nrunning * sizeof(*running));
+    memcpy(saved_qrunning, qrunning, sizeof(qrunning));
+    for (b = j = 0; b < 2; b++)
+	for (i = 0; i < cands[b].ngroup; i++)
+	    saved_next[j++] = cands[b].group[i].next;
+
+    predicting = 1;
+    predict_from = sched_now;
+
+    for (;;) {
+	while (sched_next(0, &job))
+	    fn(&job, sched_now);
+	if (next_batch <= sched_now && sched_next(1, &job)) {
+	    fn(&job, sched_now);
+	    next_batch = sched_now + interval;
+	}
+	if (remaining(&cands[0]) + remaining(&cands[1]) == 0)
+	    break;
+
+	/* Move on to the next time something changes. */
+	next = 0;
+	if (remaining(&cands[1]) > 0 && next_batch > sched_now)
+	    next = next_batch;
+	for (i = 0; i < nrunning; i++)
+	    if (next == 0 || finish(&running[i]) < next)
+		next = finish(&running[i]);
+	if (next <= sched_now || next > predict_from + SCHED_HORIZON)
+	    break;
+	sched_now = next;
+
+	for (i = j = 0; i < nrunning; i++)
+	    if (finish(&running[i]) > sched_now)
+		running[j++] = running[i];
+	nrunning = j;
+	count_running();
+    }
+
+    predicting = 0;
+    sched_now = saved_now;
+    memcpy(usage, saved_usage, saved_nusage * sizeof(*usage));
+    nusage = saved_nusage;
+    memcpy(running, saved_running, saved_nrunning * sizeof(*running));
+    nrunning = saved_nrunning;
+    memcpy(qrunning, saved_qrunning, sizeof(qrunning));
+    for (b = j = 0; b < 2; b++)
+	for (i = 0; i < cands[b].ngroup; i++)
+	    cands[b].group[i].next = saved_next[j++];
+
+out:
+    free(saved_usage);
+    free(saved_running);
+    free(saved_next);
+}
@@ -0,0 +1,71 @@
+/*
+ *  fairshare.h - fair share ordering of due at jobs
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _FAIRSHARE_H
+#define _FAIRSHARE_H
+
+#include <sys/types.h>
+#include <time.h>
+
+#include "spool.h"
+
+/* Every user's recent usage is the number of jobs started for them,
+ * halved every SCHED_HALF_LIFE seconds.  Of the jobs which are due,
+ * the next one to run is the one whose owner has the least usage for
+ * their share (user weight times queue weight); a job which has been
+ * waiting for SCHED_AGE seconds makes up for one job's worth of usage,
+ * so nobody waits forever.
+ */
+#define SCHED_HALF_LIFE 3600
+#define SCHED_AGE 600
+
+/* A job expected to take SCHED_AGE seconds counts as having waited that
+ * much less, so short jobs go first but long ones still get their turn.
+ * Predictions assume SCHED_GUESS seconds for jobs we know nothing about,
+ * and that a job running over its estimate will be done SCHED_OVERRUN
+ * seconds from now; they don't look further ahead than SCHED_HORIZON.
+ */
+#define SCHED_GUESS SCHED_AGE
+#define SCHED_OVERRUN 60
+#define SCHED_HORIZON (7 * 24 * 3600)
+
+/* Jobs which have to start within SCHED_SLACK seconds to make their
+ * deadline go before all others, earliest first.
+ */
+#define SCHED_SLACK 3600
+
+struct sched_job {
+    char name[JOBNAME_LEN + 1];
+    uid_t uid;
+    gid_t gid;
+    char queue;
+    time_t run_time;
+    long est;			/* expected runtime, -1 if unknown */
+    time_t latest;		/* latest start to make its deadline, or 0 */
+    long task;			/* index of an array job's task, or -1 */
+};
+
+void sched_begin(time_t now);
+void sched_running(const char *lease, uid_t uid);
+void sched_add(int batch, const struct sched_job *job);
+unsigned long sched_tasks(unsigned long jobno);
+int sched_next(int batch, struct sched_job *job);
+void sched_predict(void (*fn)(const struct sched_job *, time_t),
+		   time_t next_batch, unsigned int interval);
+
+#endif
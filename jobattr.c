@@ -0,0 +1,277 @@
+/*
+ *  jobattr.c - per-job attributes kept in the job file header
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/* System Headers */
+
+#include <sys/types.h>
+#include <ctype.h>
+
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+/* Local headers */
+
+#include "jobattr.h"
+
+/* Macros */
+
+#define HEADER_LINES 3		/* "#!/bin/sh", "# atrun" and "# mail" */
+
+/* Structures and unions */
+
+enum attr_type {
+    ATTR_TIME,
+    ATTR_LONG,
+    ATTR_KEY,
+    ATTR_WINDOW,
+    ATTR_DEPEND,
+    ATTR_RECUR,
+    ATTR_ARRAY
+};
+
+struct attr_key {
+    const char *name;
+    enum attr_type type;
+    size_t offset;
+};
+
+/* File scope variables */
+
+static const struct attr_key keys[] = {
+    { "after", ATTR_DEPEND, offsetof(struct job_attr, after) },
+    { "array", ATTR_ARRAY, offsetof(struct job_attr, array) },
+    { "deadline", ATTR_TIME, offsetof(struct job_attr, deadline) },
+    { "every", ATTR_RECUR, offsetof(struct job_attr, every) },
+    { "key", ATTR_KEY, offsetof(struct job_attr, key) },
+    { "maxlate", ATTR_LONG, offsetof(struct job_attr, maxlate) },
+    { "runtime", ATTR_LONG, offsetof(struct job_attr, runtime) },
+    { "spread", ATTR_LONG, offsetof(struct job_attr, spread) },
+    { "timeout", ATTR_LONG, offsetof(struct job_attr, timeout) },
+    { "window", ATTR_WINDOW, offsetof(struct job_attr, window) },
+};
+
+static const struct job_attr defaults = {
+    0,				/* deadline */
+    -1,				/* runtime */
+    0,				/* timeout */
+    0,				/* spread */
+    0,				/* maxlate */
+    "",				/* key */
+    { 0 },			/* window */
+    { 0 },			/* after */
+    { 0, 0, 0, { 0 } },		/* every */
+    { 0, 0, 0, 0, 0 }		/* array */
+};
+
+/* Local functions */
+
+static int
+set_key(struct job_attr *attr, const char *name, const char *value)
+{
+    const struct attr_key *k;
+    char *end;
+    long l;
+    size_t i;
+
+    for (i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+	k = &keys[i];
+	if (strcmp(k->name, name) != 0)
+	    continue;
+
+	if (k->type == ATTR_WINDOW)
+	    return window_parse(value,
+				(struct window_set *) ((char *) attr + k->offset));
+	if (k->type == ATTR_DEPEND)
+	    return depend_parse(value,
+				(struct depend_set *) ((char *) attr + k->offset));
+	if (k->type == ATTR_RECUR)
+	    return recur_parse(value,
+			       (struct recur *) ((char *) attr + k->offset));
+	if (k->type == ATTR_ARRAY)
+	    return array_parse(value,
+			       (struct job_array *) ((char *) attr + k->offset));
+	if (k->type == ATTR_KEY) {
+	    if (!jobattr_key_valid(value))
+		return -1;
+	    strcpy((char *) attr + k->offset, value);
+	    return 0;
+	}
+
+	l = strtol(value, &end, 10);
+	if (end == value || *end != '\0')
+	    return -1;
+
+	switch (k->type) {
+	case ATTR_TIME:
+	    *(time_t *) ((char *) attr + k->offset) = (time_t) l;
+	    break;
+	case ATTR_LONG:
+	    *(long *) ((char *) attr + k->offset) = l;
+	    break;
+	default:
+	    break;
+	}
+	return 0;
+    }
+    return -1;			/* from a newer at, perhaps */
+}
+
+/* Global functions */
+
+void
+jobattr_init(struct job_attr *attr)
+{
+    *attr = defaults;
+}
+
+int
+jobattr_write(FILE *fp, const struct job_attr *attr)
+{
+/* Write the lines for everything not at its default. */
+    const struct attr_key *k;
+    const char *p, *d;
+    char buf[JOBATTR_MAX];
+    long l;
+    size_t i;
+
+    for (i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+	k = &keys[i];
+	p = (const char *) attr + k->offset;
+	d = (const char *) &defaults + k->offset;
+
+	switch (k->type) {
+	case ATTR_TIME:
+	    if (*(const time_t *) p == *(const time_t *) d)
+		continue;
+	    l = (long) *(const time_t *) p;
+	    break;
+	case ATTR_LONG:
+	    if (*(const long *) p == *(const long *) d)
+		continue;
+	    l = *(const long *) p;
+	    break;
+	case ATTR_KEY:
+	    if (*p == '\0')
+		continue;
+	    if (fprintf(fp, "# %s %s\n", k->name, p) < 0)
+		return -1;
+	    continue;
+	case ATTR_WINDOW:
+	    if (((const struct window_set *) p)->n == 0)
+		continue;
+	    if (window_format((const struct window_set *) p, buf,
+			      sizeof(buf)) == -1
+		|| fprintf(fp, "# %s %s\n", k->name, buf) < 0)
+		return -1;
+	    continue;
+	case ATTR_DEPEND:
+	    if (((const struct depend_set *) p)->n == 0)
+		continue;
+	    if (depend_format((const struct depend_set *) p, buf,
+			      sizeof(buf)) == -1
+		|| fprintf(fp, "# %s %s\n", k->name, buf) < 0)
+		return -1;
+	    continue;
+	case ATTR_RECUR:
+	    if (((const struct recur *) p)->unit == 0)
+		continue;
+	    if (recur_format((const struct recur *) p, buf, sizeof(buf)) == -1
+		|| fprintf(fp, "# %s %s\n", k->name, buf) < 0)
+		return -1;
+	    continue;
+	case ATTR_ARRAY:
+	    if (((const struct job_array *) p)->n == 0)
+		continue;
+	    if (array_format((const struct job_array *) p, buf,
+			     sizeof(buf)) == -1
+		|| fprintf(fp, "# %s %s\n", k->name, buf) < 0)
+		return -1;
+	    continue;
+	default:
+	    continue;
+	}
+	if (fprintf(fp, "# %s %ld\n", k->name, l) < 0)
+	    return -1;
+    }
+    return 0;
+}
+
+int
+jobattr_read(int fd, struct job_attr *attr)
+{
+/* Fill in attr from the header of the job file open on fd, without
+ * moving its offset.  Keys we don't know are skipped.
+ */
+    char buf[JOBATTR_MAX + 1];
+    char *line, *nl, *value;
+    ssize_t n;
+    int lineno;
+
+    jobattr_init(attr);
+
+    while ((n = pread(fd, buf, JOBATTR_MAX, 0)) == -1 && errno == EINTR)
+	;
+    if (n == -1)
+	return -1;
+    buf[n] = '\0';
+
+    for (line = buf, lineno = 1; (nl = strchr(line, '\n')) != NULL;
+	 line = nl + 1, lineno++) {
+	if (lineno <= HEADER_LINES)
+	    continue;
+	if (line[0] != '#' || line[1] != ' ')
+	    break;
+
+	*nl = '\0';
+	if ((value = strchr(line + 2, ' ')) == NULL)
+	    continue;
+	*value++ = '\0';
+	(void) set_key(attr, line + 2, value);
+    }
+    return 0;
+}
+
+int
+jobattr_key_valid(const char *key)
+{
+/* Coalesce keys are made up of letters, digits and "-._:/@", so that
+ * they keep to one word of the header line.
+ */
+    size_t len = strlen(key);
+
+    if (len == 0 || len > JOBATTR_KEY_MAX)
+	return 0;
+    for (; *key != '\0'; key++)
+	if (!isalnum((unsigned char) *key) && strchr("-._:/@", *key) == NULL)
+	    return 0;
+    return 1;
+}
@@ -0,0 +1,58 @@
+/*
+ *  jobattr.h - per-job attributes kept in the job file header
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _JOBATTR_H
+#define _JOBATTR_H
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "array.h"
+#include "depend.h"
+#include "recur.h"
+#include "window.h"
+
+/* Anything at(1) has to tell atd about a job beyond its owner and mail
+ * settings goes into comment lines of the form "# <key> <value>" right
+ * after the "# mail" line, where the shell ignores them.  Only settings
+ * which differ from their default are written.
+ */
+#define JOBATTR_MAX 4096	/* how much of a job file the header may take */
+#define JOBATTR_SPREAD_MAX (24 * 60 * 60)	/* the most a job may start late */
+#define JOBATTR_KEY_MAX 64	/* characters in a coalesce key */
+
+struct job_attr {
+    time_t deadline;		/* must be done by then, 0 for none */
+    long runtime;		/* seconds the user expects, -1 if not given */
+    long timeout;		/* seconds before it is killed, 0 for never */
+    long spread;		/* seconds it may start late, for levelling */
+    long maxlate;		/* how late it may still start, 0 for any */
+    char key[JOBATTR_KEY_MAX + 1];	/* coalesce key, empty for none */
+    struct window_set window;	/* when it may start, empty for any time */
+    struct depend_set after;	/* jobs it waits for */
+    struct recur every;		/* how often it runs, if more than once */
+    struct job_array array;	/* the indices it runs for, if an array */
+};
+
+void jobattr_init(struct job_attr *attr);
+int jobattr_write(FILE *fp, const struct job_attr *attr);
+int jobattr_read(int fd, struct job_attr *attr);
+int jobattr_key_valid(const char *key);
+
+#endif
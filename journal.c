@@ -0,0 +1,360 @@
+/*
+ *  journal.c - write-ahead journal of at job state transitions
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/* System Headers */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#elif defined(HAVE_SYS_FCNTL_H)
+#include <sys/fcntl.h>
+#endif
+
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+/* Local headers */
+
+#include "array.h"
+#include "journal.h"
+
+/* Macros */
+
+#define JOURNAL_HASH 1024
+#define RECORD_MAX 64
+
+/* Structures and unions */
+
+struct jent {
+    struct journal_ent e;
+    unsigned long jobno;
+    long task;			/* of an array job, or -1 */
+    struct jent *next;
+};
+
+/* File scope variables */
+
+static const char *state_names[] = {
+    "queued", "planned", "claimed", "started", "finished", "mailed"
+};
+
+static struct jent *table[JOURNAL_HASH];
+
+/* Local functions */
+
+static int
+open_locked(int flags, short type)
+{
+/* Open the journal and lock it.  A checkpoint may have renamed a new
+ * journal into place while we were waiting for the lock, in which case
+ * we have to start over on the new one.
+ */
+    struct flock lock;
+    struct stat fst, pst;
+    int fd;
+
+    for (;;) {
+	if ((fd = open(ATJOURNAL, flags, S_IRUSR | S_IWUSR)) < 0)
+	    return -1;
+
+	lock.l_type = type;
+	lock.l_whence = SEEK_SET;
+	lock.l_start = 0;
+	lock.l_len = 0;
+	if (fcntl(fd, F_SETLKW, &lock) == -1
+	    || fstat(fd, &fst) == -1 || stat(ATJOURNAL, &pst) == -1) {
+	    close(fd);
+	    return -1;
+	}
+	if (fst.st_dev == pst.st_dev && fst.st_ino == pst.st_ino)
+	    return fd;
+	close(fd);
+    }
+}
+
+static int
+format_record(char *buf, size_t len, const struct journal_ent *je)
+{
+    return snprintf(buf, len, "%ld %s %s %ld\n", (long) je->when,
+		    state_names[je->state], je->name, je->pid);
+}
+
+static void
+remember(const struct journal_ent *je)
+{
+/* Later records supersede earlier ones for the same job, or for the
+ * same task of an array job, whose records go by the task's lease.
+ */
+    struct jent *p;
+    unsigned long jobno, index;
+    long task = -1;
+    unsigned int h;
+
+    if (sscanf(je->name + 1, "%5lx", &jobno) != 1)
+	return;
+    if (je->name[0] == ARRAY_LEASE) {
+	if (sscanf(je->name + 6, "%8lx", &index) != 1)
+	    return;
+	task = (long) index;
+    }
+
+    h = jobno % JOURNAL_HASH;
+    for (p = table[h]; p != NULL; p = p->next)
+	if (p->jobno == jobno && p->task == task)
+	    break;
+
+    if (p == NULL) {
+	if ((p = malloc(sizeof(*p))) == NULL)
+	    return;
+	p->jobno = jobno;
+	p->task = task;
+	p->next = table[h];
+	table[h] = p;
+    }
+    p->e = *je;
+}
+
+static void
+forget_all(void)
+{
+    struct jent *p, *q;
+    int h;
+
+    for (h = 0; h < JOURNAL_HASH; h++) {
+	for (p = table[h]; p != NULL; p = q) {
+	    q = p->next;
+	    free(p);
+	}
+	table[h] = NULL;
+    }
+}
+
+static int
+load(int fd)
+{
+/* Read the whole journal and replay it into the table.  A line cut short
+ * by a crash has no newline yet and is ignored.
+ */
+    struct journal_ent je;
+    struct stat st;
+    char *buf, *line, *nl;
+    char state[16];
+    size_t have;
+    ssize_t n;
+    int s;
+
+    if (fstat(fd, &st) == -1)
+	return -1;
+    if ((buf = malloc(st.st_size + 1)) == NULL)
+	return -1;
+
+    for (have = 0; have < (size_t) st.st_size; have += n) {
+	n = pread(fd, buf + have, st.st_size - have, have);
+	if (n == -1 && errno == EINTR) {
+	    n = 0;
+	    continue;
+	}
+	if (n <= 0)
+	    break;
+    }
+    buf[have] = '\0';
+
+    for (line = buf; (nl = strchr(line, '\n')) != NULL; line = nl + 1) {
+	long when;
+
+	*nl = '\0';
+	if (sscanf(line, "%ld %15s %14s %ld", &when, state, je.name,
+		   &je.pid) != 4 || strlen(je.name) != JOBNAME_LEN)
+	    continue;
+
+	for (s = JOURNAL_QUEUED; s <= JOURNAL_MAILED; s++)
+	    if (strcmp(state, state_names[s]) == 0)
+		break;
+	if (s > JOURNAL_MAILED)
+	    continue;
+
+	je.state = s;
+	je.when = when;
+	remember(&je);
+    }
+    free(buf);
+    return 0;
+}
+
+static int
+still_around(const struct journal_ent *je)
+{
+/* Is there anything left of this job: its spool file, in either tier,
+ * or its lease?
+ */
+    char path[sizeof(ATCOLD_DIR) + JOBNAME_LEN + 2];
+    struct stat st;
+
+    if (je->state == JOURNAL_MAILED)
+	return 0;
+
+    snprintf(path, sizeof(path), "%s/%s", ATJOB_DIR, je->name);
+    if (lstat(path, &st) == 0)
+	return 1;
+
+    path[sizeof(ATJOB_DIR)] = '=';
+    if (lstat(path, &st) == 0)
+	return 1;
+
+    snprintf(path, sizeof(path), "%s/%s", ATCOLD_DIR, je->name);
+    return lstat(path, &st) == 0;
+}
+
+/* Global functions */
+
+int
+journal_note(enum journal_state state, const char *name, pid_t pid)
+{
+/* Append one record.  Appends from at, atd and job supervisors only need
+ * to exclude checkpoints, not each other, as a single O_APPEND write is
+ * atomic.  We wait for the disk only where recovery would go wrong
+ * without the record: "started", which the spool file's removal relies
+ * on, and "finished", which tells a job that ran from one cut short.
+ * The rest reach the disk with the next record that is waited for, and
+ * recovery does without them: the spool file and the lease say as much.
+ */
+    struct journal_ent je;
+    char buf[RECORD_MAX];
+    int fd, len, rc = 0;
+
+    if (strlen(name) != JOBNAME_LEN) {
+	errno = EINVAL;
+	return -1;
+    }
+    memcpy(je.name, name, JOBNAME_LEN + 1);
+    je.state = state;
+    je.pid = (long) pid;
+    je.when = time(NULL);
+    len = format_record(buf, sizeof(buf), &je);
+
+    if ((fd = open_locked(O_RDWR | O_APPEND, F_RDLCK)) < 0)
+	return -1;
+    if (write(fd, buf, len) != len)
+	rc = -1;
+    else if ((state == JOURNAL_STARTED || state == JOURNAL_FINISHED)
+	     && fdatasync(fd) == -1)
+	rc = -1;
+    close(fd);
+    return rc;
+}
+
+int
+journal_replay(void (*fn)(const struct journal_ent *))
+{
+/* Call fn with the last recorded state of every job in the journal.
+ * Returns the number of jobs, or -1 if the journal can't be read.
+ */
+    struct jent *p;
+    int fd, h, count = 0;
+
+    if ((fd = open_locked(O_RDONLY, F_RDLCK)) < 0)
+	return -1;
+    if (load(fd) == -1) {
+	close(fd);
+	return -1;
+    }
+    close(fd);
+
+    for (h = 0; h < JOURNAL_HASH; h++)
+	for (p = table[h]; p != NULL; p = p->next) {
+	    fn(&p->e);
+	    count++;
+	}
+
+    forget_all();
+    return count;
+}
+
+int
+journal_checkpoint(off_t limit)
+{
+/* If the journal has grown to limit bytes, replace it by one holding
+ * just the last record of each job which has not finished with yet.
+ * This bounds the time a replay takes by the number of live jobs.
+ */
+    char buf[RECORD_MAX];
+    struct stat st;
+    struct jent *p;
+    int fd, nfd, h, len, rc = 0;
+
+    if ((fd = open_locked(O_RDWR | O_CREAT, F_WRLCK)) < 0)
+	return -1;
+    if (fstat(fd, &st) == -1 || st.st_size < limit) {
+	close(fd);
+	return 0;
+    }
+    if (load(fd) == -1) {
+	close(fd);
+	return -1;
+    }
+
+    /* Closing any descriptor for the journal would drop our lock, so
+     * the old one stays open until the new one is in place.
+     */
+    unlink(ATJOURNAL ".new");
+    if ((nfd = open(ATJOURNAL ".new", O_WRONLY | O_CREAT | O_EXCL,
+		    S_IRUSR | S_IWUSR)) < 0) {
+	forget_all();
+	close(fd);
+	return -1;
+    }
+
+    for (h = 0; h < JOURNAL_HASH && rc == 0; h++)
+	for (p = table[h]; p != NULL; p = p->next) {
+	    if (!still_around(&p->e))
+		continue;
+	    len = format_record(buf, sizeof(buf), &p->e);
+	    if (write(nfd, buf, len) != len) {
+		rc = -1;
+		break;
+	    }
+	}
+    forget_all();
+
+    if (rc == 0 && fsync(nfd) == -1)
+	rc = -1;
+    if (close(nfd) == -1)
+	rc = -1;
+    if (rc == 0 && rename(ATJOURNAL ".new", ATJOURNAL) == -1)
+	rc = -1;
+    if (rc == -1)
+	unlink(ATJOURNAL ".new");
+
+    close(fd);
+    return rc;
+}
@@ -0,0 +1,59 @@
+/*
+ *  journal.h - write-ahead journal of at job state transitions
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _JOURNAL_H
+#define _JOURNAL_H
+
+#include <sys/types.h>
+#include <time.h>
+
+#include "spool.h"
+
+/* Every change in a job's life is appended to the journal as a line
+ * "<time> <state> <job file name> <pid>" before it takes effect.  at
+ * records new jobs, atd the plans and claims, and the process looking after a job
+ * the rest.  A checkpoint rewrites the journal down to the last record
+ * of each job which is still around.
+ */
+#define ATJOURNAL_NAME ".journal"
+#define ATJOURNAL ATJOB_DIR "/" ATJOURNAL_NAME
+
+/* Checkpoint once the journal has grown past this many bytes. */
+#define JOURNAL_MAX (256 * 1024)
+
+enum journal_state {
+    JOURNAL_QUEUED,		/* written out by at */
+    JOURNAL_PLANNED,		/* given its start time by atd */
+    JOURNAL_CLAIMED,		/* lease taken by atd */
+    JOURNAL_STARTED,		/* committed; the spool file goes next */
+    JOURNAL_FINISHED,		/* the job's shell has exited */
+    JOURNAL_MAILED		/* output dealt with; nothing left to do */
+};
+
+struct journal_ent {
+    char name[JOBNAME_LEN + 1];
+    enum journal_state state;
+    long pid;
+    time_t when;
+};
+
+int journal_note(enum journal_state state, const char *name, pid_t pid);
+int journal_replay(void (*fn)(const struct journal_ent *));
+int journal_checkpoint(off_t limit);
+
+#endif
@@ -0,0 +1,281 @@
+/*
+ *  lease.c - leases on running at jobs
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/* System Headers */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#elif defined(HAVE_SYS_FCNTL_H)
+#include <sys/fcntl.h>
+#endif
+
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+/* Local headers */
+
+#include "lease.h"
+#include "privs.h"
+
+/* File scope variables */
+
+static int held_fd = -1;
+static char held_pid[64];
+
+/* Local functions */
+
+static unsigned long long
+start_time(pid_t pid)
+{
+/* When process pid started, in clock ticks since boot, from the 22nd
+ * field of /proc/<pid>/stat; 0 if we can't tell.  Together with the pid
+ * it names a process for good, where the pid alone may be reused.
+ */
+    char path[32], buf[512], *p;
+    unsigned long long start;
+    ssize_t len;
+    int fd, i;
+
+    snprintf(path, sizeof(path), "/proc/%ld/stat", (long) pid);
+    if ((fd = open(path, O_RDONLY)) < 0)
+	return 0;
+    len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len <= 0)
+	return 0;
+    buf[len] = '\0';
+
+    /* The command name in parentheses may hold spaces of its own. */
+    if ((p = strrchr(buf, ')')) == NULL)
+	return 0;
+    for (i = 2; i < 22; i++)
+	if ((p = strchr(p + 1, ' ')) == NULL)
+	    return 0;
+    if (sscanf(p, "%llu", &start) != 1)
+	return 0;
+    return start;
+}
+
+static pid_t
+read_lease(const char *leasename, char *queue, int *node,
+	   unsigned long long *start)
+{
+/* Parse a lease: "pid queue node start", of which older leases lack the
+ * later fields.
+ */
+    char pidbuf[64];
+    long pid;
+    char q = '\0';
+    int n = -1;
+    unsigned long long s = 0;
+    ssize_t len;
+    int fd;
+
+    if ((fd = open(leasename, O_RDONLY)) < 0)
+	return 0;
+    len = read(fd, pidbuf, sizeof(pidbuf) - 1);
+    close(fd);
+    if (len <= 0)
+	return 0;
+    pidbuf[len] = '\0';
+
+    if (sscanf(pidbuf, "%ld %c %d %llu", &pid, &q, &n, &s) < 1 || pid <= 0)
+	return 0;
+    if (queue != NULL)
+	*queue = q;
+    if (node != NULL)
+	*node = n;
+    if (start != NULL)
+	*start = s;
+    return (pid_t) pid;
+}
+
+/* Signal handlers */
+
+static RETSIGTYPE
+heartbeat(int dummy)
+{
+/* Rewriting the pid bumps the mtime.  Unlike futimens(), a write through
+ * the descriptor we already hold needs no permission on the file, which
+ * belongs to the job's owner.
+ */
+    int save_errno = errno;
+
+    if (held_fd != -1) {
+	pwrite(held_fd, held_pid, strlen(held_pid), 0);
+	alarm(LEASE_HEARTBEAT);
+    }
+    errno = save_errno;
+}
+
+/* Global functions */
+
+int
+lease_claim(const char *leasename, uid_t uid)
+{
+/* Claim a job by creating its lease.  This fails with EEXIST if somebody
+ * else holds it already.  The lease belongs to the job's owner, so that
+ * atq shows it and atrm can remove it, just like the old "=" links; it
+ * stays in our group so we can read it back without privileges.
+ */
+    gid_t gid = getegid();
+    int fd;
+
+    if ((fd = open(leasename, O_WRONLY | O_CREAT | O_EXCL,
+		   S_IRUSR | S_IWUSR)) < 0)
+	return -1;
+
+    PRIV_START
+    if (fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP) == -1
+	|| fchown(fd, uid, gid) == -1) {
+	unlink(leasename);
+	close(fd);
+	fd = -1;
+    }
+    PRIV_END
+
+    return fd;
+}
+
+void
+lease_hold(int fd, char queue, int node)
+{
+/* Called in the process which looks after the job: record our pid, the
+ * job's queue, which the lease's name has lost, the NUMA node it was
+ * placed on (-1 for none) and our start time, and keep the lease fresh
+ * until lease_drop() or exit.
+ */
+    struct sigaction act;
+
+    snprintf(held_pid, sizeof(held_pid), "%ld %c %d %llu\n",
+	     (long) getpid(), queue, node, start_time(getpid()));
+    pwrite(fd, held_pid, strlen(held_pid), 0);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    held_fd = fd;
+
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = heartbeat;
+    sigemptyset(&act.sa_mask);
+    act.sa_flags = SA_RESTART;
+    sigaction(SIGALRM, &act, NULL);
+    alarm(LEASE_HEARTBEAT);
+}
+
+void
+lease_drop(void)
+{
+/* Stop the heartbeat; a pending alarm would otherwise survive an exec(). */
+    alarm(0);
+    held_fd = -1;
+}
+
+pid_t
+lease_owner(const char *leasename)
+{
+/* The pid recorded in a lease, or 0 if there is none (yet). */
+    return lease_read(leasename, NULL, NULL);
+}
+
+pid_t
+lease_read(const char *leasename, char *queue, int *node)
+{
+/* As lease_owner(), also telling which queue the job came from and which
+ * node it was placed on, for those which aren't NULL.  Leases from before
+ * we recorded them give '\0' and -1.
+ */
+    return read_lease(leasename, queue, node, NULL);
+}
+
+int
+lease_dead(const char *leasename, pid_t pid)
+{
+/* Whether the owner of a lease is known to be gone: no process has its
+ * pid, or the one which does started at another time than the lease
+ * says, so that the pid has been reused.  pid stands in for a lease
+ * which has no owner written into it yet.
+ */
+    unsigned long long start = 0, now_start;
+    pid_t owner;
+
+    if ((owner = read_lease(leasename, NULL, NULL, &start)) == 0)
+	owner = pid;
+    if (owner == 0)
+	return 0;
+    if (kill(owner, 0) == -1 && errno == ESRCH)
+	return 1;
+    return start != 0 && (now_start = start_time(owner)) != 0
+	&& now_start != start;
+}
+
+int
+lease_stale(const char *leasename, const struct stat *st, time_t now,
+	    time_t *recheck)
+{
+/* A lease is stale once it has missed a heartbeat and the process which
+ * wrote it is gone.  Waiting for a missed beat before believing a dead
+ * owner keeps a job whose supervisor dies right away from being retried
+ * in a tight loop.  An owner is only taken to live on if its start time
+ * matches the one in the lease, so that a reused pid can't pin the
+ * lease; then the lease holds however old it looks, as the clock may
+ * have been stepped or the job may be stuck.  A lease whose owner we
+ * can't verify that way, because it has none yet, predates the start
+ * time or /proc isn't there, goes by its age: LEASE_TTL seconds without
+ * a heartbeat.  *recheck is set to when the answer may change.
+ */
+    unsigned long long start = 0, now_start = 0;
+    pid_t pid;
+
+    if ((pid = read_lease(leasename, NULL, NULL, &start)) == 0) {
+	*recheck = st->st_mtime + LEASE_TTL;
+	return *recheck <= now;
+    }
+
+    if (st->st_mtime + LEASE_HEARTBEAT > now) {
+	*recheck = st->st_mtime + LEASE_HEARTBEAT;
+	return 0;
+    }
+
+    *recheck = now + LEASE_HEARTBEAT;
+    if (kill(pid, 0) == -1 && errno == ESRCH)
+	return 1;
+    if (start != 0 && (now_start = start_time(pid)) != 0)
+	return now_start != start;
+
+    if (st->st_mtime + LEASE_TTL > now) {
+	*recheck = st->st_mtime + LEASE_TTL;
+	return 0;
+    }
+    return 1;
+}
@@ -0,0 +1,48 @@
+/*
+ *  lease.h - leases on running at jobs
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _LEASE_H
+#define _LEASE_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <time.h>
+
+/* A job is claimed by creating its "=" file exclusively.  The process
+ * looking after the job writes its pid into it and rewrites it every
+ * LEASE_HEARTBEAT seconds, along with its start time, so that a later
+ * process with the same pid isn't taken for it.  A lease which has missed
+ * a heartbeat and whose owner is gone is stale.  While the owner is there
+ * the heartbeat alone never decides it, so that a step of the clock
+ * can't make a running job look finished; only a lease whose owner can't
+ * be verified by its start time is stale after LEASE_TTL seconds without
+ * a heartbeat.
+ */
+#define LEASE_HEARTBEAT 5
+#define LEASE_TTL (3 * LEASE_HEARTBEAT)
+
+int lease_claim(const char *leasename, uid_t uid);
+void lease_hold(int fd, char queue, int node);
+void lease_drop(void);
+pid_t lease_owner(const char *leasename);
+pid_t lease_read(const char *leasename, char *queue, int *node);
+int lease_dead(const char *leasename, pid_t pid);
+int lease_stale(const char *leasename, const struct stat *st, time_t now,
+		time_t *recheck);
+
+#endif
@@ -0,0 +1,297 @@
+/*
+ *  level.c - spreading out jobs which may start late
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/* System Headers */
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Local headers */
+
+#include "jobattr.h"
+#include "level.h"
+
+/* Macros */
+
+#define RANGE_MINS (JOBATTR_SPREAD_MAX / 60 + 1)
+
+/* Structures and unions */
+
+struct load {
+    time_t start;
+    long mins;			/* how long it runs, at least one minute */
+};
+
+struct want {
+    char name[JOBNAME_LEN + 1];
+    time_t earliest;
+    time_t latest;
+    long est;
+};
+
+struct plan {
+    char name[JOBNAME_LEN + 1];
+    unsigned long jobno;
+    struct plan *next;
+};
+
+/* File scope variables */
+
+static time_t now;
+static struct load *loads;
+static size_t nloads, loads_alloc;
+static struct want *wants;
+static size_t nwants, wants_alloc, wants_done;
+static int sorted;
+static struct plan *planned[LEVEL_HASH];
+
+/* How many jobs run, and start, in each minute of the range looked at. */
+static long running[RANGE_MINS + 1];
+static long starting[RANGE_MINS];
+
+/* Local functions */
+
+static int
+grow(void **p, size_t *alloc, size_t n, size_t size)
+{
+    void *q;
+    size_t want = *alloc ? 2 * *alloc : 64;
+
+    if (n < *alloc)
+	return 0;
+    if ((q = realloc(*p, want * size)) == NULL)
+	return -1;
+    *p = q;
+    *alloc = want;
+    return 0;
+}
+
+static int
+load_cmp(const void *a, const void *b)
+{
+    const struct load *la = a, *lb = b;
+
+    return la->start < lb->start ? -1 : la->start > lb->start;
+}
+
+static int
+want_cmp(const void *a, const void *b)
+{
+/* Earliest first; among those, in the order they were submitted. */
+    const struct want *wa = a, *wb = b;
+
+    if (wa->earliest != wb->earliest)
+	return wa->earliest < wb->earliest ? -1 : 1;
+    return strcmp(wa->name + 1, wb->name + 1);
+}
+
+static size_t
+first_load(time_t from)
+{
+/* The index of the first load starting at from or later. */
+    size_t lo = 0, hi = nloads, mid;
+
+    while (lo < hi) {
+	mid = (lo + hi) / 2;
+	if (loads[mid].start < from)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    return lo;
+}
+
+static unsigned long
+jobno_of(const char *name)
+{
+    unsigned long jobno = 0;
+
+    sscanf(name + 1, "%5lx", &jobno);
+    return jobno;
+}
+
+/* Global functions */
+
+void
+level_begin(time_t t)
+{
+/* Start over for a pass through the spool.  Plans are forgotten once the
+ * range of the job they were for has surely gone by.
+ */
+    struct plan **pp, *p;
+    unsigned long ctm;
+    int h;
+
+    now = t;
+    nloads = 0;
+    nwants = 0;
+    wants_done = 0;
+    sorted = 0;
+
+    for (h = 0; h < LEVEL_HASH; h++)
+	for (pp = &planned[h]; (p = *pp) != NULL;) {
+	    if (sscanf(p->name + 6, "%8lx", &ctm) == 1
+		&& (time_t) ctm * 60 + JOBATTR_SPREAD_MAX < now) {
+		*pp = p->next;
+		free(p);
+	    }
+	    else
+		pp = &p->next;
+	}
+}
+
+void
+level_load(time_t start, long est)
+{
+/* A job expected to start at start and run for est seconds, -1 if we
+ * don't know.  Levelling is only ever a help, so if there is no memory
+ * for it, the job is left out.
+ */
+    if (grow((void **) &loads, &loads_alloc, nloads, sizeof(*loads)) == -1)
+	return;
+    loads[nloads].start = start;
+    loads[nloads].mins = est > 60 ? (est + 59) / 60 : 1;
+    if (loads[nloads].mins > RANGE_MINS)
+	loads[nloads].mins = RANGE_MINS;
+    nloads++;
+}
+
+int
+level_want(const char *name, time_t earliest, time_t latest, long est)
+{
+/* A job to be planned between earliest and latest.  Returns -1 if it
+ * can't be, in which case it had better just run when it is due.
+ */
+    struct want *w;
+
+    if (grow((void **) &wants, &wants_alloc, nwants, sizeof(*wants)) == -1)
+	return -1;
+    w = &wants[nwants++];
+    memcpy(w->name, name, sizeof(w->name));
+    w->earliest = earliest;
+    w->latest = latest;
+    w->est = est;
+    return 0;
+}
+
+int
+level_next(char *name, time_t *start)
+{
+/* Plan the next job wanting it, once the pass has seen every job; each
+ * one planned counts towards the load for the rest.  Returns 0 once
+ * there are none left.
+ */
+    struct want *w;
+    time_t from;
+    long first, last, m, best, n;
+    size_t i;
+
+    if (wants_done == nwants)
+	return 0;
+    if (!sorted) {
+	qsort(loads, nloads, sizeof(*loads), load_cmp);
+	qsort(wants, nwants, sizeof(*wants), want_cmp);
+	sorted = 1;
+    }
+    w = &wants[wants_done++];
+
+    /* What is left of its range, in whole minutes. */
+    from = w->earliest > now ? w->earliest : now;
+    first = from / 60;
+    last = w->latest / 60;
+    if (last < first)
+	last = first;
+    if (last - first >= RANGE_MINS)
+	last = first + RANGE_MINS - 1;
+    n = last - first + 1;
+
+    memset(running, 0, (n + 1) * sizeof(running[0]));
+    memset(starting, 0, n * sizeof(starting[0]));
+    for (i = first_load((first - RANGE_MINS) * 60);
+	 i < nloads && loads[i].start < (last + 1) * 60; i++) {
+	m = loads[i].start / 60;
+	if (m + loads[i].mins <= first)
+	    continue;
+	running[m > first ? m - first : 0]++;
+	if (m + loads[i].mins <= last)
+	    running[m + loads[i].mins - first]--;
+	if (m >= first)
+	    starting[m - first]++;
+    }
+
+    best = 0;
+    for (m = 1; m < n; m++) {
+	running[m] += running[m - 1];
+	if (running[m] < running[best]
+	    || (running[m] == running[best] && starting[m] < starting[best]))
+	    best = m;
+    }
+
+    *start = best == 0 ? from : (first + best) * 60;
+    memcpy(name, w->name, JOBNAME_LEN + 1);
+
+    /* Keep the loads in order with this one among them. */
+    if (grow((void **) &loads, &loads_alloc, nloads, sizeof(*loads)) == 0) {
+	i = first_load(*start + 1);
+	memmove(loads + i + 1, loads + i, (nloads - i) * sizeof(*loads));
+	loads[i].start = *start;
+	loads[i].mins = w->est > 60 ? (w->est + 59) / 60 : 1;
+	if (loads[i].mins > RANGE_MINS)
+	    loads[i].mins = RANGE_MINS;
+	nloads++;
+    }
+    return 1;
+}
+
+int
+level_planned(const char *name)
+{
+    struct plan *p;
+
+    for (p = planned[jobno_of(name) % LEVEL_HASH]; p != NULL; p = p->next)
+	if (strcmp(p->name, name) == 0)
+	    return 1;
+    return 0;
+}
+
+void
+level_mark(const char *name)
+{
+/* Note that the job under this name has been planned.  If there is no
+ * memory to note it in, it will be planned again, over what is left of
+ * its range.
+ */
+    struct plan *p;
+    unsigned long h;
+
+    if (level_planned(name))
+	return;
+    if ((p = malloc(sizeof(*p))) == NULL)
+	return;
+    memcpy(p->name, name, sizeof(p->name));
+    p->jobno = jobno_of(name);
+    h = p->jobno % LEVEL_HASH;
+    p->next = planned[h];
+    planned[h] = p;
+}
@@ -0,0 +1,43 @@
+/*
+ *  level.h - spreading out jobs which may start late
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _LEVEL_H
+#define _LEVEL_H
+
+#include <sys/types.h>
+#include <time.h>
+
+#include "spool.h"
+
+/* A job with a spread may start any time from when it is due until that
+ * many seconds later.  atd plans each one once, when it first comes
+ * across it: it goes to the minute of its range in which the fewest jobs
+ * are expected to be running, and of those the one in which the fewest
+ * start, and its spool file is renamed to say so.  Jobs whose runtime we
+ * can't guess only count in the minute they start.
+ */
+#define LEVEL_HASH 1024
+
+void level_begin(time_t now);
+void level_load(time_t start, long est);
+int level_want(const char *name, time_t earliest, time_t latest, long est);
+int level_next(char *name, time_t *start);
+int level_planned(const char *name);
+void level_mark(const char *name);
+
+#endif
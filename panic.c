@@ -92,13 +92,21 @@ usage(void)
 {
 /* Print usage and exit.
  */
-    fprintf(stderr, "Usage: at [-V] [-q x] [-f file] [-u username] [-mMlbv] timespec ...\n"
-            "       at [-V] [-q x] [-f file] [-u username] [-mMlbv] -t time\n"
+    fprintf(stderr, "Usage: at [-V] [-q x] [-f file] [-u username] [-mMlbv]\n"
+            "          [-a jobs] [-A range] [-D deadline] [-E minutes]\n"
+            "          [-K key] [-L minutes] [-R interval] [-T minutes]\n"
+            "          [-W minutes] [-w window] timespec ...\n"
+            "       at [-V] [-q x] [-f file] [-u username] [-mMlbv]\n"
+            "          [-a jobs] [-A range] [-D deadline] [-E minutes]\n"
+            "          [-K key] [-L minutes] [-R interval] [-T minutes]\n"
+            "          [-W minutes] [-w window] -t time\n"
     	    "       at -c job ...\n"
 	    "       at [-V] -l [-o timeformat] [job ...]\n"
-	    "       atq [-V] [-q x] [-o timeformat] [job ...]\n"
+	    "       atq [-V] [-q x] [-o timeformat] [-e] [job ...]\n"
 	    "       at [ -rd ] job ...\n"
 	    "       atrm [-V] job ...\n"
-	    "       batch\n");
+	    "       batch [-a jobs] [-A range] [-D deadline] [-E minutes]\n"
+	    "          [-K key] [-L minutes] [-R interval] [-T minutes]\n"
+	    "          [-W minutes] [-w window]\n");
     exit(EXIT_FAILURE);
 }
@@ -0,0 +1,295 @@
+/*
+ *  parsebench.c - how fast the time spec parsers are
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Runs every spec in a corpus through parsetime_r() or posixtime() many
+ * times over and says how many specs a second each manages, and how many
+ * allocations they make per spec.  With -m, fails if either is slower
+ * than that, so that changes to the parsers can be held to a budget.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/* System Headers */
+
+#include <sys/types.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef HAVE_GETOPT_H
+#include <getopt.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+/* Local headers */
+
+#include "panic.h"
+#include "parsetime.h"
+#include "posixtm.h"
+
+/* Macros */
+
+#define SPEC_MAX 256
+#define DEFAULT_NOW 1256832000	/* Thu Oct 29 16:00:00 2009 UTC */
+#define DEFAULT_ROUNDS 2000
+#define POSIX_BITS (PDS_LEADING_YEAR | PDS_CENTURY | PDS_SECONDS)
+
+/* Structures and unions */
+
+struct corpus {
+    char **specs;
+    size_t n;
+};
+
+struct tally {
+    unsigned long parsed;
+    unsigned long rejected;	/* in one round */
+    unsigned long allocs;
+    double secs;
+};
+
+/* File scope variables */
+
+static unsigned long allocs;
+static int counting;
+
+/* Local functions */
+
+#ifdef __GLIBC__
+/* Count the allocations made while a parser runs, wherever they come
+ * from, by standing in for the C library's allocator.
+ */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+
+void *
+malloc(size_t size)
+{
+    if (counting)
+	allocs++;
+    return __libc_malloc(size);
+}
+
+void *
+calloc(size_t n, size_t size)
+{
+    if (counting)
+	allocs++;
+    return __libc_calloc(n, size);
+}
+
+void *
+realloc(void *p, size_t size)
+{
+    if (counting)
+	allocs++;
+    return __libc_realloc(p, size);
+}
+#define COUNTS_ALLOCS 1
+#else
+#define COUNTS_ALLOCS 0
+#endif
+
+static double
+seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+read_corpus(const char *name, struct corpus *posix, struct corpus *at)
+{
+    char line[SPEC_MAX];
+    struct corpus *c;
+    FILE *fp;
+    char *p;
+
+    if ((fp = fopen(name, "r")) == NULL)
+	perr("Cannot open %.500s", name);
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+	if ((p = strchr(line, '\n')) != NULL)
+	    *p = '\0';
+	if (line[0] == '\0' || line[0] == '#')
+	    continue;
+
+	p = line;
+	c = at;
+	if (strncmp(line, "t ", 2) == 0) {
+	    p += 2;
+	    c = posix;
+	}
+	if ((c->specs = realloc(c->specs, (c->n + 1) * sizeof(char *))) == NULL
+	    || (c->specs[c->n] = strdup(p)) == NULL)
+	    panic("Virtual memory exhausted");
+	c->n++;
+    }
+    fclose(fp);
+}
+
+static void
+run_parsetime(const struct corpus *c, time_t now, long rounds,
+	      struct tally *t)
+{
+    struct parsetime_result res;
+    struct parsetime_error err;
+    double start;
+    long r;
+    size_t i;
+
+    allocs = 0;
+    counting = 1;
+    start = seconds();
+    for (r = 0; r < rounds; r++)
+	for (i = 0; i < c->n; i++)
+	    if (parsetime_r(c->specs[i], now, NULL, &res, &err) == -1
+		&& r == 0)
+		t->rejected++;
+    t->secs = seconds() - start;
+    counting = 0;
+    t->allocs = allocs;
+    t->parsed = rounds * c->n;
+}
+
+static void
+run_posixtime(const struct corpus *c, long rounds, struct tally *t)
+{
+    double start;
+    time_t when;
+    long r;
+    size_t i;
+
+    allocs = 0;
+    counting = 1;
+    start = seconds();
+    for (r = 0; r < rounds; r++)
+	for (i = 0; i < c->n; i++)
+	    if (!posixtime(&when, c->specs[i], POSIX_BITS) && r == 0)
+		t->rejected++;
+    t->secs = seconds() - start;
+    counting = 0;
+    t->allocs = allocs;
+    t->parsed = rounds * c->n;
+}
+
+static double
+report(const char *name, const struct corpus *c, const struct tally *t)
+{
+    double rate = t->secs > 0 ? t->parsed / t->secs : 0;
+
+    printf("%-12s %4lu specs, %4lu rejected: %10.0f specs/s", name,
+	   (unsigned long) c->n, t->rejected, rate);
+    if (COUNTS_ALLOCS && t->parsed > 0)
+	printf(", %.2f allocations/spec", (double) t->allocs / t->parsed);
+    printf("\n");
+    return rate;
+}
+
+/* Global functions */
+
+void
+panic(char *a)
+{
+    fprintf(stderr, "parsebench: %s\n", a);
+    exit(EXIT_FAILURE);
+}
+
+void
+perr(const char *a, ...)
+{
+    int serrno = errno;
+    va_list args;
+
+    va_start(args, a);
+    fprintf(stderr, "parsebench: ");
+    vfprintf(stderr, a, args);
+    fprintf(stderr, ": %s\n", strerror(serrno));
+    va_end(args);
+    exit(EXIT_FAILURE);
+}
+
+void
+usage(void)
+{
+    fprintf(stderr, "usage: parsebench [-m specs/s] [-n rounds] "
+	    "[-t now] corpus\n");
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char **argv)
+{
+    struct corpus posix = { NULL, 0 }, at = { NULL, 0 };
+    struct tally tp, tx;
+    time_t now = DEFAULT_NOW;
+    long rounds = DEFAULT_ROUNDS;
+    double min_rate = 0;
+    int c, slow = 0;
+
+    while ((c = getopt(argc, argv, "m:n:t:")) != EOF) {
+	switch (c) {
+	case 'm':
+	    min_rate = atof(optarg);
+	    break;
+	case 'n':
+	    if ((rounds = atol(optarg)) <= 0)
+		usage();
+	    break;
+	case 't':
+	    now = (time_t) atoll(optarg);
+	    break;
+	default:
+	    usage();
+	}
+    }
+    if (optind != argc - 1)
+	usage();
+
+    read_corpus(argv[optind], &posix, &at);
+    memset(&tp, 0, sizeof(tp));
+    memset(&tx, 0, sizeof(tx));
+
+    /* One round first, so that loading the time zone is not counted. */
+    run_parsetime(&at, now, 1, &tp);
+    memset(&tp, 0, sizeof(tp));
+
+    run_parsetime(&at, now, rounds, &tp);
+    run_posixtime(&posix, rounds, &tx);
+
+    if (at.n > 0 && report("parsetime_r", &at, &tp) < min_rate)
+	slow = 1;
+    if (posix.n > 0 && report("posixtime", &posix, &tx) < min_rate)
+	slow = 1;
+    if (slow) {
+	fprintf(stderr, "parsebench: slower than %.0f specs/s\n", min_rate);
+	return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -17,7 +17,44 @@
  *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
+#ifndef _PARSETIME_H
+#define _PARSETIME_H
+
+#include <sys/types.h>
+#include <time.h>
+
+#include "calendar.h"
+
+/* parsetime_r() keeps all its state to itself, so that it may be used
+ * from any number of threads at once, and reports problems rather than
+ * printing them.  parsetime() is what at(1) uses.
+ */
+#define PARSETIME_TOKEN_MAX 32
+
+#define PARSETIME_SYNTAX 1	/* the spec is not one we understand */
+#define PARSETIME_NOTIME 2	/* there is no such time */
+#define PARSETIME_PAST 3	/* the time has gone */
+#define PARSETIME_ZONE 4	/* the zone is not one we know */
+#define PARSETIME_NOMEM 5
+
+struct parsetime_result {
+    time_t when;
+    int is_every;		/* a calendar expression, */
+    struct calendar every;	/* which says when it comes round */
+    long spread;		/* seconds it may start after when */
+};
+
+struct parsetime_error {
+    int code;			/* 0 if there was no problem */
+    const char *message;
+    char token[PARSETIME_TOKEN_MAX];	/* the last one seen */
+};
+
+int parsetime_r(const char *spec, time_t now, const char *zone,
+		struct parsetime_result *res, struct parsetime_error *err);
+
 time_t parsetime(time_t currtime, int argc, char **argv);
+int parsetime_every(struct calendar *cal);
+long parsetime_spread(void);
 
-extern char *last_token;
-extern char **my_argv;
+#endif
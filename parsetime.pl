@@ -91,13 +91,58 @@ test("Apr 31", "Ooops...");
 test("May -1", "Ooops...");
 test("Oct 0", "Ooops...");
 
+# calendar expressions, with the two times after the first
+sub test_every {
+	my ($timespec, @expected) = @_;
+	test($timespec, join("\n", @expected));
+}
+
+test_every("every 15 minutes", "Tue Nov 17 13:00:00 2009",
+	   "Tue Nov 17 13:15:00 2009", "Tue Nov 17 13:30:00 2009");
+test_every("every 6 hours", "Tue Nov 17 18:00:00 2009",
+	   "Wed Nov 18 00:00:00 2009", "Wed Nov 18 06:00:00 2009");
+test_every("every day", "Wed Nov 18 12:47:00 2009",
+	   "Thu Nov 19 12:47:00 2009", "Fri Nov 20 12:47:00 2009");
+test_every("every weekday at 09:30", "Wed Nov 18 09:30:00 2009",
+	   "Thu Nov 19 09:30:00 2009", "Fri Nov 20 09:30:00 2009");
+test_every("every weekend at noon", "Sat Nov 21 12:00:00 2009",
+	   "Sun Nov 22 12:00:00 2009", "Sat Nov 28 12:00:00 2009");
+test_every("every mon, fri at 8am", "Fri Nov 20 08:00:00 2009",
+	   "Mon Nov 23 08:00:00 2009", "Fri Nov 27 08:00:00 2009");
+test_every("every dec 24 at 18:00", "Thu Dec 24 18:00:00 2009",
+	   "Fri Dec 24 18:00:00 2010", "Sat Dec 24 18:00:00 2011");
+test("every 7 minutes", "Ooops...");
+test("every feb 30", "Ooops...");
+
+# a range gives the start and the end
+test_every("between 02:00 and 03:00", "Wed Nov 18 02:00:00 2009",
+	   "Wed Nov 18 03:00:00 2009");
+test_every("between 23:30 and 00:30 tomorrow", "Wed Nov 18 23:30:00 2009",
+	   "Thu Nov 19 00:30:00 2009");
+test_every("between 2am and 3am dec 24", "Thu Dec 24 02:00:00 2009",
+	   "Thu Dec 24 03:00:00 2009");
+test("between 10:00 and 10:00", "Ooops...");
+
+$ENV{TZ} = "America/New_York";
+$now = 1257048000; # Sun Nov  1 00:00:00 2009 EDT, clocks go back at 2
+test_every("every day at 01:30", "Sun Nov  1 01:30:00 2009",
+	   "Mon Nov  2 01:30:00 2009", "Tue Nov  3 01:30:00 2009");
+$now = 1257052800; # Sun Nov  1 01:20:00 2009 EDT
+test_every("every 30 minutes", "Sun Nov  1 01:30:00 2009",
+	   "Sun Nov  1 01:00:00 2009", "Sun Nov  1 01:30:00 2009");
+$now = 1236488400; # Sun Mar  8 00:00:00 2009 EST, clocks go forward at 2
+test_every("every day at 02:30", "Sun Mar  8 03:00:00 2009",
+	   "Mon Mar  9 02:30:00 2009", "Tue Mar 10 02:30:00 2009");
+test_every("between 01:30 and 03:30", "Sun Mar  8 01:30:00 2009",
+	   "Sun Mar  8 03:30:00 2009");
+
 # http://bugs.debian.org/364975
-TODO: {
-local $TODO = "DST ignored when computing difference from UTC";
 $ENV{TZ} = "America/New_York";
 $now = 1146160800; # Apr 27 2006 18:00 UTC
 test("20:00 UTC", "Thu Apr 27 16:00:00 2006");
-}
+$now = 1146182400; # Apr 28 2006 00:00 UTC, still the 27th in New York
+test("23:00 UTC", "Fri Apr 28 19:00:00 2006");
+test("01:00 UTC", "Thu Apr 27 21:00:00 2006");
 
 done_testing();
 1;
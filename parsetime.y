@@ -1,11 +1,13 @@
 %{
+#include <ctype.h>
 #include <time.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <stdio.h>
 #include "panic.h"
+#include "calendar.h"
 #include "parsetime.h"
-#include "panic.h"
 
 #define YYDEBUG 1
 
@@ -14,18 +16,39 @@
     ((y) % 4 == 0 && ((y) % 100 != 0 || (y) % 400 == 0))
 #endif
 
-struct tm exectm;
-static int isgmt;
-static char *tz = NULL;
-static int yearspec;
-static int time_only;
-
-extern int yyerror(char *s);
-extern int yylex();
-
-int add_date(int number, int period);
+/* Everything one parse works on, so that any number may go on at once.
+ * Times are in the local time zone, or at a fixed offset from UTC.
+ */
+struct parse_state {
+    time_t currtime;
+    struct tm exectm;
+    struct tm currtm;
+    int local;
+    long offset;		/* seconds east of UTC, if not local */
+    int yearspec;
+    int time_only;
+    int is_every;
+    struct calendar every;
+    int is_between;
+    int from_hour, from_min;	/* the start of a range, */
+    int until_hour, until_min;	/* and its end */
+    struct parsetime_error *err;
+    char token[PARSETIME_TOKEN_MAX];	/* the last one, from the scanner */
+};
+
+int parsetime_scan_begin(void **scanner, const char *spec, char *token);
+void parsetime_scan_end(void *scanner);
+
+static time_t zone_mktime(const struct parse_state *ps, struct tm *tm);
+static void zone_time(const struct parse_state *ps, time_t t, struct tm *tm);
+static void zone_utc(struct parse_state *ps);
+static int add_date(struct parse_state *ps, int number, int period);
 %}
 
+%define api.pure full
+%parse-param { struct parse_state *ps } { void *scanner }
+%lex-param { void *scanner }
+
 %union {
 	char *	  	charval;
 	int		intval;
@@ -48,6 +71,8 @@ int add_date(int number, int period);
 %token  MINUTE HOUR DAY WEEK MONTH YEAR
 %token  JAN FEB MAR APR MAY JUN JUL AUG SEP OCT NOV DEC
 %token  UTC
+%token  EVERY AT WEEKDAY WEEKEND
+%token  BETWEEN AND
 
 %type <charval> concatenated_date
 %type <charval> hr24clock_hr_min
@@ -58,21 +83,34 @@ int add_date(int number, int period);
 %type <intval> inc_dec_number
 %type <intval> day_of_week
 
+%destructor { free($$); } <charval>
+
+%code requires {
+struct parse_state;
+}
+
+%code {
+int yylex(YYSTYPE *lvalp, void *scanner);
+static void yyerror(struct parse_state *ps, void *scanner, const char *s);
+}
+
 %start timespec
 %%
 timespec        : spec_base
 		| spec_base inc_or_dec
+		| every_spec
+		| between_spec
                 ;
 
 spec_base	: date
 		| time
 		{
-		    time_only = 1;
+		    ps->time_only = 1;
 		}
                 | time date
                 | NOW
 		{
-		    yearspec = 1;
+		    ps->yearspec = 1;
 		}
 		;
 
@@ -82,18 +120,18 @@ time		: time_base
 
 time_base	: hr24clock_hr_min
 		    {
-			exectm.tm_min = -1;
-			exectm.tm_hour = -1;
-			sscanf($1, "%2d %2d", &exectm.tm_hour,
-			    &exectm.tm_min);
+			ps->exectm.tm_min = -1;
+			ps->exectm.tm_hour = -1;
+			sscanf($1, "%2d %2d", &ps->exectm.tm_hour,
+			    &ps->exectm.tm_min);
 			free($1);
 
-			if (exectm.tm_min > 60 || exectm.tm_min < 0) {
-			    yyerror("Problem in minutes specification");
+			if (ps->exectm.tm_min > 60 || ps->exectm.tm_min < 0) {
+			    yyerror(ps, scanner, "Problem in minutes specification");
 			    YYERROR;
 			}
-			if (exectm.tm_hour > 24 || exectm.tm_hour < 0) {
-			    yyerror("Problem in hours specification");
+			if (ps->exectm.tm_hour > 24 || ps->exectm.tm_hour < 0) {
+			    yyerror(ps, scanner, "Problem in hours specification");
 			    YYERROR;
 		        }
 		    }
@@ -102,18 +140,18 @@ time_base	: hr24clock_hr_min
 		| time_hour_min am_pm
 		| NOON
 		    {
-			exectm.tm_hour = 12;
-			exectm.tm_min = 0;
+			ps->exectm.tm_hour = 12;
+			ps->exectm.tm_min = 0;
 		    }
                 | MIDNIGHT
 		    {
-			exectm.tm_hour = 0;
-			exectm.tm_min = 0;
+			ps->exectm.tm_hour = 0;
+			ps->exectm.tm_min = 0;
 		    }
 		| TEATIME
 		    {
-			exectm.tm_hour = 16;
-			exectm.tm_min = 0;
+			ps->exectm.tm_hour = 16;
+			ps->exectm.tm_min = 0;
 		    }
 		;
 
@@ -122,12 +160,12 @@ hr24clock_hr_min: INT4DIGIT
 
 time_hour	: int1_2digit
 		    {
-			sscanf($1, "%d", &exectm.tm_hour);
-			exectm.tm_min = 0;
+			sscanf($1, "%d", &ps->exectm.tm_hour);
+			ps->exectm.tm_min = 0;
 			free($1);
 
-			if (exectm.tm_hour > 24 || exectm.tm_hour < 0) {
-			    yyerror("Problem in hours specification");
+			if (ps->exectm.tm_hour > 24 || ps->exectm.tm_hour < 0) {
+			    yyerror(ps, scanner, "Problem in hours specification");
 			    YYERROR;
 		        }
 		    }
@@ -135,18 +173,18 @@ time_hour	: int1_2digit
 
 time_hour_min	: HOURMIN
 		    {
-			exectm.tm_min = -1;
-			exectm.tm_hour = -1;
-			sscanf($1, "%d %*c %d", &exectm.tm_hour,
-			    &exectm.tm_min);
+			ps->exectm.tm_min = -1;
+			ps->exectm.tm_hour = -1;
+			sscanf($1, "%d %*c %d", &ps->exectm.tm_hour,
+			    &ps->exectm.tm_min);
 			free($1);
 
-			if (exectm.tm_min > 60 || exectm.tm_min < 0) {
-			    yyerror("Problem in minutes specification");
+			if (ps->exectm.tm_min > 60 || ps->exectm.tm_min < 0) {
+			    yyerror(ps, scanner, "Problem in minutes specification");
 			    YYERROR;
 			}
-			if (exectm.tm_hour > 24 || exectm.tm_hour < 0) {
-			    yyerror("Problem in hours specification");
+			if (ps->exectm.tm_hour > 24 || ps->exectm.tm_hour < 0) {
+			    yyerror(ps, scanner, "Problem in hours specification");
 			    YYERROR;
 		        }
 		    }
@@ -154,35 +192,29 @@ time_hour_min	: HOURMIN
 
 am_pm		: AM
 		    {
-			if (exectm.tm_hour > 12) {
-			    yyerror("Hour too large for AM");
+			if (ps->exectm.tm_hour > 12) {
+			    yyerror(ps, scanner, "Hour too large for AM");
 			    YYERROR;
 			}
-			else if (exectm.tm_hour == 12) {
-			    exectm.tm_hour = 0;
+			else if (ps->exectm.tm_hour == 12) {
+			    ps->exectm.tm_hour = 0;
 			}
 		    }
 		| PM
 		    {
-			if (exectm.tm_hour > 12) {
-			    yyerror("Hour too large for PM");
+			if (ps->exectm.tm_hour > 12) {
+			    yyerror(ps, scanner, "Hour too large for PM");
 			    YYERROR;
 			}
-			else if (exectm.tm_hour < 12) {
-			    exectm.tm_hour +=12;
+			else if (ps->exectm.tm_hour < 12) {
+			    ps->exectm.tm_hour +=12;
 			}
 		    }
 		;
 
 timezone_name	: UTC
 		    {
-			isgmt = 1;
-			if (getenv("TZ")) {
-			    tz = (char *) malloc(strlen(getenv("TZ")) + 1);
-			    strcpy(tz, getenv("TZ"));
-			}
-			if (setenv("TZ", "UTC0", 1) == -1)
-			    panic("Virtual memory exhausted");
+			zone_utc(ps);
 		    }
 		;
 
@@ -191,12 +223,12 @@ date            : month_name day_number
                 | month_name day_number ',' year_number
                 | day_of_week
 		   {
-		       add_date ((6 + $1 - exectm.tm_wday) %7 + 1, DAY);
+		       add_date(ps, (6 + $1 - ps->exectm.tm_wday) %7 + 1, DAY);
 		   }
                 | TODAY
                 | TOMORROW
 		   {
-			add_date(1, DAY);
+			add_date(ps, 1, DAY);
 		   }
 		| HYPHENDATE
 		   {
@@ -204,17 +236,17 @@ date            : month_name day_number
 			int mnum = -1;
 			int dnum = -1;
 
-			yearspec = 1;
+			ps->yearspec = 1;
 			if (sscanf($1, "%d %*c %d %*c %d", &ynum, &mnum, &dnum) != 3) {
-			    yyerror("Error in hyphenated date");
+			    yyerror(ps, scanner, "Error in hyphenated date");
 			    YYERROR;
 			}
 
 			if (mnum < 1 || mnum > 12) {
-			    yyerror("Error in month number");
+			    yyerror(ps, scanner, "Error in month number");
 			    YYERROR;
 			}
-			exectm.tm_mon = mnum -1;
+			ps->exectm.tm_mon = mnum -1;
 
 			if (ynum < 70) {
 			    ynum += 100;
@@ -222,7 +254,7 @@ date            : month_name day_number
 			else if (ynum > 1900) {
 			    ynum -= 1900;
 			}
-			exectm.tm_year = ynum ;
+			ps->exectm.tm_year = ynum ;
 
 			if (   dnum < 1
 			    || ((mnum ==  1 || mnum ==  3 || mnum ==  5 ||
@@ -234,10 +266,10 @@ date            : month_name day_number
 			    || (mnum ==  2 && dnum > 28 && !__isleap(ynum+1900))
 			   )
 			{
-			    yyerror("Error in day of month");
+			    yyerror(ps, scanner, "Error in day of month");
 			    YYERROR; 
 			}
-			exectm.tm_mday = dnum;
+			ps->exectm.tm_mday = dnum;
 
 			free($1);
 		   }
@@ -247,18 +279,18 @@ date            : month_name day_number
 			int mnum = -1;
 			int dnum = -1;
 
-			yearspec = 1;
+			ps->yearspec = 1;
 
 			if (sscanf($1, "%d %*c %d %*c %d", &dnum, &mnum, &ynum) != 3) {
-			    yyerror("Error in dotted date");
+			    yyerror(ps, scanner, "Error in dotted date");
 			    YYERROR;
 			}
 
 			if (mnum < 1 || mnum > 12) {
-			    yyerror("Error in month number");
+			    yyerror(ps, scanner, "Error in month number");
 			    YYERROR;
 			}
-			exectm.tm_mon = mnum -1;
+			ps->exectm.tm_mon = mnum -1;
 
 			if (ynum < 70) {
 			    ynum += 100;
@@ -266,7 +298,7 @@ date            : month_name day_number
 			else if (ynum > 1900) {
 			    ynum -= 1900;
 			}
-			exectm.tm_year = ynum ;
+			ps->exectm.tm_year = ynum ;
 
 			if (   dnum < 1
 			    || ((mnum ==  1 || mnum ==  3 || mnum ==  5 ||
@@ -278,10 +310,10 @@ date            : month_name day_number
 			    || (mnum ==  2 && dnum > 28 && !__isleap(ynum+1900))
 			   )
 			{
-			    yyerror("Error in day of month");
+			    yyerror(ps, scanner, "Error in day of month");
 			    YYERROR; 
 			}
-			exectm.tm_mday = dnum;
+			ps->exectm.tm_mday = dnum;
 
 			free($1);
 		   }
@@ -294,7 +326,7 @@ date            : month_name day_number
 			char shallot[5];
 			char *onion;
 
-			yearspec = 1;
+			ps->yearspec = 1;
 			onion=$1;
 			memset (shallot, 0, sizeof (shallot));
 			if (strlen($1) == 5 || strlen($1) == 7) {
@@ -304,64 +336,64 @@ date            : month_name day_number
 			    strncpy (shallot,onion,2);
 			    onion+=2;
 			}
-			sscanf(shallot, "%d", &exectm.tm_mon);
+			sscanf(shallot, "%d", &ps->exectm.tm_mon);
 
-			if (exectm.tm_mon < 1 || exectm.tm_mon > 12) {
-			    yyerror("Error in month number");
+			if (ps->exectm.tm_mon < 1 || ps->exectm.tm_mon > 12) {
+			    yyerror(ps, scanner, "Error in month number");
 			    YYERROR;
 			}
-			exectm.tm_mon--;
+			ps->exectm.tm_mon--;
 
 			memset (shallot, 0, sizeof (shallot));
 			strncpy (shallot,onion,2);
-		    	sscanf(shallot, "%d", &exectm.tm_mday);
-			if (exectm.tm_mday < 0 || exectm.tm_mday > 31)
+		    	sscanf(shallot, "%d", &ps->exectm.tm_mday);
+			if (ps->exectm.tm_mday < 0 || ps->exectm.tm_mday > 31)
 			{
-			    yyerror("Error in day of month");
+			    yyerror(ps, scanner, "Error in day of month");
 			    YYERROR;
 			}
 
 			onion+=2;
 			memset (shallot, 0, sizeof (shallot));
 			strncpy (shallot,onion,4);
-			if ( sscanf(shallot, "%d", &exectm.tm_year) != 1) {
-			    yyerror("Error in year");
+			if ( sscanf(shallot, "%d", &ps->exectm.tm_year) != 1) {
+			    yyerror(ps, scanner, "Error in year");
 			    YYERROR;
 			}
-			if (exectm.tm_year < 70) {
-			    exectm.tm_year += 100;
+			if (ps->exectm.tm_year < 70) {
+			    ps->exectm.tm_year += 100;
 			}
-			else if (exectm.tm_year > 1900) {
-			    exectm.tm_year -= 1900;
+			else if (ps->exectm.tm_year > 1900) {
+			    ps->exectm.tm_year -= 1900;
 			}
 
 			free ($1);
 		    }
                 | NEXT inc_dec_period		
 		    {
-			add_date(1, $2);
+			add_date(ps, 1, $2);
 		    }
 		| NEXT day_of_week
 		    {
-			add_date ((6 + $2 - exectm.tm_wday) %7 +1, DAY);
+			add_date(ps, (6 + $2 - ps->exectm.tm_wday) %7 +1, DAY);
 		    }
                 ;
 
 concatenated_date: INT5_8DIGIT
 		;
 
-month_name	: JAN { exectm.tm_mon = 0; }
-		| FEB { exectm.tm_mon = 1; }
-		| MAR { exectm.tm_mon = 2; }
-		| APR { exectm.tm_mon = 3; }
-		| MAY { exectm.tm_mon = 4; }
-		| JUN { exectm.tm_mon = 5; }
-		| JUL { exectm.tm_mon = 6; }
-		| AUG { exectm.tm_mon = 7; }
-		| SEP { exectm.tm_mon = 8; }
-		| OCT { exectm.tm_mon = 9; }
-		| NOV { exectm.tm_mon =10; }
-		| DEC { exectm.tm_mon =11; }
+month_name	: JAN { ps->exectm.tm_mon = 0; }
+		| FEB { ps->exectm.tm_mon = 1; }
+		| MAR { ps->exectm.tm_mon = 2; }
+		| APR { ps->exectm.tm_mon = 3; }
+		| MAY { ps->exectm.tm_mon = 4; }
+		| JUN { ps->exectm.tm_mon = 5; }
+		| JUL { ps->exectm.tm_mon = 6; }
+		| AUG { ps->exectm.tm_mon = 7; }
+		| SEP { ps->exectm.tm_mon = 8; }
+		| OCT { ps->exectm.tm_mon = 9; }
+		| NOV { ps->exectm.tm_mon =10; }
+		| DEC { ps->exectm.tm_mon =11; }
 		;
 
 month_number	: int1_2digit
@@ -371,10 +403,10 @@ month_number	: int1_2digit
 			    sscanf($1, "%d", &mnum);
 
 			    if (mnum < 1 || mnum > 12) {
-				yyerror("Error in month number");
+				yyerror(ps, scanner, "Error in month number");
 				YYERROR;
 			    }
-			    exectm.tm_mon = mnum -1;
+			    ps->exectm.tm_mon = mnum -1;
 			    free($1);
 			}
 		    }
@@ -382,11 +414,11 @@ month_number	: int1_2digit
 
 day_number	: int1_2digit
                      {
-			exectm.tm_mday = -1;
-			sscanf($1, "%d", &exectm.tm_mday);
-			if (exectm.tm_mday < 1 || exectm.tm_mday > 31)
+			ps->exectm.tm_mday = -1;
+			sscanf($1, "%d", &ps->exectm.tm_mday);
+			if (ps->exectm.tm_mday < 1 || ps->exectm.tm_mday > 31)
 			{
-			    yyerror("Error in day of month");
+			    yyerror(ps, scanner, "Error in day of month");
 			    YYERROR; 
 			}
 			free($1);
@@ -395,12 +427,12 @@ day_number	: int1_2digit
 
 year_number	: int2_or_4digit
 		    { 
-			yearspec = 1;
+			ps->yearspec = 1;
 			{
 			    int ynum;
 
 			    if ( sscanf($1, "%d", &ynum) != 1) {
-				yyerror("Error in year");
+				yyerror(ps, scanner, "Error in year");
 				YYERROR;
 			    }
 			    if (ynum < 70) {
@@ -410,7 +442,7 @@ year_number	: int2_or_4digit
 				ynum -= 1900;
 			    }
 
-			    exectm.tm_year = ynum ;
+			    ps->exectm.tm_year = ynum ;
 			    free($1);
 			}
 		    }
@@ -431,20 +463,20 @@ inc_or_dec	: increment
 
 increment       : '+' inc_dec_number inc_dec_period
 		    {
-		        add_date($2, $3);
+		        add_date(ps, $2, $3);
 		    }
                 ;
 
 decrement	: '-' inc_dec_number inc_dec_period
 		    {
-			add_date(-$2, $3);
+			add_date(ps, -$2, $3);
 		    }
 		;
 
 inc_dec_number	: integer
 		    {
 			if (sscanf($1, "%d", &$$) != 1) {
-			    yyerror("Unknown increment");
+			    yyerror(ps, scanner, "Unknown increment");
 			    YYERROR;
 		        }
 		        free($1);
@@ -453,10 +485,122 @@ inc_dec_number	: integer
 
 inc_dec_period	: MINUTE { $$ = MINUTE ; }
 		| HOUR	 { $$ = HOUR   ; }
-		| DAY	 { $$ = DAY    ; time_only = 0; }
-		| WEEK   { $$ = WEEK   ; time_only = 0; }
-		| MONTH  { $$ = MONTH  ; time_only = 0; }
-		| YEAR   { $$ = YEAR   ; time_only = 0; }
+		| DAY	 { $$ = DAY    ; ps->time_only = 0; }
+		| WEEK   { $$ = WEEK   ; ps->time_only = 0; }
+		| MONTH  { $$ = MONTH  ; ps->time_only = 0; }
+		| YEAR   { $$ = YEAR   ; ps->time_only = 0; }
+		;
+
+every_spec	: EVERY every_interval
+		    {
+			ps->is_every = 1;
+		    }
+		| EVERY every_days
+		    {
+			ps->is_every = 1;
+			ps->every.hours = 1UL << ps->exectm.tm_hour;
+			ps->every.minutes = 1ULL << ps->exectm.tm_min;
+		    }
+		| EVERY every_days AT time_base
+		    {
+			if (ps->exectm.tm_hour == 24 || ps->exectm.tm_min == 60) {
+			    yyerror(ps, scanner, "Problem in time of day");
+			    YYERROR;
+			}
+			ps->is_every = 1;
+			ps->every.hours = 1UL << ps->exectm.tm_hour;
+			ps->every.minutes = 1ULL << ps->exectm.tm_min;
+		    }
+		;
+
+every_interval	: MINUTE
+		| HOUR
+		    {
+			ps->every.minutes = 1;
+		    }
+		| inc_dec_number MINUTE
+		    {
+			int i;
+
+			if ($1 <= 0 || 60 % $1 != 0) {
+			    yyerror(ps, scanner, "Interval must divide an hour");
+			    YYERROR;
+			}
+			ps->every.minutes = 0;
+			for (i = 0; i < 60; i += $1)
+			    ps->every.minutes |= 1ULL << i;
+		    }
+		| inc_dec_number HOUR
+		    {
+			int i;
+
+			if ($1 <= 0 || 24 % $1 != 0) {
+			    yyerror(ps, scanner, "Interval must divide a day");
+			    YYERROR;
+			}
+			ps->every.minutes = 1;
+			ps->every.hours = 0;
+			for (i = 0; i < 24; i += $1)
+			    ps->every.hours |= 1UL << i;
+		    }
+		;
+
+every_days	: DAY
+		| WEEKDAY
+		    {
+			ps->every.wdays = 0x3e;
+		    }
+		| WEEKEND
+		    {
+			ps->every.wdays = 0x41;
+		    }
+		| day_list
+		| MONTH
+		    {
+			ps->every.mdays = 1UL << ps->exectm.tm_mday;
+		    }
+		| month_name day_number
+		    {
+			ps->every.months = 1 << ps->exectm.tm_mon;
+			ps->every.mdays = 1UL << ps->exectm.tm_mday;
+		    }
+		;
+
+day_list	: day_of_week
+		    {
+			ps->every.wdays = 1 << $1;
+		    }
+		| day_list ',' day_of_week
+		    {
+			ps->every.wdays |= 1 << $3;
+		    }
+		;
+
+between_spec	: BETWEEN time_base AND
+		    {
+			ps->from_hour = ps->exectm.tm_hour;
+			ps->from_min = ps->exectm.tm_min;
+		    }
+		  time_base between_date
+		    {
+			ps->until_hour = ps->exectm.tm_hour;
+			ps->until_min = ps->exectm.tm_min;
+			if (ps->until_hour * 60 + ps->until_min
+			    == ps->from_hour * 60 + ps->from_min) {
+			    yyerror(ps, scanner, "Empty time range");
+			    YYERROR;
+			}
+			ps->exectm.tm_hour = ps->from_hour;
+			ps->exectm.tm_min = ps->from_min;
+			ps->is_between = 1;
+		    }
+		;
+
+between_date	: /* empty */
+		    {
+			ps->time_only = 1;
+		    }
+		| date
 		;
 
 int1_2digit	: INT1DIGIT
@@ -476,60 +620,274 @@ integer		: INT
 
 %%
 
+static int
+fail(struct parsetime_error *err, int code, const char *message)
+{
+    err->code = code;
+    err->message = message;
+    return -1;
+}
 
-time_t parsetime(time_t, int, char **);
+static int
+zone_set(struct parse_state *ps, const char *zone)
+{
+/* NULL or "" for the local time zone, or UTC, GMT or Z, perhaps
+ * followed by an offset east of it such as +02 or -05:30.
+ */
+    const char *p = zone;
+    int sign, hours = 0, mins = 0;
+
+    ps->local = 0;
+    ps->offset = 0;
+    if (zone == NULL || *zone == '\0') {
+	ps->local = 1;
+	return 0;
+    }
 
-time_t
-parsetime(time_t currtime, int argc, char **argv)
+    if (strncasecmp(p, "UTC", 3) == 0 || strncasecmp(p, "GMT", 3) == 0)
+	p += 3;
+    else if (*p == 'Z' || *p == 'z')
+	p++;
+    if (*p == '\0')
+	return 0;
+
+    if (*p != '+' && *p != '-')
+	return -1;
+    sign = *p++ == '-' ? -1 : 1;
+    if (!isdigit((unsigned char) p[0]) || !isdigit((unsigned char) p[1]))
+	return -1;
+    hours = (p[0] - '0') * 10 + p[1] - '0';
+    p += 2;
+    if (*p == ':')
+	p++;
+    if (*p != '\0') {
+	if (!isdigit((unsigned char) p[0]) || !isdigit((unsigned char) p[1])
+	    || p[2] != '\0')
+	    return -1;
+	mins = (p[0] - '0') * 10 + p[1] - '0';
+    }
+    if (hours > 23 || mins > 59)
+	return -1;
+
+    ps->offset = sign * (hours * 3600L + mins * 60L);
+    return 0;
+}
+
+static long
+days_from_civil(long year, int mon, int mday)
 {
-    time_t exectime;
-    struct tm currtm;
+/* Days from 1970-01-01 to a date in the Gregorian calendar, mon being
+ * 1 to 12.
+ */
+    long era, yoe, doy, doe;
+
+    year -= mon <= 2;
+    era = (year >= 0 ? year : year - 399) / 400;
+    yoe = year - era * 400;
+    doy = (153 * (mon + (mon > 2 ? -3 : 9)) + 2) / 5 + mday - 1;
+    doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
 
-    my_argv = argv;
-    exectm = *localtime(&currtime);
-    currtime -= exectm.tm_sec;
-    exectm.tm_sec = 0;
-    exectm.tm_isdst = -1;
-    memcpy(&currtm,&exectm,sizeof(currtm));
-    time_only = 0;
-    yearspec = 0;
-
-    if (yyparse() == 0) {
-	if (time_only)
-	{
-	    if (exectm.tm_mday == currtm.tm_mday &&
-		(exectm.tm_hour < currtm.tm_hour ||
-		(exectm.tm_hour == currtm.tm_hour &&
-		    exectm.tm_min <= currtm.tm_min)))
-		exectm.tm_mday++;
-	} 
-	else if (!yearspec) {
-	    if (exectm.tm_year == currtm.tm_year &&
-		(exectm.tm_mon < currtm.tm_mon ||
-	        (exectm.tm_mon == currtm.tm_mon &&
-		     exectm.tm_mday < currtm.tm_mday)))
-		exectm.tm_year++;
-	}
+static time_t
+zone_mktime(const struct parse_state *ps, struct tm *tm)
+{
+/* mktime() for the zone of the parse; tm is normalized as it does. */
+    long year, mon;
+    time_t t;
+
+    if (ps->local)
+	return mktime(tm);
+
+    year = tm->tm_year + 1900L + tm->tm_mon / 12;
+    mon = tm->tm_mon % 12;
+    if (mon < 0) {
+	mon += 12;
+	year--;
+    }
+    t = (time_t) days_from_civil(year, mon + 1, 1) * 24 * 3600
+	+ (tm->tm_mday - 1) * 24 * 3600L + tm->tm_hour * 3600L
+	+ tm->tm_min * 60L + tm->tm_sec;
+    gmtime_r(&t, tm);
+    return t - ps->offset;
+}
 
-	exectime = mktime(&exectm);
-	if (exectime == (time_t)-1)
-	    return 0;
-	if (isgmt) {
-	    if (tz) {
-		if (setenv("TZ", tz, 1) == -1)
-		    panic("Virtual memory exhausted");
-		free(tz);
-	    }
-	    else
-		unsetenv("TZ");
-	}
-	if (exectime < currtime)
-		panic("refusing to create job destined in the past");
-        return exectime;
+static void
+zone_time(const struct parse_state *ps, time_t t, struct tm *tm)
+{
+/* localtime_r() for the zone of the parse. */
+    if (ps->local) {
+	localtime_r(&t, tm);
+	return;
     }
-    else {
-	return 0;    
+    t += ps->offset;
+    gmtime_r(&t, tm);
+}
+
+static void
+zone_utc(struct parse_state *ps)
+{
+/* The time given is in UTC, and so is the date which goes with it
+ * unless one follows.
+ */
+    struct tm tm;
+
+    ps->local = 0;
+    ps->offset = 0;
+    zone_time(ps, ps->currtime, &tm);
+    ps->exectm.tm_year = tm.tm_year;
+    ps->exectm.tm_mon = tm.tm_mon;
+    ps->exectm.tm_mday = tm.tm_mday;
+    ps->exectm.tm_wday = tm.tm_wday;
+    ps->currtm = tm;
+}
+
+int
+parsetime_r(const char *spec, time_t now, const char *zone,
+	    struct parsetime_result *res, struct parsetime_error *err)
+{
+/* Parse spec as if it were now in zone.  Returns 0 and fills in res,
+ * or returns -1 and says what is wrong in err.  Nothing is shared with
+ * other parses or changed for the rest of the process.
+ */
+    struct parse_state ps;
+    struct tm endtm;
+    void *scanner;
+    time_t exectime, endtime;
+    int ret;
+
+    memset(err, 0, sizeof(*err));
+    memset(&ps, 0, sizeof(ps));
+    ps.err = err;
+    if (zone_set(&ps, zone) == -1)
+	return fail(err, PARSETIME_ZONE, "Unknown time zone");
+
+    zone_time(&ps, now, &ps.exectm);
+    now -= ps.exectm.tm_sec;
+    ps.currtime = now;
+    ps.exectm.tm_sec = 0;
+    ps.exectm.tm_isdst = -1;
+    ps.currtm = ps.exectm;
+    calendar_every(&ps.every);
+
+    if (parsetime_scan_begin(&scanner, spec, ps.token) == -1)
+	return fail(err, PARSETIME_NOMEM, "Virtual memory exhausted");
+    ret = yyparse(&ps, scanner);
+    parsetime_scan_end(scanner);
+    if (err->code != 0)
+	return -1;
+    if (ret != 0)		/* the scanner could not copy a token */
+	return fail(err, PARSETIME_NOMEM, "Virtual memory exhausted");
+
+    memset(res, 0, sizeof(*res));
+    if (ps.is_every) {
+	if (!ps.local)
+	    return fail(err, PARSETIME_ZONE,
+			"Calendar expressions go by local time");
+	if ((res->when = calendar_next(&ps.every, now)) == 0)
+	    return fail(err, PARSETIME_NOTIME, "No such time");
+	res->is_every = 1;
+	res->every = ps.every;
+	return 0;
     }
+
+    if (ps.time_only)
+    {
+	if (ps.exectm.tm_mday == ps.currtm.tm_mday &&
+	    (ps.exectm.tm_hour < ps.currtm.tm_hour ||
+	    (ps.exectm.tm_hour == ps.currtm.tm_hour &&
+		ps.exectm.tm_min <= ps.currtm.tm_min)))
+	    ps.exectm.tm_mday++;
+    } 
+    else if (!ps.yearspec) {
+	if (ps.exectm.tm_year == ps.currtm.tm_year &&
+	    (ps.exectm.tm_mon < ps.currtm.tm_mon ||
+	    (ps.exectm.tm_mon == ps.currtm.tm_mon &&
+		 ps.exectm.tm_mday < ps.currtm.tm_mday)))
+	    ps.exectm.tm_year++;
+    }
+
+    exectime = zone_mktime(&ps, &ps.exectm);
+    if (exectime == (time_t)-1)
+	return fail(err, PARSETIME_NOTIME, "No such time");
+    if (exectime < now)
+	return fail(err, PARSETIME_PAST,
+		    "refusing to create job destined in the past");
+    res->when = exectime;
+
+    /* A range ends the first time its end comes round after its start. */
+    if (ps.is_between) {
+	endtm = ps.exectm;
+	endtm.tm_hour = ps.until_hour;
+	endtm.tm_min = ps.until_min;
+	if (ps.until_hour * 60 + ps.until_min < ps.from_hour * 60 + ps.from_min)
+	    endtm.tm_mday++;
+	endtm.tm_isdst = -1;
+	if ((endtime = zone_mktime(&ps, &endtm)) == (time_t)-1
+	    || endtime <= exectime)
+	    return fail(err, PARSETIME_NOTIME, "No such time");
+	res->spread = endtime - exectime;
+    }
+    return 0;
+}
+
+/* What at(1) itself uses, one parse at a time. */
+
+static struct parsetime_result last;
+
+time_t
+parsetime(time_t currtime, int argc, char **argv)
+{
+/* Parse the words of argv as one time spec, reporting any problem on
+ * stderr.  Returns 0 if there is one.
+ */
+    struct parsetime_error err;
+    char *spec;
+    size_t len = 1;
+    int i;
+
+    for (i = 0; i < argc && argv[i] != NULL; i++)
+	len += strlen(argv[i]) + 1;
+    if ((spec = malloc(len)) == NULL)
+	panic("Virtual memory exhausted");
+    spec[0] = '\0';
+    for (i = 0; i < argc && argv[i] != NULL; i++) {
+	strcat(spec, argv[i]);
+	strcat(spec, " ");
+    }
+
+    i = parsetime_r(spec, currtime, NULL, &last, &err);
+    free(spec);
+    if (i == 0)
+	return last.when;
+
+    memset(&last, 0, sizeof(last));
+    if (err.code == PARSETIME_PAST)
+	panic((char *) err.message);
+    if (err.code == PARSETIME_SYNTAX)
+	fprintf(stderr, "%s. Last token seen: %s\n", err.message, err.token);
+    return 0;
+}
+
+int
+parsetime_every(struct calendar *cal)
+{
+/* Whether the last time parsed was a calendar expression, and if so,
+ * which.  parsetime() has returned the first time it fires.
+ */
+    if (!last.is_every)
+	return 0;
+    *cal = last.every;
+    return 1;
+}
+
+long
+parsetime_spread(void)
+{
+/* How much later than the time parsetime() returned the job may start,
+ * going by a range such as "between 02:00 and 03:00", or 0.
+ */
+    return last.spread;
 }
 
 #ifdef TEST_PARSER
@@ -540,6 +898,9 @@ main(int argc, char **argv)
     int retval = 1;
     time_t res;
     time_t currtime;
+    struct calendar cal;
+    struct calendar_iter it;
+    int i;
 
     if (argc < 3) {
 	fprintf(stderr, "usage: parsetest [now] [timespec] ...\n");
@@ -551,6 +912,19 @@ main(int argc, char **argv)
     if (res > 0) {
 	printf("%s",ctime(&res));
 	retval = 0;
+
+	/* and the end of a range */
+	if (parsetime_spread() > 0) {
+	    res += parsetime_spread();
+	    printf("%s",ctime(&res));
+	}
+
+	/* and the two times after that for a calendar expression */
+	if (parsetime_every(&cal)) {
+	    calendar_start(&it, &cal, res);
+	    for (i = 0; i < 2 && (res = calendar_step(&it)) != 0; i++)
+		printf("%s",ctime(&res));
+	}
     }
     else {
 	printf("Ooops...\n");
@@ -567,31 +941,34 @@ panic(char *a)
 }
 #endif
 
-int yyerror(char *s)
+static void
+yyerror(struct parse_state *ps, void *scanner, const char *s)
 {
-    if (last_token == NULL)
-	last_token = "(empty)";
-    fprintf(stderr,"%s. Last token seen: %s\n",s, last_token);
-    return 0;
+/* Only the first problem is kept. */
+    if (ps->err->code != 0)
+	return;
+    ps->err->code = PARSETIME_SYNTAX;
+    ps->err->message = s;
+    strcpy(ps->err->token, ps->token[0] != '\0' ? ps->token : "(empty)");
 }
 
-void
-add_seconds(struct tm *tm, long numsec)
+static void
+add_seconds(const struct parse_state *ps, struct tm *tm, long numsec)
 {
     struct tm basetm = *tm;
     time_t timeval;
 
-    timeval = mktime(tm);
+    timeval = zone_mktime(ps, tm);
     if (timeval == (time_t)-1)
         timeval = (time_t)0;
     timeval += numsec;
-    *tm = *localtime(&timeval);
+    zone_time(ps, timeval, tm);
 
     /*
      * Adjust +-1 hour when moving in or out of DST
      */
 
-    if (daylight > 0)	/* Only check if DST is used here */
+    if (ps->local && daylight > 0)	/* Only check if DST is used here */
     {
 	/* Set tm_isdst on &basetm and tm */
 	(void) mktime(&basetm);
@@ -600,50 +977,50 @@ add_seconds(struct tm *tm, long numsec)
 	if      (basetm.tm_isdst > 0 && tm->tm_isdst < 1)
 	{   /* DST to no DST */
 	    timeval += 3600l;
-	    *tm = *localtime(&timeval);
+	    localtime_r(&timeval, tm);
 	}
 	else if (basetm.tm_isdst < 1 && tm->tm_isdst > 0)
 	{   /* no DST to DST */
 	    timeval -= 3600l;
-	    *tm = *localtime(&timeval);
+	    localtime_r(&timeval, tm);
 	}
     }
 }
 
-int
-add_date(int number, int period)
+static int
+add_date(struct parse_state *ps, int number, int period)
 {
     switch(period) {
     case MINUTE:
-	add_seconds(&exectm , 60l*number);
+	add_seconds(ps, &ps->exectm , 60l*number);
 	break;
 
     case HOUR:
-	add_seconds(&exectm, 3600l * number);
+	add_seconds(ps, &ps->exectm, 3600l * number);
 	break;
 
     case DAY:
-	add_seconds(&exectm, 24*3600l * number);
+	add_seconds(ps, &ps->exectm, 24*3600l * number);
 	break;
 
     case WEEK:
-	add_seconds(&exectm, 7*24*3600l*number);
+	add_seconds(ps, &ps->exectm, 7*24*3600l*number);
 	break;
 
     case MONTH:
 	{
-	    int newmonth = exectm.tm_mon + number;
+	    int newmonth = ps->exectm.tm_mon + number;
 	    number = 0;
 	    while (newmonth < 0) {
 		newmonth += 12;
 		number --;
 	    }
-	    exectm.tm_mon = newmonth % 12;
+	    ps->exectm.tm_mon = newmonth % 12;
 	    number += newmonth / 12 ;
 
 	    /* Recalculate tm_isdst so we don't get a +-1 hour creep */
-	    exectm.tm_isdst = -1;
-	    (void) mktime(&exectm);
+	    ps->exectm.tm_isdst = -1;
+	    (void) zone_mktime(ps, &ps->exectm);
 	}
 	if (number == 0) {
 	    break;
@@ -651,16 +1028,15 @@ add_date(int number, int period)
 	/* fall through */
 
     case YEAR:
-	exectm.tm_year += number;
+	ps->exectm.tm_year += number;
 	/* Recalculate tm_isdst so we don't get a +-1 hour creep */
-	exectm.tm_isdst = -1;
-	(void) mktime(&exectm);
+	ps->exectm.tm_isdst = -1;
+	(void) zone_mktime(ps, &ps->exectm);
 	break;
 
     default:
-	yyerror("Internal parser error");
-	fprintf(stderr,"Unexpected case %d\n", period);
-	abort();
+	yyerror(ps, NULL, "Internal parser error");
+	return -1;
     }
 
     return 0;
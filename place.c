@@ -0,0 +1,270 @@
+/*
+ *  place.c - CPU affinity and NUMA memory placement for jobs
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/* System Headers */
+
+#include <sys/types.h>
+#include <ctype.h>
+
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+
+#include <limits.h>
+
+#ifdef HAVE_SCHED_SETAFFINITY
+#include <sched.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_SYS_SYSCALL_H
+#include <sys/syscall.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+/* Local headers */
+
+#include "place.h"
+
+/* Macros */
+
+#define NODE_DIR "/sys/devices/system/node"
+
+#define PLACE_BITS 1024		/* CPUs or nodes in a list */
+#define LONG_BITS (CHAR_BIT * sizeof(unsigned long))
+#define MASK_LONGS (PLACE_BITS / (CHAR_BIT * sizeof(unsigned long)))
+
+#define MASK_SET(m, i) ((m)[(i) / LONG_BITS] |= 1UL << (i) % LONG_BITS)
+#define MASK_ISSET(m, i) (((m)[(i) / LONG_BITS] >> (i) % LONG_BITS) & 1)
+
+/* File scope variables */
+
+static int nnodes = 0;
+static unsigned long usable[MASK_LONGS];
+
+/* Local functions */
+
+static int
+parse_list(const char *list, unsigned long *mask)
+{
+/* A list such as "0-3,8" as the kernel writes them, into a bitmask of
+ * PLACE_BITS.  Returns -1 if it is malformed or out of range.
+ */
+    const char *p = list;
+    unsigned long first, last, i;
+    char *end;
+
+    memset(mask, 0, MASK_LONGS * sizeof(unsigned long));
+    while (*p != '\0' && *p != '\n') {
+	if (!isdigit((unsigned char) *p))
+	    return -1;
+	first = last = strtoul(p, &end, 10);
+	p = end;
+	if (*p == '-') {
+	    p++;
+	    if (!isdigit((unsigned char) *p))
+		return -1;
+	    last = strtoul(p, &end, 10);
+	    p = end;
+	}
+	if (first > last || last >= PLACE_BITS)
+	    return -1;
+	for (i = first; i <= last; i++)
+	    MASK_SET(mask, i);
+
+	if (*p == ',')
+	    p++;
+	else if (*p != '\0' && *p != '\n')
+	    return -1;
+    }
+    return 0;
+}
+
+static int
+read_list(const char *path, unsigned long *mask)
+{
+    char buf[4096];
+    FILE *fp;
+    int rc = -1;
+
+    if ((fp = fopen(path, "r")) == NULL)
+	return -1;
+    if (fgets(buf, sizeof(buf), fp) != NULL)
+	rc = parse_list(buf, mask);
+    fclose(fp);
+    return rc;
+}
+
+static int
+node_cpus(int node, unsigned long *mask)
+{
+    char path[64];
+
+    snprintf(path, sizeof(path), NODE_DIR "/node%d/cpulist", node);
+    return read_list(path, mask);
+}
+
+static int
+mask_empty(const unsigned long *mask)
+{
+    size_t i;
+
+    for (i = 0; i < MASK_LONGS; i++)
+	if (mask[i] != 0)
+	    return 0;
+    return 1;
+}
+
+static int
+set_affinity(const unsigned long *mask)
+{
+#if defined(HAVE_SCHED_SETAFFINITY) && defined(CPU_SET)
+    cpu_set_t set;
+    int i;
+
+    CPU_ZERO(&set);
+    for (i = 0; i < PLACE_BITS && i < CPU_SETSIZE; i++)
+	if (MASK_ISSET(mask, i))
+	    CPU_SET(i, &set);
+    return sched_setaffinity(0, sizeof(set), &set);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static int
+set_mempolicy(unsigned int mode, const unsigned long *mask)
+{
+#ifdef SYS_set_mempolicy
+    /* The kernel takes one more than the number of bits in the mask. */
+    return syscall(SYS_set_mempolicy, (int) mode, mask,
+		   (unsigned long) PLACE_BITS + 1);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/* Global functions */
+
+int
+place_list_valid(const char *list)
+{
+    unsigned long mask[MASK_LONGS];
+
+    return strlen(list) < PLACE_LIST_MAX && parse_list(list, mask) == 0;
+}
+
+int
+place_nodes(void)
+{
+/* One more than the highest online node we would spread jobs over, or 1
+ * without NUMA.  Looked up once; nodes rarely come and go.
+ */
+    unsigned long online[MASK_LONGS], cpus[MASK_LONGS];
+    int i;
+
+    if (nnodes > 0)
+	return nnodes;
+
+    nnodes = 1;
+    memset(usable, 0, sizeof(usable));
+    if (read_list(NODE_DIR "/online", online) == -1)
+	return nnodes;
+
+    for (i = 0; i < PLACE_NODES_MAX; i++)
+	if (MASK_ISSET(online, i) && node_cpus(i, cpus) == 0
+	    && !mask_empty(cpus)) {
+	    MASK_SET(usable, i);
+	    nnodes = i + 1;
+	}
+    return nnodes;
+}
+
+int
+place_node_usable(int node)
+{
+/* Nodes with only memory are no use for running jobs. */
+    if (node < 0 || node >= place_nodes())
+	return 0;
+    return MASK_ISSET(usable, node);
+}
+
+int
+place_apply(const struct job_place *place, int node)
+{
+/* Called in the job's process before it execs the shell.  A node other
+ * than -1 is the one picked for the job when spreading: it runs on that
+ * node's CPUs, as far as the CPU list allows, and prefers its memory.
+ * Returns -1 if anything failed.
+ */
+    unsigned long cpus[MASK_LONGS], mask[MASK_LONGS];
+    unsigned int mode = place->mempolicy;
+    int have_cpus = 0, rc = 0;
+    size_t i;
+
+    if (place->cpus[0] != '\0' && parse_list(place->cpus, cpus) == 0)
+	have_cpus = 1;
+
+    if (node >= 0 && node_cpus(node, mask) == 0) {
+	if (have_cpus) {
+	    for (i = 0; i < MASK_LONGS; i++)
+		mask[i] &= cpus[i];
+	    if (mask_empty(mask))
+		memcpy(mask, cpus, sizeof(mask));
+	}
+	memcpy(cpus, mask, sizeof(cpus));
+	have_cpus = 1;
+    }
+    if (have_cpus && set_affinity(cpus) == -1)
+	rc = -1;
+
+    memset(mask, 0, sizeof(mask));
+    if (node >= 0) {
+	MASK_SET(mask, node);
+	if (mode == 0)
+	    mode = PLACE_MEM_PREFERRED;
+    }
+    else if (place->nodes[0] != '\0') {
+	if (parse_list(place->nodes, mask) == -1)
+	    return -1;
+	if (mode == 0)
+	    mode = PLACE_MEM_BIND;
+    }
+    if (mode == PLACE_MEM_PREFERRED && !mask_empty(mask)) {
+	/* Only the first node counts for a preferred policy. */
+	for (i = 0; !MASK_ISSET(mask, i); i++)
+	    ;
+	memset(mask, 0, sizeof(mask));
+	MASK_SET(mask, i);
+    }
+    if (mode != 0 && !mask_empty(mask) && set_mempolicy(mode, mask) == -1)
+	rc = -1;
+    return rc;
+}
@@ -0,0 +1,47 @@
+/*
+ *  place.h - CPU affinity and NUMA memory placement for jobs
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _PLACE_H
+#define _PLACE_H
+
+/* Where a queue's jobs run.  CPUs and nodes are lists such as "0-3,8",
+ * empty for anywhere; a memory policy of 0 leaves the one we have alone.
+ */
+#define PLACE_LIST_MAX 64
+#define PLACE_NODES_MAX 64	/* nodes we look at when spreading jobs */
+
+#define PLACE_MEM_PREFERRED 1	/* as the kernel numbers them */
+#define PLACE_MEM_BIND 2
+#define PLACE_MEM_INTERLEAVE 3
+
+#define PLACE_FIXED 1
+#define PLACE_SPREAD 2		/* each job on the least busy node */
+
+struct job_place {
+    char cpus[PLACE_LIST_MAX];
+    char nodes[PLACE_LIST_MAX];
+    unsigned int mempolicy;
+    unsigned int placement;
+};
+
+int place_list_valid(const char *list);
+int place_nodes(void);
+int place_node_usable(int node);
+int place_apply(const struct job_place *place, int node);
+
+#endif
@@ -0,0 +1,163 @@
+/*
+ *  prio.c - CPU and I/O scheduling classes for jobs
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/* System Headers */
+
+#include <sys/types.h>
+
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+
+#ifdef HAVE_SCHED_SETSCHEDULER
+#include <sched.h>
+#endif
+
+#include <string.h>
+
+#ifdef HAVE_SYS_SYSCALL_H
+#include <sys/syscall.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+/* Local headers */
+
+#include "prio.h"
+
+/* Macros */
+
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_SHIFT 13
+
+#define SCHED_FLAG_KEEP_ALL 0x18
+#define SCHED_FLAG_UTIL_CLAMP_MAX 0x40
+#define UCLAMP_SCALE 1024
+
+/* Structures and unions */
+
+/* What sched_setattr(2) takes, which the C library doesn't declare. */
+struct prio_sched_attr {
+    unsigned int size;
+    unsigned int sched_policy;
+    unsigned long long sched_flags;
+    int sched_nice;
+    unsigned int sched_priority;
+    unsigned long long sched_runtime;
+    unsigned long long sched_deadline;
+    unsigned long long sched_period;
+    unsigned int sched_util_min;
+    unsigned int sched_util_max;
+};
+
+/* Local functions */
+
+static int
+set_policy(unsigned int policy)
+{
+#if defined(HAVE_SCHED_SETSCHEDULER) && defined(SCHED_BATCH) \
+    && defined(SCHED_IDLE)
+    struct sched_param param;
+    int p;
+
+    switch (policy) {
+    case PRIO_POLICY_OTHER:
+	p = SCHED_OTHER;
+	break;
+    case PRIO_POLICY_BATCH:
+	p = SCHED_BATCH;
+	break;
+    case PRIO_POLICY_IDLE:
+	p = SCHED_IDLE;
+	break;
+    default:
+	errno = EINVAL;
+	return -1;
+    }
+    memset(&param, 0, sizeof(param));
+    return sched_setscheduler(0, p, &param);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static int
+set_ioprio(unsigned int ioclass, unsigned int level)
+{
+#ifdef SYS_ioprio_set
+    if (level > 7) {
+	errno = EINVAL;
+	return -1;
+    }
+    return syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+		   (int) (ioclass << IOPRIO_CLASS_SHIFT | level));
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static int
+set_uclamp(unsigned int percent)
+{
+/* Keep the job from driving up the CPU frequency, or from being put on
+ * a big core, on systems which go by utilization.
+ */
+#ifdef SYS_sched_setattr
+    struct prio_sched_attr attr;
+
+    if (percent > 100) {
+	errno = EINVAL;
+	return -1;
+    }
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.sched_flags = SCHED_FLAG_KEEP_ALL | SCHED_FLAG_UTIL_CLAMP_MAX;
+    attr.sched_util_max = percent * UCLAMP_SCALE / 100;
+    return syscall(SYS_sched_setattr, 0, &attr, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/* Global functions */
+
+int
+prio_apply(const struct job_prio *prio)
+{
+/* Called in the job's process before it execs the shell.  Everything
+ * is tried; returns -1 if anything failed.
+ */
+    int rc = 0;
+
+    if (prio->policy != 0 && set_policy(prio->policy) == -1)
+	rc = -1;
+    if (prio->ioclass != 0 && set_ioprio(prio->ioclass, prio->iolevel) == -1)
+	rc = -1;
+    if (prio->uclamp_max < 100 && set_uclamp(prio->uclamp_max) == -1)
+	rc = -1;
+    return rc;
+}
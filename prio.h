@@ -0,0 +1,42 @@
+/*
+ *  prio.h - CPU and I/O scheduling classes for jobs
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _PRIO_H
+#define _PRIO_H
+
+/* How a queue's jobs are scheduled beyond their nice value.  A policy or
+ * I/O class of 0 leaves the one we have alone.
+ */
+#define PRIO_POLICY_OTHER 1
+#define PRIO_POLICY_BATCH 2
+#define PRIO_POLICY_IDLE 3
+
+#define PRIO_IO_REALTIME 1	/* as the kernel numbers them */
+#define PRIO_IO_BEST_EFFORT 2
+#define PRIO_IO_IDLE 3
+
+struct job_prio {
+    unsigned int policy;
+    unsigned int ioclass;
+    unsigned int iolevel;	/* 0 (highest) to 7 within the class */
+    unsigned int uclamp_max;	/* percent of a CPU's capacity, 100 for any */
+};
+
+int prio_apply(const struct job_prio *prio);
+
+#endif
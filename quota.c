@@ -0,0 +1,168 @@
+/*
+ *  quota.c - limits on what a user or a queue may have queued
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/* System Headers */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <ctype.h>
+
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#elif defined(HAVE_SYS_FCNTL_H)
+#include <sys/fcntl.h>
+#endif
+
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+/* Local headers */
+
+#include "quota.h"
+
+/* Macros */
+
+#define RECORD_MAX 64
+
+/* Local functions */
+
+static int
+format_record(char *buf, size_t len, time_t when, unsigned long uid,
+	      char queue)
+{
+    return snprintf(buf, len, "%ld %lu %c\n", (long) when, uid, queue);
+}
+
+/* Global functions */
+
+int
+quota_count(const char *dir, uid_t uid, char queue,
+	    struct quota_usage *user, struct quota_usage *inqueue)
+{
+/* Add the jobs waiting in dir which belong to uid, and those in queue,
+ * to what has been counted so far.  Running jobs don't count; their
+ * spool files are gone, or, for recurring ones, still counted.
+ */
+    struct spool_scan *spool;
+    const struct spool_ent *ent;
+    int err;
+
+    if ((spool = spool_open(dir)) == NULL)
+	return errno == ENOENT ? 0 : -1;
+
+    while ((ent = spool_next(spool)) != NULL) {
+	if (!S_ISREG(ent->st.st_mode) || !isalpha((unsigned char) ent->queue))
+	    continue;
+	if (ent->st.st_uid == uid) {
+	    user->jobs++;
+	    user->bytes += ent->st.st_size;
+	}
+	if (ent->queue == queue) {
+	    inqueue->jobs++;
+	    inqueue->bytes += ent->st.st_size;
+	}
+    }
+    err = errno;
+    spool_close(spool);
+    errno = err;
+    return err == 0 ? 0 : -1;
+}
+
+int
+quota_recent(uid_t uid, char queue, time_t now,
+	     struct quota_usage *user, struct quota_usage *inqueue)
+{
+/* Count the jobs queued in the last QUOTA_RATE_PERIOD seconds.  Once
+ * .submits has grown to SUBMITS_MAX bytes, it is rewritten with just
+ * those.
+ */
+    char line[RECORD_MAX];
+    struct stat st;
+    FILE *fp, *out = NULL;
+    unsigned long u;
+    long when;
+    char q;
+    int fd, rc = 0;
+
+    user->recent = 0;
+    inqueue->recent = 0;
+    if ((fp = fopen(ATSUBMITS, "r")) == NULL)
+	return errno == ENOENT ? 0 : -1;
+
+    if (fstat(fileno(fp), &st) == 0 && st.st_size >= SUBMITS_MAX) {
+	unlink(ATSUBMITS ".new");
+	if ((fd = open(ATSUBMITS ".new", O_WRONLY | O_CREAT | O_EXCL,
+		       S_IRUSR | S_IWUSR)) >= 0
+	    && (out = fdopen(fd, "w")) == NULL)
+	    close(fd);
+    }
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+	if (sscanf(line, "%ld %lu %c", &when, &u, &q) != 3
+	    || when + QUOTA_RATE_PERIOD <= now)
+	    continue;
+	if ((uid_t) u == uid)
+	    user->recent++;
+	if (q == queue)
+	    inqueue->recent++;
+	if (out != NULL && fputs(line, out) == EOF)
+	    rc = -1;
+    }
+    fclose(fp);
+
+    if (out != NULL) {
+	if (fclose(out) == EOF)
+	    rc = -1;
+	if (rc == 0 && rename(ATSUBMITS ".new", ATSUBMITS) == -1)
+	    rc = -1;
+	if (rc == -1)
+	    unlink(ATSUBMITS ".new");
+    }
+    return rc;
+}
+
+int
+quota_note(uid_t uid, char queue, time_t now)
+{
+/* Record that a job has been queued. */
+    char buf[RECORD_MAX];
+    int fd, len, rc = 0;
+
+    len = format_record(buf, sizeof(buf), now, (unsigned long) uid, queue);
+    if ((fd = open(ATSUBMITS, O_WRONLY | O_APPEND | O_CREAT,
+		   S_IRUSR | S_IWUSR)) < 0)
+	return -1;
+    if (write(fd, buf, len) != len)
+	rc = -1;
+    if (close(fd) == -1)
+	rc = -1;
+    return rc;
+}
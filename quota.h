@@ -0,0 +1,50 @@
+/*
+ *  quota.h - limits on what a user or a queue may have queued
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _QUOTA_H
+#define _QUOTA_H
+
+#include <sys/types.h>
+#include <time.h>
+
+#include "spool.h"
+
+/* at(1) checks the maxjobs, maxbytes and maxrate settings of at.conf
+ * before it queues a job, while it holds the lock on the job sequence
+ * file, so that only one job at a time can get in under a limit.  The
+ * jobs and bytes are counted in the spool; each job queued appends a
+ * line "<time> <uid> <queue>" to .submits, which is what the rate is
+ * worked out from.  Only at touches .submits, always under that lock.
+ */
+#define ATSUBMITS ATJOB_DIR "/.submits"
+#define SUBMITS_MAX (64 * 1024)
+#define QUOTA_RATE_PERIOD 3600	/* maxrate counts jobs queued in this long */
+
+struct quota_usage {
+    unsigned long jobs;		/* queued, not yet running */
+    unsigned long long bytes;	/* in their job files */
+    unsigned long recent;	/* queued in the last QUOTA_RATE_PERIOD */
+};
+
+int quota_count(const char *dir, uid_t uid, char queue,
+		struct quota_usage *user, struct quota_usage *inqueue);
+int quota_recent(uid_t uid, char queue, time_t now,
+		 struct quota_usage *user, struct quota_usage *inqueue);
+int quota_note(uid_t uid, char queue, time_t now);
+
+#endif
@@ -0,0 +1,238 @@
+/*
+ *  recur.c - jobs which run again and again
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/* System Headers */
+
+#include <sys/types.h>
+#include <ctype.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Local headers */
+
+#include "recur.h"
+
+/* Macros */
+
+#define DAY_SECS (24 * 60 * 60)
+
+/* File scope variables */
+
+static const char *unit_names[] = {
+    NULL, "min", "hour", "day", "week", "month"
+};
+
+static const long unit_secs[] = {
+    0, 60, 60 * 60, DAY_SECS, 7 * DAY_SECS, 0
+};
+
+/* Local functions */
+
+static int
+month_days(int year, int mon)
+{
+    static const int days[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+
+    if (mon == 1 && year % 4 == 0 && (year % 100 != 0 || year % 400 == 0))
+	return 29;
+    return days[mon];
+}
+
+static time_t
+nth_run(const struct recur *r, const struct tm *first, long k)
+{
+/* The k-th run after the first, by the clock on the wall. */
+    struct tm tm = *first;
+    long months;
+    int days;
+
+    if (r->unit == RECUR_MONTH) {
+	months = tm.tm_mon + k * r->n;
+	tm.tm_year += months / 12;
+	tm.tm_mon = months % 12;
+	days = month_days(tm.tm_year + 1900, tm.tm_mon);
+	if (tm.tm_mday > days)
+	    tm.tm_mday = days;
+    }
+    else
+	tm.tm_mday += k * r->n * (r->unit == RECUR_WEEK ? 7 : 1);
+    return calendar_mktime(&tm, 0);
+}
+
+/* Global functions */
+
+int
+recur_parse(const char *spec, struct recur *r)
+{
+/* "[n]unit[s]@start", the unit being min, hour, day, week or month, and
+ * the start in seconds since the epoch, or "cal:" and a calendar
+ * expression as calendar_parse() takes it.  at leaves out the start,
+ * which it fills in itself.  Returns -1, leaving r alone, if spec is
+ * malformed.
+ */
+    struct recur rec;
+    const char *p = spec;
+    unsigned long n = 1;
+    char *end;
+    size_t len;
+
+    memset(&rec, 0, sizeof(rec));
+    if (strncmp(p, "cal:", 4) == 0) {
+	if (calendar_parse(p + 4, &rec.cal) == -1)
+	    return -1;
+	rec.unit = RECUR_CALENDAR;
+	rec.n = 1;
+	*r = rec;
+	return 0;
+    }
+
+    if (isdigit((unsigned char) *p)) {
+	n = strtoul(p, &end, 10);
+	p = end;
+	if (n == 0 || n > UINT_MAX)
+	    return -1;
+    }
+    for (len = 0; isalpha((unsigned char) p[len]); len++)
+	;
+    if (len > 1 && p[len - 1] == 's')
+	len--;
+
+    for (rec.unit = RECUR_MINUTE; rec.unit <= RECUR_MONTH; rec.unit++)
+	if (strlen(unit_names[rec.unit]) == len
+	    && strncmp(unit_names[rec.unit], p, len) == 0)
+	    break;
+    if (rec.unit > RECUR_MONTH)
+	return -1;
+    p += len;
+    if (*p == 's')
+	p++;
+
+    rec.n = n;
+    rec.start = 0;
+    if (*p == '@') {
+	rec.start = (time_t) strtol(p + 1, &end, 10);
+	if (end == p + 1)
+	    return -1;
+	p = end;
+    }
+    if (*p != '\0')
+	return -1;
+
+    *r = rec;
+    return 0;
+}
+
+int
+recur_format(const struct recur *r, char *buf, size_t len)
+{
+/* The inverse of recur_parse().  Returns -1 if buf is too short. */
+    int n;
+
+    if (r->unit == RECUR_CALENDAR) {
+	if (len < 5)
+	    return -1;
+	strcpy(buf, "cal:");
+	return calendar_format(&r->cal, buf + 4, len - 4);
+    }
+    if (r->unit < RECUR_MINUTE || r->unit > RECUR_MONTH)
+	return -1;
+    n = snprintf(buf, len, "%u%s@%ld", r->n, unit_names[r->unit],
+		 (long) r->start);
+    return n < 0 || (size_t) n >= len ? -1 : 0;
+}
+
+time_t
+recur_next(const struct recur *r, time_t now)
+{
+/* The first run after now.  Runs missed while the job was late or still
+ * running are skipped.  Returns 0 if there is none.
+ */
+    struct tm first, tm;
+    time_t t;
+    long k, period;
+
+    if (r->unit == 0 || r->n == 0)
+	return 0;
+    if (r->unit == RECUR_CALENDAR)
+	return calendar_next(&r->cal, now);
+    if (now < r->start)
+	return r->start;
+
+    if (r->unit < RECUR_DAY) {
+	period = unit_secs[r->unit] * (long) r->n;
+	return r->start + ((now - r->start) / period + 1) * period;
+    }
+
+    /* Guess how many runs have gone by, one low to allow for the clocks
+     * changing, and count on from there.
+     */
+    localtime_r(&r->start, &first);
+    if (r->unit == RECUR_MONTH) {
+	localtime_r(&now, &tm);
+	k = ((tm.tm_year - first.tm_year) * 12L + tm.tm_mon - first.tm_mon)
+	    / r->n;
+    }
+    else
+	k = (now - r->start) / (unit_secs[r->unit] * (long) r->n);
+    if (k > 0)
+	k--;
+
+    while ((t = nth_run(r, &first, k)) != (time_t) -1 && t <= now)
+	k++;
+    return t == (time_t) -1 ? 0 : t;
+}
+
+#ifdef TEST_RECUR
+
+int
+main(int argc, char **argv)
+{
+/* The next count runs after now of a job recurring as spec says. */
+    struct recur r;
+    time_t t;
+    int i, count = 1;
+
+    if (argc < 3 || argc > 4) {
+	fprintf(stderr, "usage: recurtest [now] [rule] [count]\n");
+	exit(EXIT_FAILURE);
+    }
+    if (argc == 4)
+	count = atoi(argv[3]);
+
+    if (recur_parse(argv[2], &r) == -1) {
+	printf("Ooops...\n");
+	return 1;
+    }
+    t = (time_t) atoll(argv[1]);
+    for (i = 0; i < count; i++) {
+	if ((t = recur_next(&r, t)) == 0) {
+	    printf("never\n");
+	    break;
+	}
+	printf("%s", ctime(&t));
+    }
+    return 0;
+}
+#endif
@@ -0,0 +1,54 @@
+/*
+ *  recur.h - jobs which run again and again
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _RECUR_H
+#define _RECUR_H
+
+#include <sys/types.h>
+#include <stddef.h>
+#include <time.h>
+
+#include "calendar.h"
+
+/* A recurring job runs every n units, counted from its first run.  Days
+ * and longer go by the clock on the wall, so a daily job stays at the
+ * same time of day across DST changes, and a monthly one on the 31st
+ * runs on the last day of shorter months.  One due at a time which the
+ * clocks skip runs as they go forward, and one due at a time which they
+ * show twice runs the first time.  A job given by a calendar
+ * expression runs whenever that says instead.
+ */
+#define RECUR_MINUTE 1
+#define RECUR_HOUR 2
+#define RECUR_DAY 3
+#define RECUR_WEEK 4
+#define RECUR_MONTH 5
+#define RECUR_CALENDAR 6
+
+struct recur {
+    unsigned int unit;		/* 0 if the job runs once */
+    unsigned int n;
+    time_t start;		/* the first run */
+    struct calendar cal;	/* for RECUR_CALENDAR */
+};
+
+int recur_parse(const char *spec, struct recur *r);
+int recur_format(const struct recur *r, char *buf, size_t len);
+time_t recur_next(const struct recur *r, time_t now);
+
+#endif
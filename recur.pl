@@ -0,0 +1,72 @@
+#! /usr/bin/perl
+#
+# recur.pl - test suite for the recurrence rules of recurring at jobs
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+
+use strict;
+use warnings;
+
+use Test::More 0.87;
+
+my $recurtest = "./recurtest 2>/dev/null";
+
+sub test {
+	my ($now, $rule, $count, $expected, $test_name) = @_;
+	$test_name = "$now: $rule" unless defined $test_name;
+
+	my $got = qx{$recurtest $now '$rule' $count};
+	chomp $got;
+	is($got, join("\n", @$expected), $test_name);
+}
+
+$ENV{TZ} = "America/New_York";
+
+# malformed rules
+test(1, "fortnight\@1", 1, ["Ooops..."]);
+test(1, "0days\@1", 1, ["Ooops..."]);
+
+# before the first run, and every so many minutes
+test(1709882900, "2days\@1709883000", 1, ["Fri Mar  8 02:30:00 2024"]);
+test(1709883000, "15min\@1709883000", 2,
+     ["Fri Mar  8 02:45:00 2024", "Fri Mar  8 03:00:00 2024"]);
+
+# monthly on the 31st keeps to the last day of shorter months, in leap
+# years and others
+test(1706709600, "month\@1706709600", 4,
+     ["Thu Feb 29 09:00:00 2024", "Sun Mar 31 09:00:00 2024",
+      "Tue Apr 30 09:00:00 2024", "Fri May 31 09:00:00 2024"]);
+test(1675173600, "month\@1675173600", 2,
+     ["Tue Feb 28 09:00:00 2023", "Fri Mar 31 09:00:00 2023"]);
+test(1706709600, "2months\@1706709600", 3,
+     ["Sun Mar 31 09:00:00 2024", "Fri May 31 09:00:00 2024",
+      "Wed Jul 31 09:00:00 2024"]);
+
+# daily at 02:30 across the clocks going forward at 02:00 on Sun Mar 10
+# 2024: that day it runs as they do
+test(1709883000, "day\@1709883000", 4,
+     ["Sat Mar  9 02:30:00 2024", "Sun Mar 10 03:00:00 2024",
+      "Mon Mar 11 02:30:00 2024", "Tue Mar 12 02:30:00 2024"]);
+test(1709883000, "week\@1709883000", 2,
+     ["Fri Mar 15 02:30:00 2024", "Fri Mar 22 02:30:00 2024"]);
+
+# the clocks going back at 02:00 on Sun Nov 3 2024: hourly runs go by
+# the hour that passes, daily ones at 01:30 run once, the first time
+test(1730608200, "hour\@1730608200", 3,
+     ["Sun Nov  3 01:30:00 2024", "Sun Nov  3 01:30:00 2024",
+      "Sun Nov  3 02:30:00 2024"]);
+test(1730525400, "day\@1730525400", 3,
+     ["Sun Nov  3 01:30:00 2024", "Mon Nov  4 01:30:00 2024",
+      "Tue Nov  5 01:30:00 2024"]);
+test(1730611800, "day\@1730525400", 1, ["Mon Nov  4 01:30:00 2024"],
+     "not again at 01:30 EST");
+
+# a calendar expression: weekdays at 09:00
+test(1705683600, "cal:1/200/*/*/3e", 2,
+     ["Mon Jan 22 09:00:00 2024", "Tue Jan 23 09:00:00 2024"]);
+
+done_testing();
+1;
@@ -0,0 +1,127 @@
+/*
+ *  ring.c - single producer, single consumer queue between atd's threads
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/* Local headers */
+
+#include "ring.h"
+
+#ifdef USE_THREADS
+
+/* System Headers */
+
+#include <sys/types.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#elif defined(HAVE_SYS_FCNTL_H)
+#include <sys/fcntl.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+/* Global functions */
+
+int
+ring_init(struct ring *r, size_t nslots, size_t size)
+{
+/* nslots must be a power of two. */
+    int i;
+
+    if ((r->slots = calloc(nslots, size)) == NULL)
+	return -1;
+    if (pipe(r->bell) == -1) {
+	free(r->slots);
+	return -1;
+    }
+    for (i = 0; i < 2; i++) {
+	fcntl(r->bell[i], F_SETFL, fcntl(r->bell[i], F_GETFL) | O_NONBLOCK);
+	fcntl(r->bell[i], F_SETFD, FD_CLOEXEC);
+    }
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    r->mask = nslots - 1;
+    r->size = size;
+    return 0;
+}
+
+int
+ring_push(struct ring *r, const void *item)
+{
+/* Returns -1 if the ring is full. */
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+
+    if (tail - head > r->mask)
+	return -1;
+
+    memcpy(r->slots + (tail & r->mask) * r->size, item, r->size);
+    atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+    return 0;
+}
+
+int
+ring_pop(struct ring *r, void *item)
+{
+/* Returns -1 if the ring is empty. */
+    size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+
+    if (head == tail)
+	return -1;
+
+    memcpy(item, r->slots + (head & r->mask) * r->size, r->size);
+    atomic_store_explicit(&r->head, head + 1, memory_order_release);
+    return 0;
+}
+
+void
+ring_wake(struct ring *r)
+{
+/* A full pipe already means a wakeup is pending, so EAGAIN is fine. */
+    char c = 0;
+
+    (void) write(r->bell[1], &c, 1);
+}
+
+void
+ring_wait(struct ring *r, int timeout)
+{
+/* Sleep for up to timeout milliseconds (forever if negative) unless
+ * ring_wake() has been called since the last wait.
+ */
+    struct pollfd pfd;
+    char buf[64];
+
+    pfd.fd = r->bell[0];
+    pfd.events = POLLIN;
+    (void) poll(&pfd, 1, timeout);
+
+    while (read(r->bell[0], buf, sizeof(buf)) > 0)
+	;
+}
+
+#endif
@@ -0,0 +1,54 @@
+/*
+ *  ring.h - single producer, single consumer queue between atd's threads
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _RING_H
+#define _RING_H
+
+#if defined(HAVE_LIBPTHREAD) && defined(HAVE_PTHREAD_H) \
+    && defined(HAVE_STDATOMIC_H)
+#define USE_THREADS 1
+#endif
+
+#ifdef USE_THREADS
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+/* A fixed number of fixed size slots.  Exactly one thread may push and
+ * exactly one may pop; neither ever blocks the other.  A consumer with
+ * nothing to do sleeps in ring_wait() until the producer calls
+ * ring_wake(), which writes to a pipe so a wakeup is never lost.
+ */
+struct ring {
+    atomic_size_t head;		/* next slot to pop, advanced by consumer */
+    atomic_size_t tail;		/* next slot to push, advanced by producer */
+    size_t mask;
+    size_t size;
+    char *slots;
+    int bell[2];
+};
+
+int ring_init(struct ring *r, size_t nslots, size_t size);
+int ring_push(struct ring *r, const void *item);
+int ring_pop(struct ring *r, void *item);
+void ring_wake(struct ring *r);
+void ring_wait(struct ring *r, int timeout);
+
+#endif
+
+#endif
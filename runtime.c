@@ -0,0 +1,381 @@
+/*
+ *  runtime.c - learning how long at jobs take
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/* System Headers */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#elif defined(HAVE_SYS_FCNTL_H)
+#include <sys/fcntl.h>
+#endif
+
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+/* Local headers */
+
+#include "runtime.h"
+#include "spool.h"
+
+/* Macros */
+
+#define RUNTIME_HASH 1024
+#define RECORD_MAX 64
+
+/* Each new sample moves the average a quarter of the way towards it. */
+#define RUNTIME_WEIGHT 0.25
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+/* Structures and unions */
+
+struct rent {
+    char kind;			/* 'S' for a script, 'U' for a user */
+    unsigned long long key;
+    double avg;
+    struct rent *next;
+};
+
+struct hent {
+    char name[JOBNAME_LEN + 1];
+    ino_t ino;
+    struct job_info info;
+    unsigned long seen;
+    struct hent *next;
+};
+
+/* File scope variables */
+
+static struct rent *table[RUNTIME_HASH];
+static struct hent *hashes[RUNTIME_HASH];
+static dev_t loaded_dev;
+static ino_t loaded_ino;
+static off_t loaded_off = 0;
+static unsigned long pass = 0;
+
+/* Local functions */
+
+static struct rent *
+find(char kind, unsigned long long key, int create)
+{
+    struct rent *p;
+    unsigned int h = (unsigned int) (key % RUNTIME_HASH);
+
+    for (p = table[h]; p != NULL; p = p->next)
+	if (p->kind == kind && p->key == key)
+	    return p;
+
+    if (!create || (p = malloc(sizeof(*p))) == NULL)
+	return NULL;
+    p->kind = kind;
+    p->key = key;
+    p->avg = -1.;
+    p->next = table[h];
+    table[h] = p;
+    return p;
+}
+
+static void
+forget_all(void)
+{
+    struct rent *p, *q;
+    int h;
+
+    for (h = 0; h < RUNTIME_HASH; h++) {
+	for (p = table[h]; p != NULL; p = q) {
+	    q = p->next;
+	    free(p);
+	}
+	table[h] = NULL;
+    }
+}
+
+static void
+apply(char *line)
+{
+    struct rent *p;
+    unsigned long long key;
+    long secs;
+    char kind;
+
+    if (sscanf(line, "%c %llx %ld", &kind, &key, &secs) != 3
+	|| (kind != 'S' && kind != 'U') || secs < 0)
+	return;
+
+    if ((p = find(kind, key, 1)) == NULL)
+	return;
+    if (p->avg < 0.)
+	p->avg = secs;
+    else
+	p->avg += (secs - p->avg) * RUNTIME_WEIGHT;
+}
+
+static int
+format_record(char *buf, size_t len, char kind, unsigned long long key,
+	      long secs)
+{
+    return snprintf(buf, len, "%c %llx %ld\n", kind, key, secs);
+}
+
+static void
+read_new(void)
+{
+/* Read whatever has been appended since the last call, starting over if
+ * the file has been compacted in the meantime.
+ */
+    struct stat st;
+    char *buf, *line, *nl;
+    ssize_t n;
+    size_t have, len;
+    int fd;
+
+    if ((fd = open(ATRUNTIMES, O_RDONLY)) < 0)
+	return;
+    if (fstat(fd, &st) == -1) {
+	close(fd);
+	return;
+    }
+    if (st.st_dev != loaded_dev || st.st_ino != loaded_ino
+	|| st.st_size < loaded_off) {
+	forget_all();
+	loaded_dev = st.st_dev;
+	loaded_ino = st.st_ino;
+	loaded_off = 0;
+    }
+    if (st.st_size == loaded_off
+	|| (buf = malloc(st.st_size - loaded_off + 1)) == NULL) {
+	close(fd);
+	return;
+    }
+
+    len = st.st_size - loaded_off;
+    for (have = 0; have < len; have += n) {
+	n = pread(fd, buf + have, len - have, loaded_off + have);
+	if (n == -1 && errno == EINTR) {
+	    n = 0;
+	    continue;
+	}
+	if (n <= 0)
+	    break;
+    }
+    close(fd);
+    buf[have] = '\0';
+
+    /* A line still being written is left for next time. */
+    for (line = buf; (nl = strchr(line, '\n')) != NULL; line = nl + 1) {
+	*nl = '\0';
+	apply(line);
+    }
+    loaded_off += line - buf;
+    free(buf);
+}
+
+/* Global functions */
+
+unsigned long long
+runtime_hash(int fd)
+{
+/* Hash the commands of a job, from the line where it changes into its
+ * working directory to the end.  Returns 0 if there is no such line.
+ * The file offset is left alone.
+ */
+    static const char mark[] = "\ncd ";
+    unsigned long long h = FNV_OFFSET;
+    char buf[8192];
+    off_t off = 0;
+    ssize_t n, i;
+    size_t matched = 0;
+    int hashing = 0;
+
+    while ((n = pread(fd, buf, sizeof(buf), off)) != 0) {
+	if (n == -1) {
+	    if (errno == EINTR)
+		continue;
+	    return 0;
+	}
+	off += n;
+
+	for (i = 0; i < n; i++) {
+	    if (!hashing) {
+		if (buf[i] == mark[matched])
+		    matched++;
+		else
+		    matched = buf[i] == '\n';
+		if (matched < sizeof(mark) - 1)
+		    continue;
+		hashing = 1;
+		h = (h ^ 'c') * FNV_PRIME;
+		h = (h ^ 'd') * FNV_PRIME;
+	    }
+	    h = (h ^ (unsigned char) buf[i]) * FNV_PRIME;
+	}
+    }
+    return hashing ? h : 0;
+}
+
+void
+runtime_note(unsigned long long hash, uid_t uid, long secs)
+{
+/* Record how long a job took.  Both lines go out in one write so that
+ * appends from several supervisors don't interleave.
+ */
+    char buf[2 * RECORD_MAX];
+    int fd, len = 0;
+
+    if (hash != 0)
+	len = format_record(buf, sizeof(buf), 'S', hash, secs);
+    len += format_record(buf + len, sizeof(buf) - len, 'U',
+			 (unsigned long long) uid, secs);
+
+    if ((fd = open(ATRUNTIMES, O_WRONLY | O_APPEND | O_CREAT,
+		   S_IRUSR | S_IWUSR)) < 0)
+	return;
+    (void) write(fd, buf, len);
+    close(fd);
+}
+
+void
+runtime_load(void)
+{
+/* Catch up with .runtimes, and forget the hashes of jobs which weren't
+ * asked about during the previous pass.
+ */
+    struct hent **pp, *p;
+    int h;
+
+    pass++;
+    for (h = 0; h < RUNTIME_HASH; h++)
+	for (pp = &hashes[h]; (p = *pp) != NULL;) {
+	    if (p->seen + 1 < pass) {
+		*pp = p->next;
+		free(p);
+	    }
+	    else
+		pp = &p->next;
+	}
+    read_new();
+}
+
+int
+runtime_compact(off_t limit)
+{
+/* Once the file has grown to limit bytes, replace it by one holding just
+ * the current average for each script and user.  Samples appended while
+ * we do this are lost, which only makes the averages a little staler.
+ */
+    char buf[RECORD_MAX];
+    struct stat st;
+    struct rent *p;
+    int fd, h, len, rc = 0;
+
+    if (stat(ATRUNTIMES, &st) == -1 || st.st_size < limit)
+	return 0;
+
+    read_new();
+
+    unlink(ATRUNTIMES ".new");
+    if ((fd = open(ATRUNTIMES ".new", O_WRONLY | O_CREAT | O_EXCL,
+		   S_IRUSR | S_IWUSR)) < 0)
+	return -1;
+
+    for (h = 0; h < RUNTIME_HASH && rc == 0; h++)
+	for (p = table[h]; p != NULL; p = p->next) {
+	    len = format_record(buf, sizeof(buf), p->kind, p->key,
+				(long) (p->avg + 0.5));
+	    if (write(fd, buf, len) != len) {
+		rc = -1;
+		break;
+	    }
+	}
+
+    if (close(fd) == -1)
+	rc = -1;
+    if (rc == 0 && rename(ATRUNTIMES ".new", ATRUNTIMES) == -1)
+	rc = -1;
+    if (rc == -1)
+	unlink(ATRUNTIMES ".new");
+    return rc;
+}
+
+long
+runtime_estimate(unsigned long long hash, uid_t uid)
+{
+/* How long we expect a job to take, in seconds, or -1 if we've no idea. */
+    struct rent *p;
+
+    if (hash != 0 && (p = find('S', hash, 0)) != NULL)
+	return (long) (p->avg + 0.5);
+    if ((p = find('U', (unsigned long long) uid, 0)) != NULL)
+	return (long) (p->avg + 0.5);
+    return -1;
+}
+
+struct job_info *
+runtime_job(const char *name, const struct stat *st)
+{
+/* Look up the job file name in the current directory, which we only read
+ * the first time we're asked about it.  Files we can't read get no hash,
+ * so just their owner's estimate, and default attributes.  Returns NULL
+ * if we run out of memory.
+ */
+    struct hent *p;
+    unsigned int h = (unsigned int) (st->st_ino % RUNTIME_HASH);
+    int fd;
+
+    for (p = hashes[h]; p != NULL; p = p->next)
+	if (p->ino == st->st_ino && strcmp(p->name, name) == 0)
+	    break;
+
+    if (p == NULL && strlen(name) == JOBNAME_LEN
+	&& (p = malloc(sizeof(*p))) != NULL) {
+	memcpy(p->name, name, JOBNAME_LEN + 1);
+	p->ino = st->st_ino;
+	p->info.hash = 0;
+	p->info.late = 0;
+	jobattr_init(&p->info.attr);
+	if ((fd = open(name, O_RDONLY | O_NONBLOCK)) >= 0) {
+	    p->info.hash = runtime_hash(fd);
+	    jobattr_read(fd, &p->info.attr);
+	    close(fd);
+	}
+	p->next = hashes[h];
+	hashes[h] = p;
+    }
+    if (p == NULL)
+	return NULL;
+
+    p->seen = pass;
+    return &p->info;
+}
@@ -0,0 +1,56 @@
+/*
+ *  runtime.h - learning how long at jobs take
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _RUNTIME_H
+#define _RUNTIME_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "jobattr.h"
+
+/* Every finished job appends how long it took to .runtimes, once under
+ * the hash of its script (from the "cd" line on, so the environment
+ * doesn't count) and once under its owner.  The estimate for a job is
+ * the moving average for its script if that has been seen before, else
+ * the one for its owner.
+ */
+#define ATRUNTIMES ATJOB_DIR "/.runtimes"
+#define RUNTIME_MAX (64 * 1024)
+
+/* Where atd leaves its latest predictions for atq -e: lines of
+ * "<job file name> <start time> <runtime, -1 if unknown>".
+ */
+#define ATESTIMATES ATJOB_DIR "/.estimates"
+
+/* What atd reads from a job file when it first comes across it. */
+struct job_info {
+    unsigned long long hash;	/* of its commands, 0 if unreadable */
+    struct job_attr attr;	/* from its header */
+    int late;			/* logged as missing its deadline */
+};
+
+unsigned long long runtime_hash(int fd);
+void runtime_note(unsigned long long hash, uid_t uid, long secs);
+void runtime_load(void);
+int runtime_compact(off_t limit);
+long runtime_estimate(unsigned long long hash, uid_t uid);
+struct job_info *runtime_job(const char *name, const struct stat *st);
+
+#endif
@@ -0,0 +1,421 @@
+/*
+ *  spool.c - read the at job spool in batches
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/* System Headers */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#elif defined(HAVE_SYS_FCNTL_H)
+#include <sys/fcntl.h>
+#endif
+
+#ifdef HAVE_DIRENT_H
+#include <dirent.h>
+#elif HAVE_SYS_DIRENT_H
+#include <sys/dirent.h>
+#elif HAVE_SYS_DIR_H
+#include <sys/dir.h>
+#endif
+
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#if defined(HAVE_LINUX_IO_URING_H) && defined(HAVE_STATX)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <linux/io_uring.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define USE_IO_URING 1
+#endif
+#endif
+
+/* Local headers */
+
+#include "spool.h"
+
+/* Macros */
+
+#define SPOOL_BUFSIZE (128 * 1024)	/* bytes asked of getdents64() */
+#define SPOOL_BATCH 256			/* entries stat()ed together */
+#define SPOOL_RING 64			/* io_uring submission queue size */
+
+/* Structures */
+
+struct spool_scan {
+    int fd;
+#ifdef HAVE_GETDENTS64
+    char *buf;
+    ssize_t buflen, bufpos;
+#else
+    DIR *dir;
+#endif
+    int eof, error;
+    int nent, pos;
+    struct spool_ent ent[SPOOL_BATCH];
+#ifdef USE_IO_URING
+    struct statx stx[SPOOL_BATCH];
+    int res[SPOOL_BATCH];
+#endif
+};
+
+#ifdef HAVE_GETDENTS64
+struct spool_dirent64 {
+    unsigned long long d_ino;
+    long long d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+#endif
+
+/* Local functions */
+
+static int
+want_entry(struct spool_ent *ent, const char *name, int type)
+{
+/* Decide from the directory entry alone whether we need to stat this;
+ * anything which is not named like a job, or which the file system
+ * tells us is not a regular file, is skipped.
+ */
+    if (strlen(name) != JOBNAME_LEN)
+	return 0;
+#ifdef DT_REG
+    if (type != DT_REG && type != DT_UNKNOWN)
+	return 0;
+#endif
+    if (sscanf(name, "%c%5lx%8lx", &ent->queue, &ent->jobno, &ent->ctm) != 3)
+	return 0;
+
+    memcpy(ent->name, name, JOBNAME_LEN + 1);
+    return 1;
+}
+
+static int
+stat_entry(struct spool_scan *sp, struct spool_ent *ent)
+{
+#ifdef HAVE_FSTATAT
+    return fstatat(sp->fd, ent->name, &ent->st, 0);
+#else
+    return stat(ent->name, &ent->st);
+#endif
+}
+
+#ifdef USE_IO_URING
+
+/* A minimal io_uring, used only to have the kernel do a batch of statx()
+ * calls for us in one system call.  If the kernel (or a seccomp filter)
+ * won't give us one, we quietly do them one by one instead.
+ */
+static struct {
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+} ring = { -2 };
+
+static int
+ring_setup(void)
+{
+    struct io_uring_params p;
+    size_t sq_sz, cq_sz;
+    char *sq, *cq;
+    int fd;
+
+    if (ring.fd != -2)
+	return ring.fd;
+    ring.fd = -1;
+
+    memset(&p, 0, sizeof(p));
+    fd = syscall(__NR_io_uring_setup, SPOOL_RING, &p);
+    if (fd < 0)
+	return -1;
+
+    sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if ((p.features & IORING_FEAT_SINGLE_MMAP) && cq_sz > sq_sz)
+	sq_sz = cq_sz;
+
+    sq = mmap(NULL, sq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+	      fd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED)
+	goto fail;
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+	cq = sq;
+    else {
+	cq = mmap(NULL, cq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		  fd, IORING_OFF_CQ_RING);
+	if (cq == MAP_FAILED)
+	    goto fail;
+    }
+
+    ring.sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+		     PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		     fd, IORING_OFF_SQES);
+    if (ring.sqes == MAP_FAILED)
+	goto fail;
+
+    ring.sq_head = (unsigned *) (sq + p.sq_off.head);
+    ring.sq_tail = (unsigned *) (sq + p.sq_off.tail);
+    ring.sq_mask = (unsigned *) (sq + p.sq_off.ring_mask);
+    ring.sq_array = (unsigned *) (sq + p.sq_off.array);
+    ring.cq_head = (unsigned *) (cq + p.cq_off.head);
+    ring.cq_tail = (unsigned *) (cq + p.cq_off.tail);
+    ring.cq_mask = (unsigned *) (cq + p.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    ring.fd = fd;
+    return fd;
+
+fail:
+    close(fd);
+    return -1;
+}
+
+static int
+ring_statx(struct spool_scan *sp, int first, int count)
+{
+/* Queue statx() for entries first .. first+count-1, wait for all of
+ * them to complete and leave the results in sp->res[].
+ */
+    unsigned tail, head;
+    int i, done;
+    struct io_uring_sqe *sqe;
+    struct io_uring_cqe *cqe;
+
+    tail = *ring.sq_tail;
+    for (i = 0; i < count; i++) {
+	unsigned idx = tail & *ring.sq_mask;
+
+	sqe = &ring.sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_STATX;
+	sqe->fd = sp->fd;
+	sqe->addr = (unsigned long) sp->ent[first + i].name;
+	sqe->len = STATX_BASIC_STATS;
+	sqe->off = (unsigned long) &sp->stx[first + i];
+	sqe->statx_flags = 0;
+	sqe->user_data = first + i;
+	ring.sq_array[idx] = idx;
+	tail++;
+    }
+    __atomic_store_n(ring.sq_tail, tail, __ATOMIC_RELEASE);
+
+    if (syscall(__NR_io_uring_enter, ring.fd, count, count,
+		IORING_ENTER_GETEVENTS, NULL, 0) < 0)
+	return -1;
+
+    done = 0;
+    head = *ring.cq_head;
+    while (done < count) {
+	if (head == __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) {
+	    if (syscall(__NR_io_uring_enter, ring.fd, 0, count - done,
+			IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR)
+		return -1;
+	    continue;
+	}
+	cqe = &ring.cqes[head & *ring.cq_mask];
+	sp->res[cqe->user_data] = cqe->res;
+	head++;
+	done++;
+    }
+    __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static void
+statx_to_stat(const struct statx *stx, struct stat *st)
+{
+    memset(st, 0, sizeof(*st));
+    st->st_dev = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+    st->st_ino = stx->stx_ino;
+    st->st_mode = stx->stx_mode;
+    st->st_nlink = stx->stx_nlink;
+    st->st_uid = stx->stx_uid;
+    st->st_gid = stx->stx_gid;
+    st->st_size = stx->stx_size;
+    st->st_mtime = stx->stx_mtime.tv_sec;
+    st->st_ctime = stx->stx_ctime.tv_sec;
+}
+
+#endif /* USE_IO_URING */
+
+static void
+stat_batch(struct spool_scan *sp)
+{
+/* Stat everything collected in this batch and drop whatever has gone
+ * away in the meantime.
+ */
+    int i, n;
+#ifdef USE_IO_URING
+    int first, count, ok;
+
+    ok = ring_setup() >= 0;
+    for (first = 0; ok && first < sp->nent; first += count) {
+	count = sp->nent - first;
+	if (count > SPOOL_RING)
+	    count = SPOOL_RING;
+	if (ring_statx(sp, first, count) == -1) {
+	    /* Ring state is unknown now; don't use it again. */
+	    close(ring.fd);
+	    ring.fd = -1;
+	    ok = 0;
+	}
+    }
+#endif
+
+    for (i = n = 0; i < sp->nent; i++) {
+#ifdef USE_IO_URING
+	if (ok && sp->res[i] == 0)
+	    statx_to_stat(&sp->stx[i], &sp->ent[i].st);
+	else if (ok && sp->res[i] == -ENOENT)
+	    continue;
+	else
+#endif
+	if (stat_entry(sp, &sp->ent[i]) != 0)
+	    continue;
+
+	if (n != i)
+	    sp->ent[n] = sp->ent[i];
+	n++;
+    }
+    sp->nent = n;
+}
+
+static void
+fill_batch(struct spool_scan *sp)
+{
+/* Collect up to SPOOL_BATCH plausible job names from the directory.
+ */
+    sp->nent = sp->pos = 0;
+
+#ifdef HAVE_GETDENTS64
+    while (!sp->eof && sp->nent < SPOOL_BATCH) {
+	struct spool_dirent64 *d;
+
+	if (sp->bufpos >= sp->buflen) {
+	    sp->buflen = getdents64(sp->fd, sp->buf, SPOOL_BUFSIZE);
+	    sp->bufpos = 0;
+	    if (sp->buflen <= 0) {
+		if (sp->buflen == -1)
+		    sp->error = errno;
+		sp->eof = 1;
+		break;
+	    }
+	}
+	d = (struct spool_dirent64 *) (sp->buf + sp->bufpos);
+	sp->bufpos += d->d_reclen;
+	if (want_entry(&sp->ent[sp->nent], d->d_name, d->d_type))
+	    sp->nent++;
+    }
+#else
+    while (!sp->eof && sp->nent < SPOOL_BATCH) {
+	struct dirent *d;
+	int type = 0;
+
+	errno = 0;
+	if ((d = readdir(sp->dir)) == NULL) {
+	    sp->error = errno;
+	    sp->eof = 1;
+	    break;
+	}
+#ifdef DT_REG
+	type = d->d_type;
+#endif
+	if (want_entry(&sp->ent[sp->nent], d->d_name, type))
+	    sp->nent++;
+    }
+#endif
+    if (sp->nent > 0)
+	stat_batch(sp);
+}
+
+/* Global functions */
+
+struct spool_scan *
+spool_open(const char *path)
+{
+    struct spool_scan *sp;
+
+    if ((sp = calloc(1, sizeof(*sp))) == NULL)
+	return NULL;
+
+#ifdef HAVE_GETDENTS64
+    if ((sp->buf = malloc(SPOOL_BUFSIZE)) == NULL) {
+	free(sp);
+	return NULL;
+    }
+    if ((sp->fd = open(path, O_RDONLY | O_DIRECTORY)) == -1) {
+	free(sp->buf);
+	free(sp);
+	return NULL;
+    }
+    fcntl(sp->fd, F_SETFD, FD_CLOEXEC);
+#else
+    if ((sp->dir = opendir(path)) == NULL) {
+	free(sp);
+	return NULL;
+    }
+    sp->fd = dirfd(sp->dir);
+#endif
+    return sp;
+}
+
+const struct spool_ent *
+spool_next(struct spool_scan *sp)
+{
+    while (sp->pos >= sp->nent) {
+	if (sp->eof) {
+	    errno = sp->error;
+	    return NULL;
+	}
+	fill_batch(sp);
+    }
+    return &sp->ent[sp->pos++];
+}
+
+void
+spool_close(struct spool_scan *sp)
+{
+#ifdef HAVE_GETDENTS64
+    close(sp->fd);
+    free(sp->buf);
+#else
+    closedir(sp->dir);
+#endif
+    free(sp);
+}
@@ -0,0 +1,63 @@
+/*
+ *  spool.h - layout of the at job spool, shared by at and atd
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _SPOOL_H
+#define _SPOOL_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/* Jobs which are due further in the future than atd's horizon (atd -H)
+ * are moved into the cold tier, a subdirectory of the spool which atd
+ * only looks at when the horizon catches up with the earliest job in it.
+ * The leading dot keeps it from ever parsing as a job name.
+ */
+#define ATCOLD_NAME ".cold"
+#define ATCOLD_DIR ATJOB_DIR "/" ATCOLD_NAME
+
+/* Several atds may share one spool (atd -i n/m); instance n keeps its
+ * pid in PIDFILE.n rather than PIDFILE.
+ */
+#define ATD_INSTANCES_MAX 64
+
+/* A job file name is the queue letter, five hex digits of job number
+ * and eight hex digits of run time in minutes since the epoch.
+ */
+#define JOBNAME_LEN 14
+
+/* Walking the spool: spool_open() a directory and call spool_next() until
+ * it returns NULL, with errno set to 0 at the end of the directory or to
+ * the error which cut the walk short.  Only entries which are named like jobs and which are
+ * still there when we get to stat them are returned, with the stat result
+ * already filled in.  Names are relative to the directory opened.
+ */
+struct spool_ent {
+    char name[JOBNAME_LEN + 1];
+    char queue;
+    unsigned long jobno;
+    unsigned long ctm;
+    struct stat st;
+};
+
+struct spool_scan;
+
+struct spool_scan *spool_open(const char *path);
+const struct spool_ent *spool_next(struct spool_scan *sp);
+void spool_close(struct spool_scan *sp);
+
+#endif
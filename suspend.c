@@ -0,0 +1,180 @@
+/*
+ *  suspend.c - make running batch jobs give way under load
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/* System Headers */
+
+#include <sys/types.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <syslog.h>
+
+/* Local headers */
+
+#include "suspend.h"
+
+/* Macros */
+
+#define CPU_PRESSURE "/proc/pressure/cpu"
+
+/* Structures and unions */
+
+struct held {
+    unsigned long jobno;
+    pid_t pid;			/* of the job's supervisor */
+    char queue;
+    int stopped;		/* -1 if we don't know */
+    int seen;
+};
+
+/* File scope variables */
+
+static struct held *held = NULL;
+static size_t nheld = 0;
+static size_t held_alloc = 0;
+static int busy = 0;
+
+/* Local functions */
+
+static int
+better(const struct held *a, const struct held *b)
+{
+/* Jobs in lower queues, which run at a higher priority, go on first;
+ * then the oldest.
+ */
+    if (a->queue != b->queue)
+	return a->queue < b->queue;
+    return a->jobno < b->jobno;
+}
+
+/* Global functions */
+
+void
+suspend_begin(void)
+{
+/* Called before each scan of the spool. */
+    size_t i;
+
+    for (i = 0; i < nheld; i++)
+	held[i].seen = 0;
+}
+
+void
+suspend_job(unsigned long jobno, char queue, pid_t pid)
+{
+/* Note a running batch job.  The tasks of an array job share its number,
+ * so the pid tells them apart.  One we haven't seen before may have been
+ * left stopped by an earlier atd, for all we know.
+ */
+    struct held *h;
+    size_t i, alloc;
+
+    for (i = 0; i < nheld; i++)
+	if (held[i].jobno == jobno && held[i].pid == pid)
+	    break;
+
+    if (i == nheld) {
+	if (nheld == held_alloc) {
+	    alloc = held_alloc ? 2 * held_alloc : 16;
+	    if ((h = realloc(held, alloc * sizeof(*h))) == NULL)
+		return;
+	    held = h;
+	    held_alloc = alloc;
+	}
+	nheld++;
+	held[i].jobno = jobno;
+	held[i].pid = 0;
+    }
+    h = &held[i];
+    if (h->pid != pid) {
+	h->pid = pid;
+	h->stopped = -1;
+    }
+    h->queue = queue;
+    h->seen = 1;
+}
+
+int
+suspend_settle(int level, int *stopped)
+{
+/* Called after the scan with level 1 if the system is busy, -1 if it
+ * has calmed down, and 0 in between.  When busy, all batch jobs are
+ * stopped at once, so the CPU is back in seconds; when calm, they are
+ * let go one each time, best first, so as not to bring the load straight
+ * back.  Returns how many jobs there are to keep an eye on and sets
+ * *stopped to how many of them are stopped.
+ */
+    struct held *best = NULL;
+    size_t i, j;
+    int n = 0;
+
+    for (i = j = 0; i < nheld; i++)
+	if (held[i].seen)
+	    held[j++] = held[i];
+    nheld = j;
+
+    for (i = 0; i < nheld; i++) {
+	if (level > 0 && held[i].stopped != 1) {
+	    if (kill(held[i].pid, SUSPEND_STOP) == 0) {
+		held[i].stopped = 1;
+		n++;
+	    }
+	}
+	else if (level < 0 && held[i].stopped != 0
+		 && (best == NULL || better(&held[i], best)))
+	    best = &held[i];
+    }
+    if (n > 0 && !busy)
+	syslog(LOG_NOTICE, "System busy, suspending batch jobs");
+    if (level > 0)
+	busy = 1;
+
+    if (best != NULL) {
+	if (kill(best->pid, SUSPEND_CONT) == 0 && best->stopped == 1)
+	    syslog(LOG_INFO, "Resuming job %8lu", best->jobno);
+	best->stopped = 0;
+	busy = 0;
+    }
+
+    for (i = n = 0; i < nheld; i++)
+	if (held[i].stopped != 0)
+	    n++;
+    *stopped = n;
+    return nheld;
+}
+
+double
+suspend_cpu_pressure(void)
+{
+/* The share of the last ten seconds in which something was waiting for
+ * a CPU, in percent, or -1 if the kernel doesn't tell us.
+ */
+    FILE *fp;
+    double avg10 = -1.;
+
+    if ((fp = fopen(CPU_PRESSURE, "r")) == NULL)
+	return -1.;
+    if (fscanf(fp, "some avg10=%lf", &avg10) != 1)
+	avg10 = -1.;
+    fclose(fp);
+    return avg10;
+}
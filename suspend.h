@@ -0,0 +1,38 @@
+/*
+ *  suspend.h - make running batch jobs give way under load
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _SUSPEND_H
+#define _SUSPEND_H
+
+#include <sys/types.h>
+
+/* While batch jobs run, atd looks at the load every SUSPEND_INTERVAL
+ * seconds.  It asks their supervisors to stop them with SUSPEND_STOP and
+ * to let them carry on with SUSPEND_CONT, and the supervisor passes that
+ * on to the job's process group.
+ */
+#define SUSPEND_INTERVAL 5
+#define SUSPEND_STOP SIGTSTP
+#define SUSPEND_CONT SIGCONT
+
+void suspend_begin(void);
+void suspend_job(unsigned long jobno, char queue, pid_t pid);
+int suspend_settle(int level, int *stopped);
+double suspend_cpu_pressure(void);
+
+#endif
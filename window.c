@@ -0,0 +1,279 @@
+/*
+ *  window.c - weekly time windows in which jobs may start
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/* System Headers */
+
+#include <sys/types.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+/* Local headers */
+
+#include "calendar.h"
+#include "window.h"
+
+/* Macros */
+
+#define ALL_DAYS 0x7f
+#define DAY_MINUTES (24 * 60)
+
+/* File scope variables */
+
+static const char *day_names[] = {
+    "sun", "mon", "tue", "wed", "thu", "fri", "sat"
+};
+
+/* Local functions */
+
+static int
+parse_day(const char **sp)
+{
+    int i;
+
+    for (i = 0; i < 7; i++)
+	if (strncasecmp(*sp, day_names[i], 3) == 0) {
+	    *sp += 3;
+	    return i;
+	}
+    return -1;
+}
+
+static int
+parse_time(const char **sp)
+{
+/* HH:MM, returned as minutes since midnight; 24:00 is allowed. */
+    const char *p = *sp;
+    int hour = 0, min;
+
+    if (!isdigit((unsigned char) *p))
+	return -1;
+    while (isdigit((unsigned char) *p) && hour <= 24)
+	hour = 10 * hour + (*p++ - '0');
+    if (*p++ != ':' || !isdigit((unsigned char) p[0])
+	|| !isdigit((unsigned char) p[1]))
+	return -1;
+    min = 10 * (p[0] - '0') + (p[1] - '0');
+    if (hour > 24 || min > 59 || (hour == 24 && min != 0))
+	return -1;
+
+    *sp = p + 2;
+    return hour * 60 + min;
+}
+
+static time_t
+day_time(const struct tm *day, int minutes, int last)
+{
+/* The time minutes after the midnight starting day, going by the clock
+ * on the wall, so that DST changes are taken care of.  A time which the
+ * clocks show twice is the first of the two, or the last if last is set,
+ * so that a window spans both.
+ */
+    struct tm tm = *day;
+
+    tm.tm_hour = 0;
+    tm.tm_min = minutes;
+    tm.tm_sec = 0;
+    return calendar_mktime(&tm, last);
+}
+
+/* Global functions */
+
+int
+window_parse(const char *spec, struct window_set *ws)
+{
+/* Returns -1, leaving ws alone, if spec is malformed. */
+    struct window_set set;
+    struct window *w;
+    const char *p = spec;
+    int d, d1, d2, start, end;
+
+    set.n = 0;
+    if (*p == '\0') {
+	*ws = set;
+	return 0;
+    }
+
+    for (;;) {
+	if (set.n == WINDOW_MAX)
+	    return -1;
+	w = &set.w[set.n];
+
+	w->days = ALL_DAYS;
+	if (isalpha((unsigned char) *p)) {
+	    if ((d1 = d2 = parse_day(&p)) < 0)
+		return -1;
+	    if (*p == '-') {
+		p++;
+		if ((d2 = parse_day(&p)) < 0)
+		    return -1;
+	    }
+	    if (*p != '/')
+		return -1;
+	    p++;
+
+	    w->days = 0;
+	    for (d = d1;; d = (d + 1) % 7) {
+		w->days |= 1 << d;
+		if (d == d2)
+		    break;
+	    }
+	}
+
+	if ((start = parse_time(&p)) < 0 || start == DAY_MINUTES || *p != '-')
+	    return -1;
+	p++;
+	if ((end = parse_time(&p)) < 0)
+	    return -1;
+
+	w->start = start;
+	w->end = end;
+	set.n++;
+
+	if (*p == '\0') {
+	    *ws = set;
+	    return 0;
+	}
+	if (*p != ',')
+	    return -1;
+	p++;
+    }
+}
+
+int
+window_format(const struct window_set *ws, char *buf, size_t len)
+{
+/* The inverse of window_parse().  Returns -1 if buf is too short. */
+    const struct window *w;
+    size_t used = 0;
+    int i, n, d1, d2;
+
+    if (len == 0)
+	return -1;
+    buf[0] = '\0';
+
+    for (i = 0; i < ws->n; i++) {
+	w = &ws->w[i];
+	n = 0;
+
+	if (w->days != ALL_DAYS && w->days != 0) {
+	    /* The days are a range, possibly wrapping round the week. */
+	    for (d1 = 0; d1 < 7; d1++)
+		if ((w->days & 1 << d1) && !(w->days & 1 << (d1 + 6) % 7))
+		    break;
+	    for (d2 = d1; w->days & 1 << (d2 + 1) % 7; d2 = (d2 + 1) % 7)
+		;
+	    if (d1 == d2)
+		n = snprintf(buf + used, len - used, "%s%s/", i ? "," : "",
+			     day_names[d1]);
+	    else
+		n = snprintf(buf + used, len - used, "%s%s-%s/", i ? "," : "",
+			     day_names[d1], day_names[d2]);
+	}
+	else if (i > 0)
+	    n = snprintf(buf + used, len - used, ",");
+	if (n < 0 || (size_t) n >= len - used)
+	    return -1;
+	used += n;
+
+	n = snprintf(buf + used, len - used, "%02d:%02d-%02d:%02d",
+		     w->start / 60, w->start % 60, w->end / 60, w->end % 60);
+	if (n < 0 || (size_t) n >= len - used)
+	    return -1;
+	used += n;
+    }
+    return 0;
+}
+
+time_t
+window_next(const struct window_set *ws, time_t t)
+{
+/* The first time from t on at which one of the windows is open: t itself
+ * if one is open now.  Windows which started the day before may still
+ * be open, and every window comes round within a week.
+ */
+    const struct window *w;
+    struct tm now, day;
+    time_t start, end, best = 0;
+    int i, offset, len;
+
+    if (ws->n == 0)
+	return t;
+
+    localtime_r(&t, &now);
+    for (offset = -1; offset <= 7; offset++) {
+	day = now;
+	day.tm_mday += offset;
+	day.tm_hour = 12;
+	day.tm_min = day.tm_sec = 0;
+	day.tm_isdst = -1;
+	if (mktime(&day) == (time_t) -1)
+	    continue;
+
+	for (i = 0; i < ws->n; i++) {
+	    w = &ws->w[i];
+	    if (!(w->days & 1 << day.tm_wday))
+		continue;
+
+	    len = w->end > w->start ? w->end - w->start
+		: w->end + DAY_MINUTES - w->start;
+	    start = day_time(&day, w->start, 0);
+	    end = day_time(&day, w->start + len, 1);
+
+	    if (start <= t && t < end)
+		return t;
+	    if (start > t && (best == 0 || start < best))
+		best = start;
+	}
+    }
+    return best;
+}
+
+#ifdef TEST_WINDOW
+
+int
+main(int argc, char **argv)
+{
+/* When a job due at now may start under the windows in spec. */
+    struct window_set ws;
+    time_t t;
+
+    if (argc != 3) {
+	fprintf(stderr, "usage: windowtest [now] [windows]\n");
+	exit(EXIT_FAILURE);
+    }
+
+    if (window_parse(argv[2], &ws) == -1) {
+	printf("Ooops...\n");
+	return 1;
+    }
+    t = window_next(&ws, (time_t) atoll(argv[1]));
+    if (t == 0)
+	printf("never\n");
+    else
+	printf("%s", ctime(&t));
+    return 0;
+}
+#endif
@@ -0,0 +1,47 @@
+/*
+ *  window.h - weekly time windows in which jobs may start
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _WINDOW_H
+#define _WINDOW_H
+
+#include <sys/types.h>
+#include <time.h>
+
+/* A window set is written as a comma separated list of
+ * "[days/]HH:MM-HH:MM", in local time, where days is a day name or a
+ * range of them such as "mon-fri" and defaults to every day.  A window
+ * which ends at or before it starts runs past midnight into the next
+ * day.  An empty set means no restriction.
+ */
+#define WINDOW_MAX 8
+
+struct window {
+    unsigned char days;		/* bit 0 for Sunday ... bit 6 for Saturday */
+    short start, end;		/* minutes since midnight */
+};
+
+struct window_set {
+    int n;
+    struct window w[WINDOW_MAX];
+};
+
+int window_parse(const char *spec, struct window_set *ws);
+int window_format(const struct window_set *ws, char *buf, size_t len);
+time_t window_next(const struct window_set *ws, time_t t);
+
+#endif
@@ -0,0 +1,63 @@
+#! /usr/bin/perl
+#
+# window.pl - test suite for the time windows of at queues and jobs
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+
+use strict;
+use warnings;
+
+use Test::More 0.87;
+
+my $windowtest = "./windowtest 2>/dev/null";
+
+sub test {
+	my ($now, $windows, $expected, $test_name) = @_;
+	$test_name = "$now: $windows" unless defined $test_name;
+
+	my $got = qx{$windowtest $now '$windows'};
+	chomp $got;
+	is($got, $expected, $test_name);
+}
+
+$ENV{TZ} = "America/New_York";
+
+# no windows, a malformed one
+test(1705424400, "", "Tue Jan 16 12:00:00 2024");
+test(1705424400, "25:00-26:00", "Ooops...");
+
+# a window past midnight: inside, before, after midnight, at its end
+test(1705464000, "22:00-06:00", "Tue Jan 16 23:00:00 2024");
+test(1705424400, "22:00-06:00", "Tue Jan 16 22:00:00 2024");
+test(1705478400, "22:00-06:00", "Wed Jan 17 03:00:00 2024");
+test(1705489200, "22:00-06:00", "Wed Jan 17 22:00:00 2024");
+
+# weekdays only: Friday night's window runs into Saturday
+test(1705737600, "mon-fri/22:00-06:00", "Sat Jan 20 03:00:00 2024");
+test(1705770000, "mon-fri/22:00-06:00", "Mon Jan 22 22:00:00 2024");
+
+# a range of days round the end of the week, and a list of windows
+test(1705424400, "sat-mon/09:00-10:00", "Sat Jan 20 09:00:00 2024");
+test(1705424400, "mon/08:00-09:00,wed/20:00-21:00",
+     "Wed Jan 17 20:00:00 2024");
+
+# clocks going forward at 02:00 on Sun Mar 10 2024: a window starting in
+# the gap opens as they do, one ending in it closes then
+test(1710046800, "02:30-03:30", "Sun Mar 10 03:00:00 2024");
+test(1710054600, "02:30-03:30", "Sun Mar 10 03:10:00 2024");
+test(1710056400, "02:30-03:30", "Mon Mar 11 02:30:00 2024");
+test(1710046800, "02:00-04:00", "Sun Mar 10 03:00:00 2024");
+test(1710052200, "01:00-02:30", "Sun Mar 10 01:30:00 2024");
+test(1710054600, "01:00-02:30", "Mon Mar 11 01:00:00 2024");
+
+# clocks going back at 02:00 on Sun Nov 3 2024: 01:45 comes twice, and
+# the window is open both times
+test(1730612700, "01:30-02:00", "Sun Nov  3 01:45:00 2024", "01:45 EDT");
+test(1730616300, "01:30-02:00", "Sun Nov  3 01:45:00 2024", "01:45 EST");
+test(1730617200, "01:30-02:00", "Mon Nov  4 01:30:00 2024");
+
+done_testing();
+1;